@@ -0,0 +1,714 @@
+/**
+ * \file bench.cpp
+ * \brief Benchmark workloads and timing comparisons between evaluation modes
+ * \author Laura Zhang
+ *
+ * Every measurement runs its workload a few times to warm up and then
+ * times each of a fixed number of runs separately, so the report can give
+ * the median and percentiles instead of a single best or average time.
+ * With --json=FILE the runs are also written out with every sample, for
+ * tracking the numbers across commits. With --counters the timed runs of
+ * the workloads are also counted with the hardware performance counters,
+ * when the machine has them.
+ */
+
+#include "expr.h"
+#include "parse.h"
+#include "val.h"
+#include "env.h"
+#include "parallel.h"
+#include "typecheck.h"
+#include "compile.h"
+#include "specialize.h"
+#include "profile.h"
+#include "counters.h"
+#include "fuzz.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// runs before the timed ones, and timed runs, of every measurement
+static int warmup = 3;
+static int reps = 15;
+
+// set by --counters when any hardware counter can be opened
+static PerfCounters* counters = nullptr;
+
+// the timings of one workload or of one side of a comparison
+struct Timings {
+    std::vector<double> samples_ms_;
+    std::string         result_;
+    // mean hardware counts per timed run, -1 for events not counted
+    double              counts_[PerfCounters::event_count] = {-1, -1, -1, -1};
+
+    /**
+     * \brief the p-th percentile, interpolated between the two nearest runs
+     * \param p between 0 and 100
+     */
+    double percentile(double p) const {
+        std::vector<double> sorted = samples_ms_;
+        std::sort(sorted.begin(), sorted.end());
+
+        double rank = p / 100 * (sorted.size() - 1);
+        size_t below = (size_t) rank;
+        size_t above = std::min(below + 1, sorted.size() - 1);
+
+        return sorted[below] + (sorted[above] - sorted[below]) * (rank - below);
+    }
+
+    double median() const {
+        return percentile(50);
+    }
+};
+
+/**
+ * \brief time a piece of work after warming it up
+ * \param run the work, returning a printed result that must not change
+ * \param n number of timed runs
+ * \return the time of each timed run and the result
+ */
+static Timings measure(const std::function<std::string()>& run, int n, bool count = false) {
+    Timings t;
+
+    for (int i = 0; i < warmup; i++) {
+        t.result_ = run();
+    }
+    if (count && counters != nullptr) {
+        counters->reset();
+    }
+    for (int i = 0; i < n; i++) {
+        if (count && counters != nullptr) {
+            counters->start();
+        }
+        auto begin = std::chrono::steady_clock::now();
+        std::string result = run();
+        auto end = std::chrono::steady_clock::now();
+        if (count && counters != nullptr) {
+            counters->stop();
+        }
+
+        if (i > 0 || warmup > 0) {
+            if (result != t.result_) {
+                throw std::runtime_error("result changed between runs: " + t.result_ + ", " + result);
+            }
+        }
+        t.result_ = result;
+        t.samples_ms_.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+    if (count && counters != nullptr) {
+        for (int e = 0; e < PerfCounters::event_count; e++) {
+            double total = counters->value((PerfCounters::event_t) e);
+            t.counts_[e] = total < 0 ? -1 : total / n;
+        }
+    }
+
+    return t;
+}
+
+// everything measured, for --json
+static std::ostringstream json_workloads;
+static std::ostringstream json_comparisons;
+
+static void json_samples(std::ostream& out, const Timings& t) {
+    out << "[";
+    for (size_t i = 0; i < t.samples_ms_.size(); i++) {
+        out << (i == 0 ? "" : ",") << t.samples_ms_[i];
+    }
+    out << "]";
+}
+
+static void json_timings(std::ostream& out, const Timings& t) {
+    out << "\"median_ms\":" << t.median()
+        << ",\"p10_ms\":" << t.percentile(10)
+        << ",\"p90_ms\":" << t.percentile(90)
+        << ",\"p99_ms\":" << t.percentile(99)
+        << ",\"min_ms\":" << t.percentile(0)
+        << ",\"max_ms\":" << t.percentile(100)
+        << ",\"samples_ms\":";
+    json_samples(out, t);
+}
+
+// sum(sum)(n) computes 0 + 1 + ... + n through self-application
+static const std::string SUM =
+        "_let sum = _fun (s) _fun (n) _if n == 0 _then 0 _else n + s(s)(n + -1)\n";
+
+/**
+ * \brief a script that binds two expensive values per call but only uses one
+ * \param calls number of calls to the branchy function
+ * \return the script source
+ */
+static std::string branchy_lets(int calls) {
+    std::string s = SUM +
+            "_in _let pick = _fun (k)\n"
+            "                _let a = sum(sum)(1000)\n"
+            "                _in _let b = sum(sum)(1000) * 2\n"
+            "                _in _if k == 0 _then a _else b\n"
+            "_in ";
+
+    for (int i = 0; i < calls; i++) {
+        s += "pick(" + std::to_string(i % 2) + ") + ";
+    }
+
+    return s + "0";
+}
+
+/**
+ * \brief a script that passes expensive arguments that are used on one branch
+ * \param calls number of calls to the branchy function
+ * \return the script source
+ */
+static std::string branchy_args(int calls) {
+    std::string s = SUM +
+            "_in _let choose = _fun (k) _fun (a) _fun (b) _if k == 0 _then a _else b\n"
+            "_in ";
+
+    for (int i = 0; i < calls; i++) {
+        s += "choose(" + std::to_string(i % 2) + ")(sum(sum)(1000))(sum(sum)(500)) + ";
+    }
+
+    return s + "0";
+}
+
+/**
+ * \brief a script whose work is split over many independent recursive calls
+ * \param calls number of independent calls
+ * \return the script source
+ */
+static std::string wide_fib(int calls) {
+    std::string s = "_let fib = _fun (f) _fun (n)\n"
+                    "            _if n == 0 _then 0\n"
+                    "            _else _if n == 1 _then 1\n"
+                    "            _else f(f)(n + -1) + f(f)(n + -2)\n"
+                    "_in ";
+
+    for (int i = 0; i < calls; i++) {
+        s += "fib(fib)(" + std::to_string(14 + i % 4) + ") + ";
+    }
+
+    return s + "0";
+}
+
+/**
+ * \brief a well-typed script of arithmetic, comparisons and closure calls
+ * \param terms number of summed calls
+ * \return the script source
+ */
+static std::string typed_calls(int terms) {
+    std::string s = "_let step = _fun (x) _if x == 7 _then x + 1 _else x * 3 + 1\n"
+                    "_in _let twice = _fun (f) _fun (x) f(f(x))\n"
+                    "_in ";
+
+    for (int i = 0; i < terms; i++) {
+        s += "twice(step)(" + std::to_string(i % 10) + ") * 2 + ";
+    }
+
+    return s + "0";
+}
+
+/**
+ * \brief a script of recursive integer functions the JIT can compile
+ * \param n the argument of fib
+ * \return the script source
+ */
+static std::string integer_recursion(int n) {
+    return "_let fib = _fun (f) _fun (n)\n"
+           "            _if n == 0 _then 0\n"
+           "            _else _if n == 1 _then 1\n"
+           "            _else f(f)(n + -1) + f(f)(n + -2)\n"
+           "_in " + SUM +
+           "_in fib(fib)(" + std::to_string(n) + ") + sum(sum)(1000)";
+}
+
+static void print_header(const std::string& base, const std::string& other) {
+    std::cout << std::left << std::setw(16) << "workload"
+              << std::right << std::setw(15) << base
+              << std::setw(15) << other
+              << std::setw(11) << "speedup" << std::endl;
+}
+
+static void print_row(const std::string& name, double base, double other) {
+    std::cout << std::left << std::setw(16) << name
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << base << " ms"
+              << std::setw(12) << other << " ms"
+              << std::setw(10) << std::setprecision(2) << base / other << "x" << std::endl;
+}
+
+/**
+ * \brief time interpreting the expression
+ * \param e the expression
+ * \param n number of timed runs
+ * \param pool the pool to run it on, or nullptr for the tree walker
+ * \return the timings and printed value
+ */
+static Timings time_interp(PTR(Expr) e, int n, WorkStealingPool* pool = nullptr) {
+    return measure([&]() {
+        return (pool == nullptr ? e->interp(Env::empty) : pool->run(e, Env::empty))->to_string();
+    }, n);
+}
+
+/**
+ * \brief print and record the medians of the two sides of a comparison
+ */
+static void report_comparison(const std::string& base_name, const std::string& other_name,
+                              const std::string& name, const Timings& base, const Timings& other) {
+    if (base.result_ != other.result_) {
+        throw std::runtime_error(name + ": " + base_name + " and " + other_name + " results differ");
+    }
+
+    print_row(name, base.median(), other.median());
+
+    json_comparisons << (json_comparisons.tellp() == 0 ? "\n" : ",\n")
+                     << "    {\"name\":\"" << name << "\",\"base\":\"" << base_name
+                     << "\",\"other\":\"" << other_name << "\",\"speedup\":" << base.median() / other.median()
+                     << ",\"base_samples_ms\":";
+    json_samples(json_comparisons, base);
+    json_comparisons << ",\"other_samples_ms\":";
+    json_samples(json_comparisons, other);
+    json_comparisons << "}";
+}
+
+static void compare_lazy(const std::string& name, const std::string& src) {
+    PTR(Expr) e = parse_str(src);
+
+    Expr::call_by_need = false;
+    Timings eager = time_interp(e, reps);
+    Expr::call_by_need = true;
+    Timings lazy = time_interp(e, reps);
+    Expr::call_by_need = false;
+
+    report_comparison("eager", "lazy", name, eager, lazy);
+}
+
+static void compare_parallel(const std::string& name, const std::string& src, WorkStealingPool& pool) {
+    PTR(Expr) e = parse_str(src);
+
+    Timings tree = time_interp(e, reps);
+    Timings parallel = time_interp(e, reps, &pool);
+
+    report_comparison("tree", "parallel", name, tree, parallel);
+}
+
+static void compare_typed(const std::string& name, const std::string& src) {
+    PTR(Expr) untyped = parse_str(src);
+    PTR(Expr) typed = parse_str(src);
+
+    typecheck(typed);
+
+    Timings checked = time_interp(untyped, reps);
+    Timings unchecked = time_interp(typed, reps);
+
+    report_comparison("checked", "typed", name, checked, unchecked);
+}
+
+static void compare_jit(const std::string& name, const std::string& src) {
+    PTR(Expr) e = parse_str(src);
+
+    FunExpr::use_jit = false;
+    Timings tree = time_interp(e, reps);
+    FunExpr::use_jit = true;
+    Timings jit = time_interp(e, reps);
+    FunExpr::use_jit = false;
+
+    report_comparison("tree", "jit", name, tree, jit);
+}
+
+static void compare_closure(const std::string& name, const std::string& src) {
+    PTR(Expr) e = parse_str(src);
+    PTR(Compiled) code = compile(e);
+
+    Timings tree = time_interp(e, reps);
+    Timings closure = measure([&]() {
+        return code->run()->to_string();
+    }, reps);
+
+    report_comparison("tree", "closure", name, tree, closure);
+}
+
+static void compare_specialized(const std::string& name, const std::string& src) {
+    PTR(Expr) e = parse_str(src);
+    Specializer specializer;
+    PTR(Expr) specialized = specializer.rewrite(parse_str(src));
+
+    Timings tree = time_interp(e, reps);
+    Timings fast = time_interp(specialized, reps);
+
+    report_comparison("tree", "specialized", name, tree, fast);
+}
+
+static void compare_var_cache(const std::string& name, const std::string& src) {
+    PTR(Expr) e = parse_str(src);
+
+    VarExpr::inline_cache = false;
+    Timings walk = time_interp(e, reps);
+    VarExpr::inline_cache = true;
+    Timings cached = time_interp(e, reps);
+
+    report_comparison("env walk", "var cache", name, walk, cached);
+}
+
+/**
+ * \brief a script whose innermost function reads variables bound far out
+ * \param n the argument of the recursive sum
+ * \return the script source
+ */
+static std::string deep_lets(int n) {
+    return "_let a = 1 _in _let b = 2 _in _let c = 3 _in _let d = 4 _in _let e = 5\n"
+           "_in _let sum = _fun (s) _fun (k) _if k == 0 _then 0 _else a + b + c + d + e + s(s)(k + -1)\n"
+           "_in sum(sum)(" + std::to_string(n) + ")";
+}
+
+/**
+ * \brief a variable name for a number, since names can only have letters
+ */
+static std::string letters(int i) {
+    std::string s = "v";
+
+    do {
+        s += (char) ('a' + i % 26);
+        i /= 26;
+    } while (i > 0);
+
+    return s;
+}
+
+/**
+ * \brief a long chain of + and * nested on the right
+ * \param n number of products summed
+ * \return the script source
+ */
+static std::string arith_chain(int n) {
+    std::string s;
+
+    for (int i = 0; i < n; i++) {
+        s += std::to_string(i % 10) + " * " + std::to_string(i % 7 + 1) + " + ";
+    }
+
+    return s + "0";
+}
+
+/**
+ * \brief a chain of _let each using the variable bound by the one before
+ * \param n number of _let expressions
+ * \return the script source
+ */
+static std::string let_chain(int n) {
+    std::string s = "_let " + letters(0) + " = 1\n";
+
+    for (int i = 1; i < n; i++) {
+        s += "_in _let " + letters(i) + " = " + letters(i - 1) + " + " + std::to_string(i % 5) + "\n";
+    }
+
+    return s + "_in " + letters(n - 1);
+}
+
+/**
+ * \brief a script that builds a chain of n composed closures and calls it
+ * \param n number of closures composed
+ * \return the script source
+ */
+static std::string closure_chain(int n) {
+    return "_let compose = _fun (f) _fun (g) _fun (x) f(g(x))\n"
+           "_in _let adder = _fun (k) _fun (x) x + k\n"
+           "_in _let build = _fun (b) _fun (n) _fun (f)\n"
+           "                   _if n == 0 _then f _else b(b)(n + -1)(compose(f)(adder(n)))\n"
+           "_in build(build)(" + std::to_string(n) + ")(adder(0))(1)";
+}
+
+/**
+ * \brief the number of nodes in an expression
+ */
+static long tree_nodes(PTR(Expr) e) {
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        return 1 + tree_nodes(a->lhs_) + tree_nodes(a->rhs_);
+    }
+    if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        return 1 + tree_nodes(m->lhs_) + tree_nodes(m->rhs_);
+    }
+    if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        return 1 + tree_nodes(q->lhs_) + tree_nodes(q->rhs_);
+    }
+    if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        return 1 + tree_nodes(i->condition_) + tree_nodes(i->then_) + tree_nodes(i->else_);
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        return 1 + tree_nodes(l->rhs_) + tree_nodes(l->body_);
+    }
+    if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        return 1 + tree_nodes(f->body_);
+    }
+    if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        return 1 + tree_nodes(c->callee_) + tree_nodes(c->arg_);
+    }
+
+    return 1;
+}
+
+/**
+ * \brief the number of nodes interpreting an expression evaluates, counted
+ * by running it once under the profiler
+ */
+static long evaluated_nodes(PTR(Expr) e) {
+    long n = 0;
+
+    Profiler::reset();
+    Profiler::enable();
+    e->interp(Env::empty);
+    Expr::profiling = false;
+
+    for (auto& type : Profiler::by_type()) {
+        n += type.second.count_;
+    }
+    Profiler::reset();
+
+    return n;
+}
+
+// a named piece of work for the suite, and the number of nodes it
+// evaluates, parses or prints per run
+struct Workload {
+    std::string                  name_;
+    std::function<std::string()> run_;
+    std::function<long()>        nodes_;
+};
+
+/**
+ * \brief time the representative workloads, print a table and record them
+ * \param only run only workloads whose name contains this
+ */
+static void run_suite(const std::string& only) {
+    PTR(Expr) arith = parse_str(arith_chain(5000));
+    PTR(Expr) lets = parse_str(let_chain(5000));
+    PTR(Expr) recursion = parse_str(integer_recursion(18));
+    PTR(Expr) closures = parse_str(closure_chain(2000));
+    std::string large_src = let_chain(1500) + " + " + arith_chain(1500);
+    PTR(Expr) large = parse_str(large_src);
+    std::mt19937_64 rng(1);
+    PTR(Expr) typed = Fuzzer::random_typed_program(rng, 200000);
+
+    std::vector<Workload> workloads = {
+        {"arith-chain", [=]() { return arith->interp(Env::empty)->to_string(); },
+                        [=]() { return evaluated_nodes(arith); }},
+        {"let-chain", [=]() { return lets->interp(Env::empty)->to_string(); },
+                      [=]() { return evaluated_nodes(lets); }},
+        {"self-recursion", [=]() { return recursion->interp(Env::empty)->to_string(); },
+                           [=]() { return evaluated_nodes(recursion); }},
+        {"closure-chain", [=]() { return closures->interp(Env::empty)->to_string(); },
+                          [=]() { return evaluated_nodes(closures); }},
+        {"typed-random", [=]() { return typed->interp(Env::empty)->to_string(); },
+                         [=]() { return evaluated_nodes(typed); }},
+        {"parse-large", [=]() { return std::to_string(parse_str(large_src)->equals(large)); },
+                        [=]() { return tree_nodes(large); }},
+        {"print-large", [=]() { return std::to_string(large->to_string().size()); },
+                        [=]() { return tree_nodes(large); }},
+        {"pretty-print-large", [=]() { return std::to_string(large->to_pretty_string().size()); },
+                               [=]() { return tree_nodes(large); }},
+    };
+    // workloads counted with hardware counters, and their nodes per run
+    std::vector<std::pair<std::string, Timings>> counted;
+    std::vector<double> counted_nodes;
+
+    std::cout << std::left << std::setw(20) << "workload" << std::right
+              << std::setw(12) << "median" << std::setw(12) << "p10" << std::setw(12) << "p90"
+              << std::setw(12) << "p99" << std::setw(12) << "max" << std::endl;
+
+    for (const Workload& w : workloads) {
+        if (w.name_.find(only) == std::string::npos) {
+            continue;
+        }
+
+        Timings t = measure(w.run_, reps, true);
+
+        std::cout << std::left << std::setw(20) << w.name_ << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(9) << t.median() << " ms" << std::setw(9) << t.percentile(10) << " ms"
+                  << std::setw(9) << t.percentile(90) << " ms" << std::setw(9) << t.percentile(99) << " ms"
+                  << std::setw(9) << t.percentile(100) << " ms" << std::endl;
+
+        json_workloads << (json_workloads.tellp() == 0 ? "\n" : ",\n")
+                       << "    {\"name\":\"" << w.name_ << "\",\"result\":\"" << t.result_ << "\",";
+        json_timings(json_workloads, t);
+        json_workloads << ",\"counters\":";
+        if (counters != nullptr) {
+            double nodes = (double) w.nodes_();
+            const char* separator = "{";
+
+            json_workloads << std::setprecision(6);
+            for (int e = 0; e < PerfCounters::event_count; e++) {
+                if (t.counts_[e] >= 0) {
+                    json_workloads << separator << "\"" << PerfCounters::name((PerfCounters::event_t) e)
+                                   << "\":" << t.counts_[e];
+                    separator = ",";
+                }
+            }
+            if (t.counts_[PerfCounters::cycles] > 0 && t.counts_[PerfCounters::instructions] >= 0) {
+                json_workloads << separator << "\"ipc\":"
+                               << t.counts_[PerfCounters::instructions] / t.counts_[PerfCounters::cycles];
+            }
+            json_workloads << ",\"nodes\":" << (long) nodes;
+            if (nodes > 0 && t.counts_[PerfCounters::cache_misses] >= 0) {
+                json_workloads << ",\"cache_misses_per_node\":" << t.counts_[PerfCounters::cache_misses] / nodes;
+            }
+            if (nodes > 0 && t.counts_[PerfCounters::branch_misses] >= 0) {
+                json_workloads << ",\"branch_misses_per_node\":" << t.counts_[PerfCounters::branch_misses] / nodes;
+            }
+            json_workloads << "}";
+            counted.push_back({w.name_, t});
+            counted_nodes.push_back(nodes);
+        }
+        else {
+            json_workloads << "null";
+        }
+        json_workloads << "}";
+    }
+
+    if (counters == nullptr) {
+        return;
+    }
+
+    std::cout << std::endl << std::left << std::setw(20) << "workload" << std::right
+              << std::setw(14) << "instructions" << std::setw(8) << "ipc"
+              << std::setw(16) << "cache miss/node" << std::setw(17) << "branch miss/node" << std::endl;
+    for (size_t i = 0; i < counted.size(); i++) {
+        const double* c = counted[i].second.counts_;
+        double nodes = counted_nodes[i];
+
+        std::cout << std::left << std::setw(20) << counted[i].first << std::right
+                  << std::setw(14) << std::setprecision(0) << c[PerfCounters::instructions]
+                  << std::setw(8) << std::setprecision(2)
+                  << (c[PerfCounters::cycles] > 0 ? c[PerfCounters::instructions] / c[PerfCounters::cycles] : -1)
+                  << std::setw(16) << std::setprecision(4) << (nodes > 0 ? c[PerfCounters::cache_misses] / nodes : -1)
+                  << std::setw(17) << (nodes > 0 ? c[PerfCounters::branch_misses] / nodes : -1) << std::endl;
+    }
+}
+
+/**
+ * \brief time the evaluation modes against each other on the same scripts
+ */
+static void run_comparisons() {
+    std::cout << std::endl;
+    print_header("eager", "lazy");
+    compare_lazy("branchy-lets", branchy_lets(40));
+    compare_lazy("branchy-args", branchy_args(40));
+
+    int threads = (int) std::thread::hardware_concurrency();
+    WorkStealingPool pool(threads, 100);
+
+    std::cout << std::endl;
+    print_header("tree", "parallel");
+    compare_parallel("wide-fib", wide_fib(32), pool);
+    compare_parallel("small-arith", "1 + 2 * 3 + 4 * 5", pool);
+    std::cout << threads << " threads, " << pool.steals() << " steals" << std::endl;
+
+    std::cout << std::endl;
+    print_header("checked", "typed");
+    compare_typed("typed-calls", typed_calls(2000));
+
+    std::cout << std::endl;
+    print_header("tree", "jit");
+    compare_jit("int-recursion", integer_recursion(20));
+    compare_jit("typed-calls", typed_calls(2000));
+
+    std::cout << std::endl;
+    print_header("tree", "closure");
+    compare_closure("int-recursion", integer_recursion(20));
+    compare_closure("typed-calls", typed_calls(2000));
+    compare_closure("branchy-lets", branchy_lets(40));
+
+    std::cout << std::endl;
+    print_header("tree", "specialized");
+    compare_specialized("int-recursion", integer_recursion(20));
+    compare_specialized("typed-calls", typed_calls(2000));
+    compare_specialized("branchy-lets", branchy_lets(40));
+
+    std::cout << std::endl;
+    print_header("env walk", "var cache");
+    compare_var_cache("deep-lets", deep_lets(3000));
+    compare_var_cache("int-recursion", integer_recursion(20));
+}
+
+/**
+ * \brief parse a positive integer given to an option such as --reps=N
+ */
+static int option_int(const std::string& option, const std::string& value) {
+    if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::runtime_error(option + " expects a number");
+    }
+
+    return std::stoi(value);
+}
+
+int main(int argc, const char * argv[]) {
+    try {
+        std::string json_path;
+        std::string only;
+        bool suite_only = false;
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg.rfind("--json=", 0) == 0) {
+                json_path = arg.substr(7);
+            }
+            else if (arg.rfind("--reps=", 0) == 0) {
+                reps = option_int("--reps", arg.substr(7));
+                if (reps < 1) {
+                    throw std::runtime_error("--reps expects at least 1");
+                }
+            }
+            else if (arg.rfind("--warmup=", 0) == 0) {
+                warmup = option_int("--warmup", arg.substr(9));
+            }
+            else if (arg.rfind("--only=", 0) == 0) {
+                only = arg.substr(7);
+                suite_only = true;
+            }
+            else if (arg == "--suite") {
+                suite_only = true;
+            }
+            else if (arg == "--counters") {
+                static PerfCounters perf;
+
+                if (perf.available()) {
+                    counters = &perf;
+                }
+                else {
+                    std::cout << "hardware counters are not available here, timing only" << std::endl;
+                }
+            }
+            else {
+                throw std::runtime_error("usage: bench_msdscript [--suite] [--only=NAME] [--reps=N] [--warmup=N] [--counters] [--json=FILE]");
+            }
+        }
+
+        std::cout << warmup << " warmup runs, median and percentiles of " << reps << " runs" << std::endl << std::endl;
+        run_suite(only);
+
+        if (! suite_only) {
+            run_comparisons();
+        }
+
+        if (! json_path.empty()) {
+            std::ofstream out(json_path);
+
+            out << std::setprecision(6);
+            out << "{\n  \"warmup\": " << warmup << ",\n  \"reps\": " << reps
+                << ",\n  \"workloads\": [" << json_workloads.str() << "\n  ],\n  \"comparisons\": ["
+                << json_comparisons.str() << "\n  ]\n}\n";
+            if (! out) {
+                throw std::runtime_error("cannot write " + json_path);
+            }
+        }
+
+        return 0;
+    }
+    catch (std::runtime_error exn) {
+        std::cerr << exn.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,283 @@
+/**
+ * \file bench_compare.cpp
+ * \brief Compares two --json results of bench_msdscript and fails on a regression
+ * \author Laura Zhang
+ *
+ * Every workload measured in both files is compared sample by sample with
+ * the Mann-Whitney U test. A workload has regressed when its median got
+ * slower by more than the threshold and the test says the difference is
+ * unlikely to be noise. The comparisons of evaluation modes are checked
+ * too, each side as a workload of its own. The exit status is 1 when
+ * anything regressed, so a build can stop on it.
+ */
+
+#include "stats.h"
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * \brief the parts of a JSON value bench_compare reads
+ */
+struct Json {
+    enum kind_t { null, boolean, number, string, array, object };
+
+    kind_t                                    kind_ = null;
+    double                                    number_ = 0;
+    std::string                               string_;
+    std::vector<Json>                         items_;
+    std::vector<std::pair<std::string, Json>> members_;
+
+    /**
+     * \brief the member named key of an object
+     */
+    const Json& operator[](const std::string& key) const {
+        for (auto& member : members_) {
+            if (member.first == key) {
+                return member.second;
+            }
+        }
+        throw std::runtime_error("missing \"" + key + "\" in benchmark results");
+    }
+};
+
+static void skip_space(std::istream& in) {
+    while (isspace(in.peek())) {
+        in.get();
+    }
+}
+
+static void consume(std::istream& in, char expected) {
+    skip_space(in);
+    if (in.get() != expected) {
+        throw std::runtime_error(std::string("expected '") + expected + "' in benchmark results");
+    }
+}
+
+static std::string parse_json_string(std::istream& in) {
+    std::string s;
+
+    consume(in, '"');
+    for (int c = in.get(); c != '"'; c = in.get()) {
+        if (c == EOF) {
+            throw std::runtime_error("unterminated string in benchmark results");
+        }
+        if (c == '\\') {
+            c = in.get();
+        }
+        s += (char) c;
+    }
+
+    return s;
+}
+
+static Json parse_json(std::istream& in) {
+    Json j;
+
+    skip_space(in);
+    int c = in.peek();
+
+    if (c == '{') {
+        j.kind_ = Json::object;
+        in.get();
+        skip_space(in);
+        if (in.peek() == '}') {
+            in.get();
+            return j;
+        }
+        do {
+            std::string key = parse_json_string(in);
+            consume(in, ':');
+            j.members_.push_back({key, parse_json(in)});
+            skip_space(in);
+        } while (in.peek() == ',' && in.get());
+        consume(in, '}');
+    }
+    else if (c == '[') {
+        j.kind_ = Json::array;
+        in.get();
+        skip_space(in);
+        if (in.peek() == ']') {
+            in.get();
+            return j;
+        }
+        do {
+            j.items_.push_back(parse_json(in));
+            skip_space(in);
+        } while (in.peek() == ',' && in.get());
+        consume(in, ']');
+    }
+    else if (c == '"') {
+        j.kind_ = Json::string;
+        j.string_ = parse_json_string(in);
+    }
+    else if (isalpha(c)) {
+        std::string word;
+        while (isalpha(in.peek())) {
+            word += (char) in.get();
+        }
+        if (word == "true" || word == "false") {
+            j.kind_ = Json::boolean;
+            j.number_ = word == "true";
+        }
+        else if (word != "null") {
+            throw std::runtime_error("unexpected '" + word + "' in benchmark results");
+        }
+    }
+    else {
+        j.kind_ = Json::number;
+        if (! (in >> j.number_)) {
+            throw std::runtime_error("unexpected character in benchmark results");
+        }
+    }
+
+    return j;
+}
+
+static std::vector<double> samples(const Json& j) {
+    std::vector<double> v;
+
+    for (const Json& item : j.items_) {
+        v.push_back(item.number_);
+    }
+    if (v.empty()) {
+        throw std::runtime_error("a workload without samples in benchmark results");
+    }
+
+    return v;
+}
+
+/**
+ * \brief read the samples of every workload in a bench_msdscript --json file
+ * \param path the file
+ * \return the samples by workload name, a comparison giving two entries
+ * named "name [mode]"
+ */
+static std::map<std::string, std::vector<double>> read_results(const std::string& path) {
+    std::ifstream in(path);
+    if (! in) {
+        throw std::runtime_error("cannot read " + path);
+    }
+
+    Json results = parse_json(in);
+    std::map<std::string, std::vector<double>> workloads;
+
+    for (const Json& w : results["workloads"].items_) {
+        workloads[w["name"].string_] = samples(w["samples_ms"]);
+    }
+    for (const Json& c : results["comparisons"].items_) {
+        std::string name = c["name"].string_;
+        workloads[name + " [" + c["base"].string_ + "]"] = samples(c["base_samples_ms"]);
+        workloads[name + " [" + c["other"].string_ + "]"] = samples(c["other_samples_ms"]);
+    }
+
+    return workloads;
+}
+
+/**
+ * \brief parse a number given to an option such as --threshold=PCT
+ */
+static double option_double(const std::string& option, const std::string& value) {
+    std::istringstream in(value);
+    double d;
+
+    if (! (in >> d) || ! in.eof() || d < 0) {
+        throw std::runtime_error(option + " expects a non-negative number");
+    }
+
+    return d;
+}
+
+int main(int argc, const char * argv[]) {
+    try {
+        std::vector<std::string> paths;
+        // slowdown of the median, in percent, that counts as a regression
+        double threshold = 5;
+        // p-value below which a difference is not put down to noise
+        double alpha = 0.01;
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg.rfind("--threshold=", 0) == 0) {
+                threshold = option_double("--threshold", arg.substr(12));
+            }
+            else if (arg.rfind("--alpha=", 0) == 0) {
+                alpha = option_double("--alpha", arg.substr(8));
+            }
+            else if (arg.rfind("--", 0) != 0 && paths.size() < 2) {
+                paths.push_back(arg);
+            }
+            else {
+                paths.clear();
+                break;
+            }
+        }
+        if (paths.size() != 2) {
+            std::cerr << "usage: bench_compare [--threshold=PCT] [--alpha=P] BASELINE.json CURRENT.json" << std::endl;
+            return 2;
+        }
+
+        std::map<std::string, std::vector<double>> baseline = read_results(paths[0]);
+        std::map<std::string, std::vector<double>> current = read_results(paths[1]);
+        int regressions = 0;
+
+        std::cout << std::left << std::setw(36) << "workload"
+                  << std::right << std::setw(12) << "base ms" << std::setw(12) << "current ms"
+                  << std::setw(10) << "change" << std::setw(10) << "p" << "  verdict" << std::endl;
+
+        for (auto& entry : current) {
+            auto base = baseline.find(entry.first);
+
+            std::cout << std::left << std::setw(36) << entry.first << std::right;
+            if (base == baseline.end()) {
+                std::cout << std::setw(12) << "-" << std::setw(12) << median(entry.second)
+                          << std::setw(10) << "-" << std::setw(10) << "-" << "  new" << std::endl;
+                continue;
+            }
+
+            double before = median(base->second);
+            double after = median(entry.second);
+            double change = 100 * (after - before) / before;
+            MannWhitney test = mann_whitney(base->second, entry.second);
+            bool significant = test.p_ < alpha;
+            const char* verdict = "same";
+
+            if (significant && change > threshold) {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+            else if (significant && change < -threshold) {
+                verdict = "faster";
+            }
+
+            std::cout << std::fixed << std::setprecision(3)
+                      << std::setw(12) << before << std::setw(12) << after
+                      << std::setprecision(1) << std::setw(9) << std::showpos << change << "%" << std::noshowpos
+                      << std::setprecision(4) << std::setw(10) << test.p_
+                      << "  " << verdict << std::endl;
+        }
+        for (auto& entry : baseline) {
+            if (current.count(entry.first) == 0) {
+                std::cout << std::left << std::setw(36) << entry.first << std::right
+                          << "  missing from " << paths[1] << std::endl;
+            }
+        }
+
+        std::cout << std::endl << regressions << " regression" << (regressions == 1 ? "" : "s")
+                  << " beyond " << std::fixed << std::setprecision(1) << threshold
+                  << "% at p < " << std::defaultfloat << alpha << std::endl;
+
+        return regressions == 0 ? 0 : 1;
+    }
+    catch (std::runtime_error exn) {
+        std::cerr << exn.what() << std::endl;
+        return 2;
+    }
+}
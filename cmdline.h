@@ -1,16 +1,29 @@
 /**
  * \file cmdline.h
- * \brief Declarations of use_arguments
+ * \brief Declarations of use_arguments and serve_worker
  * \author Laura Zhang
  */
 
 #pragma once
 
+#include <iosfwd>
+
 typedef enum {
     do_nothing,
     do_interp,
     do_print,
     do_pretty_print,
+    do_emit_cpp,
+    do_fuzz,
+    do_worker,
 } run_mode_t;
 
+typedef enum {
+    engine_tree,
+    engine_parallel,
+    engine_jit,
+    engine_closure,
+} engine_t;
+
 int use_arguments(int argc, char **argv);
+void serve_worker(run_mode_t mode, std::istream& frames, std::ostream& replies);
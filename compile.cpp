@@ -0,0 +1,291 @@
+/**
+ * \file compile.cpp
+ * \brief Definitions of the closure-compilation engine
+ * \author Laura Zhang
+ *
+ * compile() turns an expression into a tree of lambdas once, so running it
+ * does not dispatch on node types or look variables up by name again. Each
+ * variable is resolved to a slot in the frame of the function that binds
+ * it and the number of frames to walk out to reach it. Common shapes such
+ * as a variable plus a constant get their own lambda, and arithmetic on two
+ * constants is folded.
+ */
+
+#include "compile.h"
+#include "expr.h"
+#include "sample.h"
+#include "trace.h"
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+static const PTR(Val) TRUE_VAL = NEW(BoolVal)(true);
+static const PTR(Val) FALSE_VAL = NEW(BoolVal)(false);
+
+/*
+ * Frame
+ */
+
+Frame::Frame(int size, PTR(Frame) parent) : slots_(size) {
+    parent_ = parent;
+}
+
+/*
+ * Compiled
+ */
+
+Compiled::Compiled(Code code, int slots) {
+    code_ = std::move(code);
+    slots_ = slots;
+}
+
+/**
+ * \brief run compiled top-level code in a fresh frame
+ * \return the value of the expression
+ */
+PTR(Val) Compiled::run() {
+    if (Expr::call_by_need) {
+        throw std::runtime_error("call-by-need evaluation cannot run compiled");
+    }
+
+    return code_(NEW(Frame)(slots_, nullptr));
+}
+
+/*
+ * CompiledFunVal
+ */
+
+CompiledFunVal::CompiledFunVal(PTR(VarExpr) arg, PTR(Expr) body, PTR(Compiled) fun, PTR(Frame) frame)
+        : FunVal(arg, body) {
+    fun_ = fun;
+    frame_ = frame;
+}
+
+/**
+ * \brief run the compiled body with the argument in slot 0 of a new frame
+ * \param arg the argument
+ * \return the value of the body
+ */
+PTR(Val) CompiledFunVal::call(PTR(Val) arg) {
+    SampledCall sampled(body_.get());
+    TraceSpan traced(body_.get());
+    PTR(Frame) frame = NEW(Frame)(fun_->slots_, frame_);
+    frame->slots_[0] = arg;
+
+    return fun_->code_(frame);
+}
+
+/*
+ * compiler
+ */
+
+// the variables of one function body being compiled
+class FunScope {
+public:
+    std::vector<std::pair<std::string, int>> names_;
+    int                                      slots_ = 0;
+    FunScope*                                parent_;
+
+    FunScope(FunScope* parent) {
+        parent_ = parent;
+    }
+
+    int bind(std::string name) {
+        names_.push_back({name, slots_});
+        return slots_++;
+    }
+
+    void unbind() {
+        names_.pop_back();
+    }
+};
+
+/**
+ * \brief find the frame and slot a variable lives in
+ * \param name the variable
+ * \param scope the innermost function scope
+ * \param depth receives the number of parent frames to follow
+ * \return the slot, or -1 for a free variable
+ */
+static int resolve(const std::string& name, FunScope* scope, int& depth) {
+    for (depth = 0; scope != nullptr; scope = scope->parent_, depth++) {
+        for (int i = (int) scope->names_.size() - 1; i >= 0; i--) {
+            if (scope->names_[i].first == name) {
+                return scope->names_[i].second;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static Code compile(PTR(Expr) e, FunScope* scope);
+
+struct AddOp {
+    PTR(Val) operator()(const PTR(Val)& lhs, const PTR(Val)& rhs) const {
+        return lhs->add_to(rhs);
+    }
+};
+
+struct MultOp {
+    PTR(Val) operator()(const PTR(Val)& lhs, const PTR(Val)& rhs) const {
+        return lhs->mult_with(rhs);
+    }
+};
+
+/**
+ * \brief compile + or *, specialized on constant and local variable operands
+ */
+template <typename Op>
+static Code compile_arith(PTR(Expr) lhs, PTR(Expr) rhs, FunScope* scope) {
+    Op op;
+    PTR(NumExpr) lhs_num = CAST(NumExpr)(lhs);
+    PTR(NumExpr) rhs_num = CAST(NumExpr)(rhs);
+    PTR(VarExpr) lhs_var = CAST(VarExpr)(lhs);
+    int depth = -1;
+    int slot = lhs_var == nullptr ? -1 : resolve(lhs_var->var_, scope, depth);
+
+    if (lhs_num != nullptr && rhs_num != nullptr) {
+        PTR(Val) folded = op(NEW(NumVal)(lhs_num->val_), NEW(NumVal)(rhs_num->val_));
+        return [folded](const PTR(Frame)&) {
+            return folded;
+        };
+    }
+    if (slot != -1 && depth == 0 && rhs_num != nullptr) {
+        PTR(Val) c = NEW(NumVal)(rhs_num->val_);
+        return [op, slot, c](const PTR(Frame)& f) {
+            return op(f->slots_[slot], c);
+        };
+    }
+
+    Code l = compile(lhs, scope);
+    Code r = compile(rhs, scope);
+
+    return [op, l = std::move(l), r = std::move(r)](const PTR(Frame)& f) {
+        PTR(Val) lhs_val = l(f);
+        return op(lhs_val, r(f));
+    };
+}
+
+static Code compile(PTR(Expr) e, FunScope* scope) {
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        PTR(Val) v = NEW(NumVal)(n->val_);
+        return [v](const PTR(Frame)&) {
+            return v;
+        };
+    }
+    if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        PTR(Val) v = b->var_ ? TRUE_VAL : FALSE_VAL;
+        return [v](const PTR(Frame)&) {
+            return v;
+        };
+    }
+    if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        std::string name = v->var_;
+        int depth;
+        int slot = resolve(name, scope, depth);
+
+        if (slot == -1) {
+            return [name](const PTR(Frame)&) -> PTR(Val) {
+                throw std::runtime_error("free variable: " + name);
+            };
+        }
+        if (depth == 0) {
+            return [slot](const PTR(Frame)& f) {
+                return f->slots_[slot];
+            };
+        }
+        if (depth == 1) {
+            return [slot](const PTR(Frame)& f) {
+                return f->parent_->slots_[slot];
+            };
+        }
+
+        return [slot, depth](const PTR(Frame)& f) {
+            Frame* frame = f.get();
+            for (int i = 0; i < depth; i++) {
+                frame = frame->parent_.get();
+            }
+            return frame->slots_[slot];
+        };
+    }
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        return compile_arith<AddOp>(a->lhs_, a->rhs_, scope);
+    }
+    if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        return compile_arith<MultOp>(m->lhs_, m->rhs_, scope);
+    }
+    if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        Code l = compile(q->lhs_, scope);
+        PTR(NumExpr) rhs_num = CAST(NumExpr)(q->rhs_);
+
+        if (rhs_num != nullptr) {
+            PTR(Val) c = NEW(NumVal)(rhs_num->val_);
+            return [l = std::move(l), c](const PTR(Frame)& f) {
+                return l(f)->equals(c) ? TRUE_VAL : FALSE_VAL;
+            };
+        }
+
+        Code r = compile(q->rhs_, scope);
+        return [l = std::move(l), r = std::move(r)](const PTR(Frame)& f) {
+            PTR(Val) lhs_val = l(f);
+            return lhs_val->equals(r(f)) ? TRUE_VAL : FALSE_VAL;
+        };
+    }
+    if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        Code c = compile(i->condition_, scope);
+        Code t = compile(i->then_, scope);
+        Code el = compile(i->else_, scope);
+
+        return [c = std::move(c), t = std::move(t), el = std::move(el)](const PTR(Frame)& f) {
+            return c(f)->is_true() ? t(f) : el(f);
+        };
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        Code rhs = compile(l->rhs_, scope);
+        int slot = scope->bind(l->var_);
+        Code body = compile(l->body_, scope);
+        scope->unbind();
+
+        return [slot, rhs = std::move(rhs), body = std::move(body)](const PTR(Frame)& f) {
+            f->slots_[slot] = rhs(f);
+            return body(f);
+        };
+    }
+    if (PTR(FunExpr) fn = CAST(FunExpr)(e)) {
+        FunScope inner(scope);
+        inner.bind(fn->arg_->var_);
+        Code body = compile(fn->body_, &inner);
+
+        PTR(Compiled) fun = NEW(Compiled)(std::move(body), inner.slots_);
+        PTR(VarExpr) arg = fn->arg_;
+        PTR(Expr) body_expr = fn->body_;
+
+        return [arg, body_expr, fun](const PTR(Frame)& f) -> PTR(Val) {
+            return NEW(CompiledFunVal)(arg, body_expr, fun, f);
+        };
+    }
+    if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        Code callee = compile(c->callee_, scope);
+        Code arg = compile(c->arg_, scope);
+
+        return [callee = std::move(callee), arg = std::move(arg)](const PTR(Frame)& f) {
+            PTR(Val) callee_val = callee(f);
+            return callee_val->call(arg(f));
+        };
+    }
+
+    throw std::runtime_error("compile: unknown expression " + e->to_string());
+}
+
+/**
+ * \brief compile an expression to a tree of lambdas
+ * \param e the expression
+ * \return the code, run with Compiled::run()
+ */
+PTR(Compiled) compile(PTR(Expr) e) {
+    FunScope top(nullptr);
+    Code code = compile(e, &top);
+
+    return NEW(Compiled)(std::move(code), top.slots_);
+}
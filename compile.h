@@ -0,0 +1,49 @@
+/**
+ * \file compile.h
+ * \brief Declarations of the closure-compilation engine
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include "val.h"
+#include <functional>
+#include <vector>
+
+class Expr;
+
+class Frame {
+public:
+    // arguments and _let values of one call, addressed by slot
+    std::vector<PTR(Val)> slots_;
+    // frame the called function was created in
+    PTR(Frame)            parent_;
+
+    Frame(int size, PTR(Frame) parent);
+};
+
+typedef std::function<PTR(Val)(const PTR(Frame)&)> Code;
+
+class Compiled {
+public:
+    Code code_;
+    // size of the frame code_ runs in
+    int  slots_;
+
+    Compiled(Code code, int slots);
+
+    PTR(Val) run();
+};
+
+class CompiledFunVal : public FunVal {
+public:
+    PTR(Compiled) fun_;
+    PTR(Frame)    frame_;
+
+    CompiledFunVal(PTR(VarExpr) arg, PTR(Expr) body, PTR(Compiled) fun, PTR(Frame) frame);
+
+    PTR(Val) call(PTR(Val) arg) override;
+};
+
+PTR(Compiled) compile(PTR(Expr) e);
@@ -0,0 +1,375 @@
+/**
+ * \file complexity.cpp
+ * \brief Definitions of the complexity fuzzer behind --complexity
+ * \author Laura Zhang
+ *
+ * A seed picks a structure: a short pattern of frames such as "the body
+ * of a _let" or "the left side of a +", repeated down a spine, with small
+ * random leaves hanging off each frame. The same seed grows the structure
+ * to several depths, and parse, print, pretty print, equals, typecheck and
+ * interp are timed at each. Fitting time = c * n^k over the node counts n
+ * shows how each operation grows; one that grows faster than n log n by
+ * more than n^max_excess is flagged, timed again to rule out noise, and
+ * its seed saved so that --seed=S --complexity=1 shows it again.
+ *
+ * Leaves only use the few innermost variables in scope. An environment is
+ * a chain of bindings, so a variable bound far away costs a walk down the
+ * chain each time, which would make every deep structure quadratic.
+ */
+
+#include "complexity.h"
+#include "expr.h"
+#include "parse.h"
+#include "val.h"
+#include "env.h"
+#include "typecheck.h"
+#include "fuzz.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <streambuf>
+#include <vector>
+
+int Complexity::max_depth = 4096;
+double Complexity::max_excess = 0.3;
+std::string Complexity::seeds_path = "complexity_seeds.txt";
+
+// where the spine continues inside a frame
+typedef enum {
+    frame_let_body,
+    frame_let_rhs,
+    frame_if_then,
+    frame_if_else,
+    frame_if_cond,
+    frame_add_lhs,
+    frame_add_rhs,
+    frame_mult_lhs,
+    frame_mult_rhs,
+    frame_call_arg,
+    frame_fun_body,
+    frame_count,
+} frame_t;
+
+static const char* const frame_names[] = {
+    "let-body", "let-rhs", "if-then", "if-else", "if-cond", "add-lhs",
+    "add-rhs", "mult-lhs", "mult-rhs", "call-arg", "fun-body",
+};
+
+// operations timed on every structure, in the order they are reported
+static const char* const operations[] = {"parse", "print", "pretty-print", "equals", "typecheck", "interp"};
+static const int operation_count = 6;
+
+// a structure made of random programs instead of a repeated pattern
+static const int random_structure = -1;
+
+static int pick(std::mt19937_64& rng, int n) {
+    return (int) (rng() % (unsigned long) n);
+}
+
+/**
+ * \brief the frames a seed repeats down its spine, or just
+ * random_structure for a random well-typed program
+ */
+static std::vector<int> pattern_of(unsigned long seed) {
+    std::mt19937_64 rng(seed);
+
+    if (pick(rng, 6) == 0) {
+        return {random_structure};
+    }
+
+    std::vector<int> pattern(1 + pick(rng, 3));
+    for (int& frame : pattern) {
+        frame = pick(rng, frame_count);
+    }
+
+    return pattern;
+}
+
+/**
+ * \brief a small number, or one of the innermost variables in scope
+ */
+static PTR(Expr) leaf(std::mt19937_64& rng, const std::vector<std::string>& scope) {
+    if (! scope.empty() && pick(rng, 2) == 0) {
+        int reach = std::min((int) scope.size(), 3);
+        return NEW(VarExpr)(scope[scope.size() - 1 - pick(rng, reach)]);
+    }
+
+    return NEW(NumExpr)(pick(rng, 10));
+}
+
+/**
+ * \brief a variable name for frame i, in letters since names have no digits
+ */
+static std::string name_of(int i) {
+    std::string name = "x";
+
+    do {
+        name += (char) ('a' + i % 26);
+        i /= 26;
+    } while (i > 0);
+
+    return name;
+}
+
+// one frame of a spine, with its leaves, waiting for the rest of the spine
+struct Frame {
+    int frame_;
+    std::string name_;
+    PTR(Expr) leaves_[3];
+};
+
+/**
+ * \brief the structure of a seed grown to a spine of depth frames; the
+ * same seed always makes the same structure, deeper ones extending
+ * shallower ones
+ */
+PTR(Expr) Complexity::grow(unsigned long seed, int depth) {
+    std::vector<int> pattern = pattern_of(seed);
+    std::mt19937_64 rng(seed * 2 + 1);
+
+    if (pattern[0] == random_structure) {
+        return Fuzzer::random_typed_program(rng, 4 * depth);
+    }
+
+    // pick the leaves top down, where the scope is known, then build the
+    // expression bottom up
+    std::vector<Frame> frames(depth);
+    std::vector<std::string> scope;
+
+    for (int i = 0; i < depth; i++) {
+        Frame& f = frames[i];
+        f.frame_ = pattern[i % pattern.size()];
+        f.name_ = name_of(i);
+
+        std::vector<std::string> inner = scope;
+        inner.push_back(f.name_);
+        for (PTR(Expr)& l : f.leaves_) {
+            l = leaf(rng, f.frame_ == frame_let_rhs || f.frame_ == frame_call_arg ? inner : scope);
+        }
+        if (f.frame_ == frame_let_body || f.frame_ == frame_fun_body) {
+            scope = inner;
+        }
+    }
+
+    PTR(Expr) e = leaf(rng, scope);
+
+    for (int i = depth - 1; i >= 0; i--) {
+        Frame& f = frames[i];
+        PTR(VarExpr) var = NEW(VarExpr)(f.name_);
+        PTR(Expr)* l = f.leaves_;
+
+        switch (f.frame_) {
+        case frame_let_body:
+            e = NEW(LetExpr)(f.name_, l[0], e);
+            break;
+        case frame_let_rhs:
+            e = NEW(LetExpr)(f.name_, e, NEW(AddExpr)(var, l[0]));
+            break;
+        case frame_if_then:
+            e = NEW(IfExpr)(NEW(BoolExpr)(true), e, l[0]);
+            break;
+        case frame_if_else:
+            e = NEW(IfExpr)(NEW(BoolExpr)(false), l[0], e);
+            break;
+        case frame_if_cond:
+            e = NEW(IfExpr)(NEW(EqExpr)(e, l[0]), l[1], l[2]);
+            break;
+        case frame_add_lhs:
+            e = NEW(AddExpr)(e, l[0]);
+            break;
+        case frame_add_rhs:
+            e = NEW(AddExpr)(l[0], e);
+            break;
+        case frame_mult_lhs:
+            e = NEW(MultExpr)(e, l[0]);
+            break;
+        case frame_mult_rhs:
+            e = NEW(MultExpr)(l[0], e);
+            break;
+        case frame_call_arg:
+            e = NEW(CallExpr)(NEW(FunExpr)(var, NEW(AddExpr)(var, l[0])), e);
+            break;
+        default:
+            e = NEW(CallExpr)(NEW(FunExpr)(var, e), l[0]);
+            break;
+        }
+    }
+
+    return e;
+}
+
+/**
+ * \brief the frames a seed repeats, such as "let-body if-then", or
+ * "random" for a random well-typed program
+ */
+std::string Complexity::describe(unsigned long seed) {
+    std::vector<int> pattern = pattern_of(seed);
+
+    if (pattern[0] == random_structure) {
+        return "random";
+    }
+
+    std::string text;
+    for (int frame : pattern) {
+        text += (text.empty() ? "" : " ") + std::string(frame_names[frame]);
+    }
+
+    return text;
+}
+
+/**
+ * \brief the best of three measurements of the seconds one run of op
+ * takes, each repeating it for at least 2 ms
+ */
+static double seconds_per_run(const std::function<void()>& op) {
+    typedef std::chrono::steady_clock clock;
+    double best = 1e300;
+
+    for (int trial = 0; trial < 3; trial++) {
+        clock::time_point start = clock::now();
+        double elapsed;
+        int runs = 0;
+
+        do {
+            op();
+            runs++;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < 0.002);
+
+        best = std::min(best, elapsed / runs);
+    }
+
+    return best;
+}
+
+// a stream buffer that counts what is written to it and throws it away,
+// so that timing pretty_print does not time a growing string as well
+class CountingBuf : public std::streambuf {
+public:
+    long count_ = 0;
+
+protected:
+    int_type overflow(int_type c) override {
+        count_++;
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        count_ += n;
+        return n;
+    }
+};
+
+// how one structure's operations grow
+struct Growth {
+    std::vector<double> sizes_;
+    std::vector<double> seconds_[operation_count];
+    // bytes of pretty printed output at each size
+    std::vector<double> pretty_bytes_;
+};
+
+/**
+ * \brief time every operation on a seed's structure at depths from
+ * max_depth / 16 up to max_depth
+ */
+static Growth measure(unsigned long seed) {
+    Growth g;
+
+    for (int depth = std::max(Complexity::max_depth / 16, 1); depth <= Complexity::max_depth; depth *= 2) {
+        PTR(Expr) e = Complexity::grow(seed, depth);
+        std::string text = e->to_string();
+        PTR(Expr) copy = parse_str(text);
+        CountingBuf counter;
+        std::ostream sink(&counter);
+        std::function<void()> ops[operation_count] = {
+            [&] { parse_str(text); },
+            [&] { e->to_string(); },
+            [&] { e->pretty_print(sink); },
+            [&] { e->equals(copy); },
+            [&] { typecheck(copy); },
+            [&] { e->interp(Env::empty); },
+        };
+
+        g.sizes_.push_back(Fuzzer::size(e));
+        e->pretty_print(sink);
+        g.pretty_bytes_.push_back(counter.count_);
+        for (int op = 0; op < operation_count; op++) {
+            g.seconds_[op].push_back(seconds_per_run(ops[op]));
+        }
+    }
+
+    return g;
+}
+
+/**
+ * \brief how much faster than n log n an operation grows, as an exponent
+ * of n: about 0 for n log n or less, 1 for n^2 log n
+ */
+static double excess(const std::vector<double>& sizes, const std::vector<double>& seconds) {
+    std::vector<double> per_n_log_n;
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+        per_n_log_n.push_back(seconds[i] / (sizes[i] * std::log2(sizes[i] + 1)));
+    }
+
+    return growth_exponent(sizes, per_n_log_n);
+}
+
+/**
+ * \brief grow structures from consecutive seeds and flag every operation
+ * that grows faster than n log n
+ * \param structures the number of structures
+ * \param seed structure i is made from seed + i
+ * \param out where to print how each structure grows
+ * \return true if nothing was flagged
+ */
+bool Complexity::run(long structures, unsigned long seed, std::ostream& out) {
+    bool all_fine = true;
+
+    for (long i = 0; i < structures; i++) {
+        unsigned long s = seed + i;
+        Growth g = measure(s);
+        std::vector<std::string> flagged;
+
+        out << "seed " << s << " (" << describe(s) << ", " << (long) g.sizes_.front() << " to "
+            << (long) g.sizes_.back() << " nodes):" << std::fixed << std::setprecision(2);
+        for (int op = 0; op < operation_count; op++) {
+            double k = growth_exponent(g.sizes_, g.seconds_[op]);
+            bool over = excess(g.sizes_, g.seconds_[op]) > max_excess;
+
+            // one more measurement, so that a noisy one is not enough
+            if (over) {
+                Growth again = measure(s);
+                over = excess(again.sizes_, again.seconds_[op]) > max_excess;
+            }
+            if (over) {
+                flagged.push_back(operations[op]);
+            }
+            out << " " << operations[op] << " n^" << k << (over ? "!" : "");
+        }
+        out << std::endl;
+
+        if (! flagged.empty()) {
+            all_fine = false;
+
+            std::ofstream saved(seeds_path, std::ios::app);
+            for (const std::string& op : flagged) {
+                saved << s << " " << op << " " << describe(s) << std::endl;
+            }
+
+            out << "  grows faster than n log n: ";
+            for (size_t f = 0; f < flagged.size(); f++) {
+                out << (f == 0 ? "" : ", ") << flagged[f];
+            }
+            out << "; pretty printed output grows as n^" << growth_exponent(g.sizes_, g.pretty_bytes_)
+                << "; seed saved to " << seeds_path << ", run it again with --seed=" << s
+                << " --complexity=1" << std::endl;
+        }
+    }
+
+    return all_fine;
+}
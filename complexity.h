@@ -0,0 +1,27 @@
+/**
+ * \file complexity.h
+ * \brief Declarations of the complexity fuzzer behind --complexity
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <ostream>
+#include <string>
+
+class Expr;
+
+class Complexity {
+public:
+    // deepest nesting run() grows a structure to
+    static int max_depth;
+    // growth beyond n log n, as an exponent of n, that run() flags
+    static double max_excess;
+    // file that run() appends the seeds of flagged structures to
+    static std::string seeds_path;
+
+    static PTR(Expr)   grow(unsigned long seed, int depth);
+    static std::string describe(unsigned long seed);
+    static bool        run(long structures, unsigned long seed, std::ostream& out);
+};
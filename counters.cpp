@@ -0,0 +1,146 @@
+/**
+ * \file counters.cpp
+ * \brief Definitions of the hardware performance counters used by the
+ * benchmark harness
+ * \author Laura Zhang
+ *
+ * Each event is opened with perf_event_open on its own, counting this
+ * process in user space only, so one the CPU or the kernel does not offer
+ * leaves the others working. In a container or a virtual machine without
+ * a PMU, or with perf_event_paranoid set too high, nothing opens and the
+ * harness reports timings only. When the kernel has to share the hardware
+ * counters between events it runs each for part of the time, and values
+ * are scaled up by the time the event was enabled over the time it ran.
+ */
+
+#include "counters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#endif
+
+PerfCounters::PerfCounters() {
+    for (int i = 0; i < event_count; i++) {
+        fds_[i] = -1;
+        totals_[i] = 0;
+    }
+
+#if defined(__linux__)
+    static const uint64_t configs[event_count] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int i = 0; i < event_count; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds_[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for (int i = 0; i < event_count; i++) {
+        if (fds_[i] != -1) {
+            close(fds_[i]);
+        }
+    }
+#endif
+}
+
+/**
+ * \brief whether any event could be opened
+ */
+bool PerfCounters::available() {
+    for (int i = 0; i < event_count; i++) {
+        if (fds_[i] != -1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * \brief whether one event could be opened
+ */
+bool PerfCounters::has(event_t event) {
+    return fds_[event] != -1;
+}
+
+/**
+ * \brief forget the counts added up so far
+ */
+void PerfCounters::reset() {
+    for (int i = 0; i < event_count; i++) {
+        totals_[i] = 0;
+    }
+}
+
+/**
+ * \brief start counting from zero
+ */
+void PerfCounters::start() {
+#if defined(__linux__)
+    for (int i = 0; i < event_count; i++) {
+        if (fds_[i] != -1) {
+            ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/**
+ * \brief stop counting and add the counts since start() to the totals
+ */
+void PerfCounters::stop() {
+#if defined(__linux__)
+    for (int i = 0; i < event_count; i++) {
+        if (fds_[i] != -1) {
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < event_count; i++) {
+        // value, time enabled, time running
+        uint64_t data[3];
+
+        if (fds_[i] != -1 && read(fds_[i], data, sizeof(data)) == (ssize_t) sizeof(data) && data[2] > 0) {
+            totals_[i] += (double) data[0] * ((double) data[1] / (double) data[2]);
+        }
+    }
+#endif
+}
+
+/**
+ * \brief the total of an event over the start() and stop() pairs since
+ * reset(), or -1 if the event is not available
+ */
+double PerfCounters::value(event_t event) {
+    return fds_[event] == -1 ? -1 : totals_[event];
+}
+
+/**
+ * \brief the name of an event in reports
+ */
+const char* PerfCounters::name(event_t event) {
+    static const char* names[event_count] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+    return names[event];
+}
@@ -0,0 +1,37 @@
+/**
+ * \file counters.h
+ * \brief Declarations of the hardware performance counters used by the
+ * benchmark harness
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+class PerfCounters {
+public:
+    typedef enum {
+        cycles,
+        instructions,
+        cache_misses,
+        branch_misses,
+        event_count
+    } event_t;
+
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available();
+    bool has(event_t event);
+    void reset();
+    void start();
+    void stop();
+    double value(event_t event);
+
+    static const char* name(event_t event);
+
+private:
+    int    fds_[event_count];
+    double totals_[event_count];
+};
@@ -0,0 +1,531 @@
+/**
+ * \file emit_cpp.cpp
+ * \brief Definitions of the translator from MSDScript to C++
+ * \author Laura Zhang
+ *
+ * The translation is a function whose parameters are the free variables of
+ * the expression. When type inference gives every node a monomorphic type,
+ * numbers and booleans become int and bool and a function of type a -> b
+ * becomes a shared_ptr to an interface struct in namespace msd. Otherwise
+ * every value is an msd::Value, checked at run time with the same error
+ * messages as the interpreter. Either way each _fun becomes a struct that
+ * holds the variables it captures, and every operation is stored in a
+ * temporary so operands are evaluated left to right as in interp().
+ */
+
+#include "emit_cpp.h"
+#include "expr.h"
+#include <climits>
+#include <stdexcept>
+#include <vector>
+
+// longest part of the source quoted in the header comment
+static const int QUOTE_LIMIT = 200;
+
+// runtime for untyped scripts, guarded so several translations can share it
+static const char* RUNTIME =
+        "#ifndef MSD_RUNTIME\n"
+        "#define MSD_RUNTIME\n"
+        "namespace msd {\n"
+        "struct Closure;\n"
+        "\n"
+        "struct Value {\n"
+        "    enum Kind { num_kind, bool_kind, fun_kind };\n"
+        "    Kind kind_ = num_kind;\n"
+        "    int num_ = 0;\n"
+        "    bool bool_ = false;\n"
+        "    std::shared_ptr<Closure> fun_;\n"
+        "};\n"
+        "\n"
+        "struct Closure {\n"
+        "    int shape_ = -1;\n"
+        "    virtual ~Closure() {}\n"
+        "    virtual Value call(Value arg) = 0;\n"
+        "};\n"
+        "\n"
+        "inline Value num(int n) { Value v; v.kind_ = Value::num_kind; v.num_ = n; return v; }\n"
+        "inline Value boolean(bool b) { Value v; v.kind_ = Value::bool_kind; v.bool_ = b; return v; }\n"
+        "inline Value fun(std::shared_ptr<Closure> f) { Value v; v.kind_ = Value::fun_kind; v.fun_ = f; return v; }\n"
+        "\n"
+        "inline void fail(const Value& v, const char* op) {\n"
+        "    const char* kind = v.kind_ == Value::num_kind ? \"NumVal\" : v.kind_ == Value::bool_kind ? \"BoolVal\" : \"FunVal\";\n"
+        "    throw std::runtime_error(std::string(\"invalid type for \") + kind + \"::\" + op + \"()\");\n"
+        "}\n"
+        "\n"
+        "inline Value add(const Value& a, const Value& b) {\n"
+        "    if (a.kind_ != Value::num_kind || b.kind_ != Value::num_kind) fail(a, \"add_to\");\n"
+        "    return num((int) ((unsigned) a.num_ + (unsigned) b.num_));\n"
+        "}\n"
+        "\n"
+        "inline Value mult(const Value& a, const Value& b) {\n"
+        "    if (a.kind_ != Value::num_kind || b.kind_ != Value::num_kind) fail(a, \"mult_with\");\n"
+        "    return num((int) ((unsigned) a.num_ * (unsigned) b.num_));\n"
+        "}\n"
+        "\n"
+        "inline bool truth(const Value& c) {\n"
+        "    if (c.kind_ != Value::bool_kind) fail(c, \"is_true\");\n"
+        "    return c.bool_;\n"
+        "}\n"
+        "\n"
+        "inline bool equals(const Value& a, const Value& b) {\n"
+        "    if (a.kind_ != b.kind_) return false;\n"
+        "    if (a.kind_ == Value::num_kind) return a.num_ == b.num_;\n"
+        "    if (a.kind_ == Value::bool_kind) return a.bool_ == b.bool_;\n"
+        "    return a.fun_->shape_ == b.fun_->shape_;\n"
+        "}\n"
+        "\n"
+        "inline Value call(const Value& f, const Value& arg) {\n"
+        "    if (f.kind_ != Value::fun_kind) fail(f, \"call\");\n"
+        "    return f.fun_->call(arg);\n"
+        "}\n"
+        "}\n"
+        "#endif\n";
+
+/**
+ * \brief collect the variables used but not bound in an expression
+ * \param e the expression
+ * \param bound variables bound around e
+ * \param free receives the free variables
+ */
+static void free_vars(PTR(Expr) e, std::set<std::string> bound, std::set<std::string>& free) {
+    if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        if (bound.count(v->var_) == 0) {
+            free.insert(v->var_);
+        }
+    }
+    else if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        free_vars(a->lhs_, bound, free);
+        free_vars(a->rhs_, bound, free);
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        free_vars(m->lhs_, bound, free);
+        free_vars(m->rhs_, bound, free);
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        free_vars(q->lhs_, bound, free);
+        free_vars(q->rhs_, bound, free);
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        free_vars(i->condition_, bound, free);
+        free_vars(i->then_, bound, free);
+        free_vars(i->else_, bound, free);
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        free_vars(l->rhs_, bound, free);
+        bound.insert(l->var_);
+        free_vars(l->body_, bound, free);
+    }
+    else if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        bound.insert(f->arg_->var_);
+        free_vars(f->body_, bound, free);
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        free_vars(c->callee_, bound, free);
+        free_vars(c->arg_, bound, free);
+    }
+}
+
+static std::string type_code(PTR(Type) t) {
+    t = t->resolve();
+
+    switch (t->kind_) {
+        case type_int:
+            return "i";
+        case type_bool:
+            return "b";
+        default:
+            return "F" + type_code(t->arg_) + type_code(t->ret_);
+    }
+}
+
+CppEmitter::CppEmitter(std::string name) {
+    name_ = name;
+    typed_ = false;
+    next_name_ = 0;
+    next_closure_ = 0;
+    ti_.allow_free_ = true;
+}
+
+/**
+ * \brief translate an expression to a C++ translation unit
+ * \param e the expression
+ * \return the source of the translation unit
+ */
+std::string CppEmitter::emit(PTR(Expr) e) {
+    try {
+        ti_.infer(e);
+        typed_ = all_typed(e);
+    }
+    catch (std::runtime_error&) {
+        typed_ = false;
+    }
+
+    std::set<std::string> names;
+    free_vars(e, {}, names);
+
+    Scope scope;
+    std::string params;
+    for (const std::string& name : names) {
+        std::string type = typed_ ? ctype(ti_.free_vars()[name]) : "msd::Value";
+
+        scope[name] = {"v_" + name, type};
+        params += (params.empty() ? "" : ", ") + type + " v_" + name;
+    }
+
+    std::ostringstream body;
+    std::string result = gen(e, scope, body, 1);
+    std::string signature = ctype(e) + " " + name_ + "(" + params + ")";
+
+    std::string source = e->to_string();
+    if (source.length() > QUOTE_LIMIT) {
+        source = source.substr(0, QUOTE_LIMIT - 3) + "...";
+    }
+
+    std::ostringstream out;
+    out << "// Generated by msdscript --emit-cpp from:" << std::endl
+        << "//     " << source << std::endl
+        << "// Declare the entry point as:" << std::endl
+        << "//     " << signature << ";" << std::endl
+        << std::endl
+        << "#include <memory>" << std::endl;
+
+    if (! typed_) {
+        out << "#include <stdexcept>" << std::endl
+            << "#include <string>" << std::endl
+            << std::endl
+            << RUNTIME;
+    }
+
+    out << interfaces_.str() << std::endl;
+
+    if (next_closure_ > 0) {
+        out << "namespace " << name_ << "_impl {" << std::endl
+            << closures_.str()
+            << "}" << std::endl
+            << std::endl;
+    }
+
+    out << signature << " {" << std::endl
+        << body.str()
+        << "    return " << result << ";" << std::endl
+        << "}" << std::endl;
+
+    return out.str();
+}
+
+/**
+ * \brief check that inference gave every node a type without variables
+ */
+bool CppEmitter::all_typed(PTR(Expr) e) {
+    std::vector<PTR(Expr)> pending = {e};
+
+    for (auto& free : ti_.free_vars()) {
+        if (! free.second->is_ground()) {
+            return false;
+        }
+    }
+
+    while (! pending.empty()) {
+        PTR(Expr) cur = pending.back();
+        pending.pop_back();
+
+        PTR(Type) t = ti_.type_of(cur.get());
+        if (t == nullptr || ! t->is_ground()) {
+            return false;
+        }
+
+        if (PTR(AddExpr) a = CAST(AddExpr)(cur)) {
+            pending.push_back(a->lhs_);
+            pending.push_back(a->rhs_);
+        }
+        else if (PTR(MultExpr) m = CAST(MultExpr)(cur)) {
+            pending.push_back(m->lhs_);
+            pending.push_back(m->rhs_);
+        }
+        else if (PTR(EqExpr) q = CAST(EqExpr)(cur)) {
+            pending.push_back(q->lhs_);
+            pending.push_back(q->rhs_);
+        }
+        else if (PTR(IfExpr) i = CAST(IfExpr)(cur)) {
+            pending.push_back(i->condition_);
+            pending.push_back(i->then_);
+            pending.push_back(i->else_);
+        }
+        else if (PTR(LetExpr) l = CAST(LetExpr)(cur)) {
+            pending.push_back(l->rhs_);
+            pending.push_back(l->body_);
+        }
+        else if (PTR(FunExpr) f = CAST(FunExpr)(cur)) {
+            pending.push_back(f->body_);
+        }
+        else if (PTR(CallExpr) c = CAST(CallExpr)(cur)) {
+            pending.push_back(c->callee_);
+            pending.push_back(c->arg_);
+        }
+    }
+
+    return true;
+}
+
+std::string CppEmitter::ctype(PTR(Expr) e) {
+    return typed_ ? ctype(ti_.type_of(e.get())) : "msd::Value";
+}
+
+std::string CppEmitter::ctype(PTR(Type) t) {
+    t = t->resolve();
+
+    switch (t->kind_) {
+        case type_int:
+            return "int";
+        case type_bool:
+            return "bool";
+        default:
+            return "std::shared_ptr<" + interface(t) + ">";
+    }
+}
+
+/**
+ * \brief declare the interface struct of a function type, such as msd::Fii
+ * for int -> int, named after the type in prefix form
+ * \param t a function type
+ * \return the qualified name of the struct
+ */
+std::string CppEmitter::interface(PTR(Type) t) {
+    t = t->resolve();
+    std::string code = type_code(t);
+
+    if (declared_.count(code) == 0) {
+        std::string arg = ctype(t->arg_);
+        std::string ret = ctype(t->ret_);
+
+        declared_.insert(code);
+        interfaces_ << std::endl
+                    << "#ifndef MSD_" << code << std::endl
+                    << "#define MSD_" << code << std::endl
+                    << "namespace msd {" << std::endl
+                    << "// " << t->to_string() << std::endl
+                    << "struct " << code << " {" << std::endl
+                    << "    int shape_ = -1;" << std::endl
+                    << "    virtual ~" << code << "() {}" << std::endl
+                    << "    virtual " << ret << " call(" << arg << " arg) = 0;" << std::endl
+                    << "};" << std::endl
+                    << "}" << std::endl
+                    << "#endif" << std::endl;
+    }
+
+    return "msd::" + code;
+}
+
+std::string CppEmitter::fresh(std::string base) {
+    return base + "_" + std::to_string(next_name_++);
+}
+
+/**
+ * \brief number functions so that closures of equal functions compare
+ * equal, as FunVal::equals() compares the code and not the environment
+ */
+int CppEmitter::shape(PTR(FunExpr) f) {
+    for (size_t i = 0; i < shapes_.size(); i++) {
+        if (shapes_[i]->equals(f)) {
+            return (int) i;
+        }
+    }
+
+    shapes_.push_back(f);
+    return (int) shapes_.size() - 1;
+}
+
+/**
+ * \brief generate the struct for a _fun
+ * \param f the function
+ * \param scope the C++ names of the variables around f
+ * \return an expression that makes a closure of f
+ */
+std::string CppEmitter::closure(PTR(FunExpr) f, const Scope& scope) {
+    std::set<std::string> captured;
+    free_vars(f->body_, {f->arg_->var_}, captured);
+
+    std::string name = name_ + "_impl::closure_" + std::to_string(next_closure_);
+    std::string short_name = "closure_" + std::to_string(next_closure_++);
+    std::string base = "msd::Closure";
+    std::string arg_type = "msd::Value";
+    std::string ret_type = "msd::Value";
+
+    if (typed_) {
+        PTR(Type) t = ti_.type_of(f.get());
+        base = interface(t);
+        arg_type = ctype(t->arg_);
+        ret_type = ctype(t->ret_);
+    }
+
+    Scope inner;
+    for (const std::string& var : captured) {
+        inner[var] = scope.at(var);
+    }
+
+    std::string arg = fresh(f->arg_->var_);
+    inner[f->arg_->var_] = {arg, arg_type};
+
+    std::ostringstream body;
+    std::string result = gen(f->body_, inner, body, 2);
+
+    std::string fields, params, inits, args;
+    for (const std::string& var : captured) {
+        const Binding& b = scope.at(var);
+        std::string sep = args.empty() ? "" : ", ";
+
+        fields += "    " + b.ctype_ + " " + b.name_ + ";\n";
+        params += sep + b.ctype_ + " " + b.name_;
+        inits += sep + b.name_ + "(" + b.name_ + ")";
+        args += sep + b.name_;
+    }
+
+    closures_ << std::endl
+              << "// " << f->to_string().substr(0, QUOTE_LIMIT) << std::endl
+              << "struct " << short_name << " : " << base << " {" << std::endl
+              << fields
+              << "    " << short_name << "(" << params << ")" << (inits.empty() ? "" : " : " + inits)
+              << " { shape_ = " << shape(f) << "; }" << std::endl
+              << std::endl
+              << "    " << ret_type << " call(" << arg_type << " " << arg << ") override {" << std::endl
+              << body.str()
+              << "        return " << result << ";" << std::endl
+              << "    }" << std::endl
+              << "};" << std::endl;
+
+    return "std::make_shared<" + name + ">(" + args + ")";
+}
+
+/**
+ * \brief write the statements that evaluate an expression
+ * \param e the expression
+ * \param scope the C++ names of the variables around e
+ * \param out receives the statements
+ * \param indent indentation level of the statements
+ * \return a literal or variable holding the value of e
+ */
+std::string CppEmitter::gen(PTR(Expr) e, const Scope& scope, std::ostream& out, int indent) {
+    std::string pad(indent * 4, ' ');
+
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        std::string lit = n->val_ == INT_MIN ? "(-2147483647 - 1)" : std::to_string(n->val_);
+        return typed_ ? lit : "msd::num(" + lit + ")";
+    }
+    if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        std::string lit = b->var_ ? "true" : "false";
+        return typed_ ? lit : "msd::boolean(" + lit + ")";
+    }
+    if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        return scope.at(v->var_).name_;
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        std::string rhs = gen(l->rhs_, scope, out, indent);
+        std::string var = fresh(l->var_);
+        std::string type = ctype(l->rhs_);
+
+        out << pad << type << " " << var << " = " << rhs << ";" << std::endl;
+
+        Scope body_scope = scope;
+        body_scope[l->var_] = {var, type};
+        return gen(l->body_, body_scope, out, indent);
+    }
+
+    std::string t = fresh("t");
+    std::string type = ctype(e);
+
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        std::string lhs = gen(a->lhs_, scope, out, indent);
+        std::string rhs = gen(a->rhs_, scope, out, indent);
+
+        if (typed_) {
+            out << pad << "int " << t << " = (int) ((unsigned) " << lhs << " + (unsigned) " << rhs << ");" << std::endl;
+        }
+        else {
+            out << pad << "msd::Value " << t << " = msd::add(" << lhs << ", " << rhs << ");" << std::endl;
+        }
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        std::string lhs = gen(m->lhs_, scope, out, indent);
+        std::string rhs = gen(m->rhs_, scope, out, indent);
+
+        if (typed_) {
+            out << pad << "int " << t << " = (int) ((unsigned) " << lhs << " * (unsigned) " << rhs << ");" << std::endl;
+        }
+        else {
+            out << pad << "msd::Value " << t << " = msd::mult(" << lhs << ", " << rhs << ");" << std::endl;
+        }
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        std::string lhs = gen(q->lhs_, scope, out, indent);
+        std::string rhs = gen(q->rhs_, scope, out, indent);
+
+        if (! typed_) {
+            out << pad << "msd::Value " << t << " = msd::boolean(msd::equals(" << lhs << ", " << rhs << "));" << std::endl;
+        }
+        else {
+            PTR(Type) lhs_type = ti_.type_of(q->lhs_.get());
+            PTR(Type) rhs_type = ti_.type_of(q->rhs_.get());
+
+            if (lhs_type->kind_ != rhs_type->kind_) {
+                out << pad << "bool " << t << " = false;" << std::endl;
+            }
+            else if (lhs_type->kind_ == type_fun) {
+                out << pad << "bool " << t << " = " << lhs << "->shape_ == " << rhs << "->shape_;" << std::endl;
+            }
+            else {
+                out << pad << "bool " << t << " = " << lhs << " == " << rhs << ";" << std::endl;
+            }
+        }
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        std::string condition = gen(i->condition_, scope, out, indent);
+
+        out << pad << type << " " << t << "{};" << std::endl;
+        out << pad << "if (" << (typed_ ? condition : "msd::truth(" + condition + ")") << ") {" << std::endl;
+        std::string then_val = gen(i->then_, scope, out, indent + 1);
+        out << pad << "    " << t << " = " << then_val << ";" << std::endl;
+        out << pad << "}" << std::endl;
+        out << pad << "else {" << std::endl;
+        std::string else_val = gen(i->else_, scope, out, indent + 1);
+        out << pad << "    " << t << " = " << else_val << ";" << std::endl;
+        out << pad << "}" << std::endl;
+    }
+    else if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        std::string make = closure(f, scope);
+
+        if (typed_) {
+            out << pad << type << " " << t << " = " << make << ";" << std::endl;
+        }
+        else {
+            out << pad << "msd::Value " << t << " = msd::fun(" << make << ");" << std::endl;
+        }
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        std::string callee = gen(c->callee_, scope, out, indent);
+        std::string arg = gen(c->arg_, scope, out, indent);
+
+        if (typed_) {
+            out << pad << type << " " << t << " = " << callee << "->call(" << arg << ");" << std::endl;
+        }
+        else {
+            out << pad << "msd::Value " << t << " = msd::call(" << callee << ", " << arg << ");" << std::endl;
+        }
+    }
+    else {
+        throw std::runtime_error("emit-cpp: unknown expression " + e->to_string());
+    }
+
+    return t;
+}
+
+/**
+ * \brief translate an expression to a C++ translation unit
+ * \param e the expression
+ * \param name the name of the generated function
+ * \return the source of the translation unit
+ */
+std::string emit_cpp(PTR(Expr) e, std::string name) {
+    CppEmitter emitter(name);
+
+    return emitter.emit(e);
+}
@@ -0,0 +1,55 @@
+/**
+ * \file emit_cpp.h
+ * \brief Declarations of the translator from MSDScript to C++
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include "typecheck.h"
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class Expr;
+class FunExpr;
+
+class CppEmitter {
+public:
+    // whether every value has a known type, so the code uses int and bool
+    bool typed_;
+
+    CppEmitter(std::string name);
+
+    std::string emit(PTR(Expr) e);
+
+private:
+    struct Binding {
+        std::string name_;
+        std::string ctype_;
+    };
+    typedef std::map<std::string, Binding> Scope;
+
+    std::string               name_;
+    TypeInference             ti_;
+    std::ostringstream        interfaces_;
+    std::set<std::string>     declared_;
+    std::ostringstream        closures_;
+    std::vector<PTR(FunExpr)> shapes_;
+    int                       next_name_;
+    int                       next_closure_;
+
+    bool        all_typed(PTR(Expr) e);
+    std::string ctype(PTR(Expr) e);
+    std::string ctype(PTR(Type) t);
+    std::string interface(PTR(Type) t);
+    std::string fresh(std::string base);
+    int         shape(PTR(FunExpr) f);
+    std::string closure(PTR(FunExpr) f, const Scope& scope);
+    std::string gen(PTR(Expr) e, const Scope& scope, std::ostream& out, int indent);
+};
+
+std::string emit_cpp(PTR(Expr) e, std::string name);
@@ -5,6 +5,8 @@
  */
 
 #include "env.h"
+#include "expr.h"
+#include <stdexcept>
 
 PTR(Env) Env::empty = NEW(EmptyEnv)();
 
@@ -26,6 +28,9 @@ ExtendedEnv::ExtendedEnv(std::string name, PTR(Val) val, PTR(Env) rest) {
     name_ = name;
     val_ = val;
     env_ = rest;
+    outer_ = rest.get();
+    binding_ = &name_;
+    bound_val_ = &val_;
 }
 
 bool ExtendedEnv::equals(std::shared_ptr<Env> rhs) {
@@ -47,3 +52,53 @@ PTR(Val) ExtendedEnv::lookup(std::string input) {
 
     return env_->lookup(input);
 }
+
+LazyEnv::LazyEnv(std::string name, PTR(Expr) expr, PTR(Env) expr_env, PTR(Env) rest) {
+    name_ = name;
+    expr_ = expr;
+    expr_env_ = expr_env;
+    val_ = nullptr;
+    env_ = rest;
+    outer_ = rest.get();
+    binding_ = &name_;
+    bound_val_ = &val_;
+}
+
+bool LazyEnv::equals(std::shared_ptr<Env> rhs) {
+    PTR(LazyEnv) lazyEnv = CAST(LazyEnv)(rhs);
+
+    if (lazyEnv == nullptr) {
+        return false;
+    }
+
+    return (name_ == lazyEnv->name_ &&
+            force()->equals(lazyEnv->force()) &&
+            env_->equals(lazyEnv->env_));
+}
+
+PTR(Val) LazyEnv::lookup(std::string input) {
+    if (input == name_) {
+        return force();
+    }
+
+    return env_->lookup(input);
+}
+
+/**
+ * \brief evaluate the bound expression on first use and memoize the result
+ *
+ * If the evaluation throws, nothing is memoized and the expression is kept,
+ * so every later lookup of the same binding throws the same error again.
+ * \return the value of the bound expression
+ */
+PTR(Val) LazyEnv::force() {
+    if (val_ == nullptr) {
+        val_ = expr_->interp(expr_env_);
+
+        // drop the references so the captured environment can be freed
+        expr_ = nullptr;
+        expr_env_ = nullptr;
+    }
+
+    return val_;
+}
@@ -9,10 +9,22 @@
 #include "pointer.h"
 #include "val.h"
 
+class Expr;
+
 CLASS(Env) {
 public:
     static PTR(Env) empty;
 
+    // the next binding out, the name bound here and its value once known,
+    // or nullptr, so that VarExpr::interp() can walk the chain without
+    // virtual calls
+    Env*               outer_ = nullptr;
+    const std::string* binding_ = nullptr;
+    const PTR(Val)*    bound_val_ = nullptr;
+    // set on bindings made by the interpreter, which follow the lexical
+    // nesting of the program
+    bool               lexical_ = false;
+
     virtual PTR(Val) lookup(std::string) = 0;
     virtual bool     equals(PTR(Env) rhs) = 0;
 };
@@ -32,4 +44,22 @@ public:
     ExtendedEnv(std::string, PTR(Val), PTR(Env));
     PTR(Val) lookup(std::string) override;
     bool equals(PTR(Env) rhs) override;
-};
\ No newline at end of file
+};
+
+/**
+ * \brief binding used by call-by-need evaluation: holds the unevaluated
+ * expression and its environment until the first lookup forces it
+ */
+class LazyEnv : public Env {
+public:
+    std::string name_;
+    PTR(Expr)   expr_;
+    PTR(Env)    expr_env_;
+    PTR(Val)    val_;
+    PTR(Env)    env_;
+
+    LazyEnv(std::string, PTR(Expr), PTR(Env), PTR(Env));
+    PTR(Val) lookup(std::string) override;
+    bool equals(PTR(Env) rhs) override;
+    PTR(Val) force();
+};
@@ -4,6 +4,15 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 static const int READ_END  = 0;
 static const int WRITE_END = 1;
@@ -19,13 +28,18 @@ static void wait_until_one_ready(int wr_fd, bool wr_done,
                                  int rd2_fd, bool rd2_done);
 static void pump_to(std::string &str, int fd, bool &done);
 static void pump_from(int fd, std::string &str, bool &done);
-static void wait_child(pid_t pid, int &exit_code);
+static bool wait_for(int fd, short events, std::chrono::steady_clock::time_point deadline);
+static pid_t start_child(const char * const *command, int &in_fd, int &out_fd, int *err_fd);
+static void ignore_sigpipe();
+static void wait_child(pid_t pid, ExecResult &r);
+static void record_status(int status, const struct rusage &usage, ExecResult &r);
 
 // Run the program in command[0], where `command` must be a NULL-terminated
 // array (like `execv` expects). Supply the given string as stdin to the
 // program, wait until it complete, and report its exit status, stdout
 // as a string, and stderr s a string. The exit status is set to a signal
-// number if the program exits with a signal.
+// number if the program exits with a signal. Throws if the program
+// cannot be started.
 ExecResult exec_program(int argc, const char * const *argv, std::string input) {
   // Need a NULL-teriminated array for `execv`:
   const char * command[argc + 1];
@@ -36,66 +50,354 @@ ExecResult exec_program(int argc, const char * const *argv, std::string input) {
   }
   command[argc] = NULL;
 
-  signal(SIGPIPE, SIG_IGN);
-  
+  ignore_sigpipe();
+
+  int in_fd, out_fd, err_fd;
+  pid_t pid = start_child(command, in_fd, out_fd, &err_fd);
+  bool in_done = false, out_done = false, err_done = false;
+  ExecResult r;
+
+  do {
+    wait_until_one_ready(in_fd, in_done,
+                         out_fd, out_done,
+                         err_fd, err_done);
+    pump_to(input, in_fd, in_done);
+    pump_from(out_fd, r.out, out_done);
+    pump_from(err_fd, r.err, err_done);
+  } while (!in_done || !out_done || !err_done);
+
+  wait_child(pid, r);
+
+  return r;
+}
+
+// Start the program in command[0] with pipes for its stdin, stdout and,
+// unless `err_fd` is NULL, stderr, returning the parent's ends of the
+// pipes. The parent's ends are closed on exec, so children started later
+// do not hold them open. posix_spawn launches without copying the page
+// tables of the parent the way fork does, which is most of the cost of a
+// launch when the parent is large.
+static pid_t start_child(const char * const *command, int &in_fd, int &out_fd, int *err_fd) {
   int in[2];
-  if (pipe(in) != 0)
+  if (pipe2(in, O_CLOEXEC) != 0)
     throw std::runtime_error("stdin pipe failed");
-  
+
   int out[2];
-  if (pipe(out) != 0)
+  if (pipe2(out, O_CLOEXEC) != 0)
     throw std::runtime_error("stdout pipe failed");
-  
+
   int err[2];
-  if (pipe(err) != 0)
-    throw std::runtime_error("stdout pipe failed");
+  if (err_fd && pipe2(err, O_CLOEXEC) != 0)
+    throw std::runtime_error("stderr pipe failed");
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[READ_END], STDIN_FD);
+  posix_spawn_file_actions_adddup2(&actions, out[WRITE_END], STDOUT_FD);
+  if (err_fd)
+    posix_spawn_file_actions_adddup2(&actions, err[WRITE_END], STDERR_FD);
+
+  // the child gets its own process group, so that a timeout can kill
+  // everything it started along with it, and the default SIGPIPE that
+  // ignore_sigpipe took away from us
+  posix_spawnattr_t attr;
+  sigset_t defaults;
+  posix_spawnattr_init(&attr);
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
 
-  pid_t pid = fork();
-  if (pid == -1)
-    throw std::runtime_error("fork failed");
-  else if (pid ==  0) {
-    // child
-    dup2(in[READ_END], STDIN_FD);
-    dup2(out[WRITE_END], STDOUT_FD);
-    dup2(err[WRITE_END], STDERR_FD);
-    
-    close(in[READ_END]);
+  pid_t pid;
+  int rtn = posix_spawn(&pid, command[0], &actions, &attr, (char * const *)command, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  close(in[READ_END]);
+  close(out[WRITE_END]);
+  if (err_fd)
+    close(err[WRITE_END]);
+
+  if (rtn != 0) {
     close(in[WRITE_END]);
     close(out[READ_END]);
-    close(out[WRITE_END]);
-    close(err[READ_END]);
-    close(err[WRITE_END]);
-    
-    execv(command[0], (char * const *)command);
-    
-    // Getting here means that the execve failed
-    {
-      const char *msg = "exec failed\n";
-      write(STDERR_FD, msg, strlen(msg));
-      exit(1);
+    if (err_fd)
+      close(err[READ_END]);
+    throw std::runtime_error(std::string("exec failed: ") + command[0] + ": " + strerror(rtn));
+  }
+
+  in_fd = in[WRITE_END];
+  out_fd = out[READ_END];
+  if (err_fd)
+    *err_fd = err[READ_END];
+
+  return pid;
+}
+
+// Ignore SIGPIPE, so that writing to a child that has exited fails with
+// EPIPE instead of killing us. Done once; children get the default back.
+static void ignore_sigpipe() {
+  static bool ignored = false;
+  if (!ignored) {
+    signal(SIGPIPE, SIG_IGN);
+    ignored = true;
+  }
+}
+
+// A program started by ExecPool::run and not yet reaped
+struct RunningChild {
+  size_t job;
+  pid_t pid;
+  std::string input;
+  int fds[3];
+  bool done[3];
+  std::chrono::steady_clock::time_point deadline;
+};
+
+ExecPool::ExecPool(int max_children, double timeout_seconds) {
+  if (max_children < 1)
+    throw std::runtime_error("an ExecPool needs at least one child");
+  this->max_children = max_children;
+  this->timeout_seconds = timeout_seconds;
+}
+
+// Run every job, keeping up to `max_children` of them running at once,
+// and return their results in the order of the jobs. A job still running
+// after `timeout_seconds` is killed with SIGKILL and reported with
+// `timed_out` set. CPU times and peak RSS come from wait4.
+std::vector<ExecResult> ExecPool::run(const std::vector<ExecJob> &jobs) {
+  typedef std::chrono::steady_clock clock;
+  std::vector<ExecResult> results(jobs.size());
+  std::vector<RunningChild> running;
+  size_t next = 0;
+
+  ignore_sigpipe();
+
+  while (next < jobs.size() || !running.empty()) {
+    while ((int)running.size() < max_children && next < jobs.size()) {
+      const ExecJob &job = jobs[next];
+      std::vector<const char *> command;
+      for (const std::string &arg : job.argv)
+        command.push_back(arg.c_str());
+      command.push_back(NULL);
+
+      RunningChild c;
+      c.job = next++;
+      c.input = job.input;
+      c.pid = start_child(command.data(), c.fds[0], c.fds[1], &c.fds[2]);
+      c.done[0] = c.done[1] = c.done[2] = false;
+      c.deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+                       std::chrono::duration<double>(timeout_seconds));
+      running.push_back(c);
     }
-  } else {
-    // parent
-    bool in_done = false, out_done = false, err_done = false;
-    ExecResult r;
 
-    close(in[READ_END]);
-    close(out[WRITE_END]);
-    close(err[WRITE_END]);
-    
+    // wait for any pipe, or until the next deadline
+    std::vector<struct pollfd> poll_info;
+    clock::time_point wake = clock::now() + std::chrono::milliseconds(100);
+    for (RunningChild &c : running) {
+      for (int i = 0; i < 3; i++) {
+        if (!c.done[i]) {
+          struct pollfd p;
+          p.fd = c.fds[i];
+          p.events = (i == 0 ? POLLOUT : POLLIN);
+          p.revents = 0;
+          poll_info.push_back(p);
+        }
+      }
+      wake = std::min(wake, c.deadline);
+      // a child whose output is closed is about to exit, look again soon
+      if (c.done[1] && c.done[2])
+        wake = std::min(wake, clock::now() + std::chrono::milliseconds(1));
+    }
+    int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - clock::now()).count();
+    int rtn;
     do {
-      wait_until_one_ready(in[WRITE_END], in_done,
-                           out[READ_END], out_done,
-                           err[READ_END], err_done);
-      pump_to(input, in[WRITE_END], in_done);
-      pump_from(out[READ_END], r.out, out_done);
-      pump_from(err[READ_END], r.err, err_done);
-    } while (!in_done || !out_done || !err_done);
-    
-    wait_child(pid, r.exit_code);
-    
+      rtn = poll(poll_info.data(), poll_info.size(), std::max(wait_ms, 1));
+    } while (needs_retry(rtn));
+    if (rtn == -1)
+      throw std::runtime_error("poll failed");
+
+    for (size_t k = 0; k < running.size(); k++) {
+      RunningChild &c = running[k];
+      ExecResult &r = results[c.job];
+
+      pump_to(c.input, c.fds[0], c.done[0]);
+      pump_from(c.fds[1], r.out, c.done[1]);
+      pump_from(c.fds[2], r.err, c.done[2]);
+
+      if (!r.timed_out && clock::now() >= c.deadline) {
+        kill(-c.pid, SIGKILL);
+        r.timed_out = true;
+      }
+
+      // reap it once it has exited and its output is read
+      int status;
+      struct rusage usage;
+      if (c.done[1] && c.done[2]) {
+        pid_t done;
+        do {
+          done = wait4(c.pid, &status, WNOHANG, &usage);
+        } while (needs_retry(done));
+        if (done == -1)
+          throw std::runtime_error("wait4 failed");
+        if (done == c.pid) {
+          if (!c.done[0])
+            close(c.fds[0]);
+          record_status(status, usage, r);
+          running.erase(running.begin() + k);
+          k--;
+        }
+      }
+    }
+  }
+
+  return results;
+}
+
+ExecWorker::ExecWorker(const std::vector<std::string> &argv, double timeout_seconds) {
+  this->argv = argv;
+  this->timeout_seconds = timeout_seconds;
+  pid = 0;
+  ignore_sigpipe();
+  start();
+}
+
+// Close the worker's input, which asks it to exit, and wait for it
+ExecWorker::~ExecWorker() {
+  if (pid == 0)
+    return;
+  close(in_fd);
+  close(out_fd);
+  ExecResult r;
+  try {
+    wait_child(pid, r);
+  } catch (std::runtime_error &) {
+    // nothing more to do for a worker that is already gone
+  }
+}
+
+// Send one input to the worker and wait for its reply. The same pipes
+// carry every input, so nothing is created per call. A worker that does
+// not reply by the deadline is killed and reported with `timed_out` set,
+// and one that exits instead of replying is reported with its exit code
+// or signal; either way the next input starts a new worker.
+ExecResult ExecWorker::run(const std::string &input) {
+  if (pid == 0)
+    start();
+
+  clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+                                   std::chrono::duration<double>(timeout_seconds));
+  std::string frame = std::to_string(input.size()) + "\n" + input;
+  ExecResult r;
+  size_t newline = 0, out_len = 0, err_len = 0;
+
+  bool replied = write_all(frame, deadline);
+  while (replied && (newline = pending.find('\n')) == std::string::npos)
+    replied = read_at_least(pending.size() + 1, deadline);
+  if (replied) {
+    if (sscanf(pending.c_str(), "%d %zu %zu", &r.exit_code, &out_len, &err_len) != 3)
+      throw std::runtime_error("bad reply from worker");
+    pending.erase(0, newline + 1);
+    replied = read_at_least(out_len + err_len, deadline);
+  }
+
+  if (!replied) {
+    r.timed_out = clock::now() >= deadline;
+    stop(r);
     return r;
   }
+
+  r.out = pending.substr(0, out_len);
+  r.err = pending.substr(out_len, err_len);
+  pending.erase(0, out_len + err_len);
+
+  return r;
+}
+
+// Start the program. Its input is nonblocking so that a write to a
+// worker that has stopped reading cannot outlast the deadline.
+void ExecWorker::start() {
+  std::vector<const char *> command;
+  for (const std::string &arg : argv)
+    command.push_back(arg.c_str());
+  command.push_back(NULL);
+
+  pid = start_child(command.data(), in_fd, out_fd, NULL);
+  nonblocking(in_fd, true);
+  pending.clear();
+}
+
+// Kill the program along with its process group, reap it, and report
+// how it ended in `r`. The CPU times and RSS cover every input it ran,
+// so they are left out.
+void ExecWorker::stop(ExecResult &r) {
+  kill(-pid, SIGKILL);
+  close(in_fd);
+  close(out_fd);
+
+  ExecResult ended;
+  wait_child(pid, ended);
+  r.exit_code = ended.exit_code;
+  pid = 0;
+}
+
+// Write all of `frame` to the worker, returning false if the worker
+// has gone or the deadline passes first
+bool ExecWorker::write_all(const std::string &frame, clock::time_point deadline) {
+  size_t sent = 0;
+  while (sent < frame.size()) {
+    if (!wait_for(in_fd, POLLOUT, deadline))
+      return false;
+    ssize_t len = write(in_fd, frame.data() + sent, frame.size() - sent);
+    if (needs_retry((int)len) || (len < 0 && errno == EAGAIN))
+      continue;
+    if (len < 0)
+      return false;
+    sent += len;
+  }
+  return true;
+}
+
+// Read from the worker until `pending` holds at least `n` bytes,
+// returning false if the worker has gone or the deadline passes first
+bool ExecWorker::read_at_least(size_t n, clock::time_point deadline) {
+  char buffer[4096];
+  while (pending.size() < n) {
+    if (!wait_for(out_fd, POLLIN, deadline))
+      return false;
+    ssize_t len = read(out_fd, buffer, sizeof(buffer));
+    if (needs_retry((int)len))
+      continue;
+    if (len <= 0)
+      return false;
+    pending.append(buffer, len);
+  }
+  return true;
+}
+
+// Block until `fd` is ready for `events` or has hung up, returning false
+// if the deadline passes first
+static bool wait_for(int fd, short events, std::chrono::steady_clock::time_point deadline) {
+  typedef std::chrono::steady_clock clock;
+  while (true) {
+    clock::time_point now = clock::now();
+    if (now >= deadline)
+      return false;
+    int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+
+    struct pollfd p;
+    p.fd = fd;
+    p.events = events;
+    p.revents = 0;
+    int rtn = poll(&p, 1, std::max(wait_ms, 1));
+    if (needs_retry(rtn))
+      continue;
+    if (rtn == -1)
+      throw std::runtime_error("poll failed");
+    if (rtn > 0)
+      return true;
+  }
 }
 
 // Enable/disable nonblocking mode for a file descriptor
@@ -201,19 +503,30 @@ static void pump_from(int fd, std::string &str, bool &done) {
 }
 
 // Wait until a process has terminated
-static void wait_child(pid_t pid, int &exit_code) {
+static void wait_child(pid_t pid, ExecResult &r) {
   int status;
+  struct rusage usage;
   pid_t rtn;
-  
+
   do {
-    rtn = waitpid(pid, &status, 0);
+    rtn = wait4(pid, &status, 0, &usage);
   } while (needs_retry(rtn));
   if (rtn == -1)
     throw std::runtime_error("waitpid failed");
+  record_status(status, usage, r);
+}
+
+// Fill in the exit code and resource use of a terminated process. The
+// exit code is the signal number if the process exited with a signal.
+static void record_status(int status, const struct rusage &usage, ExecResult &r) {
   if (WIFEXITED(status))
-    exit_code = WEXITSTATUS(status);
+    r.exit_code = WEXITSTATUS(status);
   else if (WIFSIGNALED(status))
-    exit_code = WTERMSIG(status);
+    r.exit_code = WTERMSIG(status);
   else
     throw std::runtime_error("unrecognized status from waitpid");
+
+  r.user_ms = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0;
+  r.sys_ms = usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+  r.max_rss_kb = usage.ru_maxrss;
 }
@@ -1,20 +1,91 @@
 #ifndef exec_hpp
 #define exec_hpp
 
+#include <chrono>
 #include <string>
+#include <sys/types.h>
+#include <vector>
 
 class ExecResult {
 public:
   int exit_code;
   std::string out;
   std::string err;
+  // killed for running past its timeout
+  bool timed_out;
+  // CPU time of the child, from wait4
+  double user_ms;
+  double sys_ms;
+  // peak resident set size of the child
+  long max_rss_kb;
   ExecResult() {
     exit_code = 0;
     out = "";
     err = "";
+    timed_out = false;
+    user_ms = 0;
+    sys_ms = 0;
+    max_rss_kb = 0;
   }
 };
 
+// A program to run with ExecPool: its arguments, program path first,
+// and its standard input
+class ExecJob {
+public:
+  std::vector<std::string> argv;
+  std::string input;
+};
+
+// Runs many programs at once, at most `max_children` at a time, killing
+// any that runs longer than `timeout_seconds`
+class ExecPool {
+public:
+  ExecPool(int max_children, double timeout_seconds);
+
+  std::vector<ExecResult> run(const std::vector<ExecJob> &jobs);
+
+private:
+  int max_children;
+  double timeout_seconds;
+};
+
+// Keeps one program running and sends it many inputs, one after another,
+// so that a test loop does not pay for a launch per input. The program
+// must speak the framed protocol of `msdscript --worker=MODE`: a request
+// is a decimal byte count and a newline followed by that many bytes of
+// input, and a reply is "CODE OUTLEN ERRLEN\n" followed by the output
+// and the error output. The worker's own stderr is ours. Results carry
+// no CPU times or RSS, since those are not per input. An input that
+// takes longer than `timeout_seconds`, or that makes the program exit,
+// costs the program: it is killed and the next input starts a new one.
+class ExecWorker {
+public:
+  ExecWorker(const std::vector<std::string> &argv, double timeout_seconds);
+  ~ExecWorker();
+
+  ExecResult run(const std::string &input);
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  std::vector<std::string> argv;
+  double timeout_seconds;
+  // 0 while no program is running
+  pid_t pid;
+  int in_fd;
+  int out_fd;
+  // reply bytes read but not yet used
+  std::string pending;
+
+  ExecWorker(const ExecWorker &);
+  ExecWorker &operator=(const ExecWorker &);
+  void start();
+  void stop(ExecResult &r);
+  bool write_all(const std::string &frame, clock::time_point deadline);
+  bool read_at_least(size_t n, clock::time_point deadline);
+};
+
 extern ExecResult exec_program(int argc, const char * const *argv, std::string input);
 
 #endif /* exec_hpp */
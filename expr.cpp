@@ -6,12 +6,47 @@
 
 #include "expr.h"
 #include "val.h"
+#include "parallel.h"
+#include "jit.h"
+#include "output.h"
 #include <stdexcept>
 #include <sstream>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 /*
  * Expr
  */
+thread_local bool Expr::call_by_need = false;
+bool Expr::profiling = false;
+thread_local bool FunExpr::use_jit = false;
+bool VarExpr::inline_cache = true;
+bool VarExpr::cache_stats = false;
+std::atomic<long> VarExpr::cache_hits(0);
+std::atomic<long> VarExpr::cache_misses(0);
+
+/**
+ * \brief evaluate two operands in order, or in parallel when the parallel
+ * engine is running and both are expensive enough to be worth a fork
+ * \param lhs the left operand
+ * \param rhs the right operand
+ * \param env the environment
+ * \param lhs_val receives the value of lhs
+ * \param rhs_val receives the value of rhs
+ */
+static void interp_operands(PTR(Expr) lhs, PTR(Expr) rhs, PTR(Env) env,
+                            PTR(Val)& lhs_val, PTR(Val)& rhs_val) {
+    WorkStealingPool* pool = WorkStealingPool::current;
+
+    if (pool != nullptr && lhs->cost_ >= pool->grain_ && rhs->cost_ >= pool->grain_) {
+        pool->fork_join(lhs, rhs, env, lhs_val, rhs_val);
+        return;
+    }
+
+    lhs_val = lhs->interp(env);
+    rhs_val = rhs->interp(env);
+}
 
 /**
  * \brief convert stringstream to string
@@ -27,23 +62,186 @@ std::string Expr::to_string() {
 /**
  * \brief driver function of pretty_print_at()
  * \param ot ostream
+ * \param width the longest line to aim for, 0 for no limit
+ */
+void Expr::pretty_print(std::ostream& ot, int width) {
+    PrettyWriter writer(ot, width);
+    pretty_print_at(writer, prec_none, false, false);
+    writer.finish();
+}
+
+/**
+ * \brief the number of subexpressions, none unless a subclass says so
+ */
+int Expr::child_count() {
+    return 0;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* Expr::child(int i) {
+    return nullptr;
+}
+
+// a node whose parts are being written: the next part is part_
+struct PrintStep {
+    Expr* e_;
+    int   part_;
+};
+
+/**
+ * \brief print the Expr: each node writes its text around its
+ * subexpressions, see print_part()
+ * \param ot ostream
  */
-void Expr::pretty_print(std::ostream& ot) {
-    std::streampos begin_pos = ot.tellp();
-    pretty_print_at(ot, prec_none, false, false, begin_pos);
+void Expr::print(std::ostream& ot) {
+    std::vector<PrintStep> stack = {{this, 0}};
+
+    while (! stack.empty()) {
+        PrintStep& top = stack.back();
+        Expr* e = top.e_;
+        int part = top.part_++;
+
+        e->print_part(ot, part);
+        if (part == e->child_count()) {
+            stack.pop_back();
+        }
+        else {
+            stack.push_back({e->child(part), 0});
+        }
+    }
+}
+
+// a node being pretty printed, where, and its next part
+struct PrettyStep {
+    Expr*       e_;
+    PrettyPlace at_;
+    int         part_;
+};
+
+/**
+ * \brief print the Expr in a pretty format
+ * \param ot where the text goes, and its column
+ * \param p precedence of the previous Expr
+ * \param left if the current Expr is on the left hand side of the previous Expr
+ * \param parenthesized if the previous Expr is parenthesized
+ */
+void Expr::pretty_print_at(PrettyWriter& ot, precedence_t p, bool left, bool parenthesized) {
+    std::vector<PrettyStep> stack = {{this, {p, left, parenthesized}, 0}};
+
+    while (! stack.empty()) {
+        PrettyStep& top = stack.back();
+        Expr* e = top.e_;
+        int part = top.part_++;
+        PrettyPlace kid = {prec_none, false, false};
+
+        e->pretty_part(ot, top.at_, part, kid);
+        if (part == e->child_count()) {
+            stack.pop_back();
+        }
+        else {
+            stack.push_back({e->child(part), kid, 0});
+        }
+    }
+}
+
+/**
+ * \brief check if two expressions are the same tree, node by node
+ * \param e the expression to compare with
+ * \return true if they are equal, false if e is NULL
+ */
+bool Expr::equals(PTR(Expr) e) {
+    if (e == nullptr) {
+        return false;
+    }
+
+    std::vector<std::pair<Expr*, Expr*>> stack = {{this, &*e}};
+
+    while (! stack.empty()) {
+        Expr* a = stack.back().first;
+        Expr* b = stack.back().second;
+        stack.pop_back();
+
+        int n = a->child_count();
+        if (! a->same_node(b) || b->child_count() != n) {
+            return false;
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            stack.push_back({a->child(i), b->child(i)});
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief release a subexpression from a destructor without recursing: one
+ * that nothing else holds is queued, and the outermost destructor frees the
+ * queue, so freeing a deep tree takes no more C++ stack than a shallow one
+ * \param kid the subexpression
+ */
+void Expr::dispose(PTR(Expr)& kid) {
+#if ! USE_PLAIN_POINTERS
+    // the queue of the outermost call, while it runs; a plain pointer, so
+    // that nothing about it is destroyed at thread exit
+    static thread_local std::vector<PTR(Expr)>* queue = nullptr;
+
+    if (kid == nullptr || kid.use_count() != 1) {
+        return;
+    }
+    if (queue != nullptr) {
+        queue->push_back(std::move(kid));
+        return;
+    }
+
+    std::vector<PTR(Expr)> pending;
+    pending.push_back(std::move(kid));
+    queue = &pending;
+    while (! pending.empty()) {
+        // its destructor queues its own subexpressions
+        PTR(Expr) last = std::move(pending.back());
+        pending.pop_back();
+        last.reset();
+    }
+    queue = nullptr;
+#endif
 }
 
 /**
  * \brief for testing
+ * \param width the longest line to aim for, 0 for no limit
  * \return string version of stringstream
  */
-std::string Expr::to_pretty_string() {
+std::string Expr::to_pretty_string(int width) {
     std::stringstream st;
-    pretty_print(st);
+    pretty_print(st, width);
 
     return st.str();
 }
 
+/**
+ * \brief the number of nodes on the longest path down from this one,
+ * found with a stack of its own like print()
+ */
+int Expr::depth() {
+    std::vector<std::pair<Expr*, int>> pending = {{this, 1}};
+    int deepest = 0;
+
+    while (! pending.empty()) {
+        Expr* e = pending.back().first;
+        int d = pending.back().second;
+        pending.pop_back();
+
+        deepest = std::max(deepest, d);
+        for (int i = 0; i < e->child_count(); i++) {
+            pending.push_back({e->child(i), d + 1});
+        }
+    }
+
+    return deepest;
+}
+
 /*
  * NumExpr
  */
@@ -52,25 +250,20 @@ NumExpr::NumExpr(int val) {
 }
 
 /**
- * \brief check if two NumExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two NumExprs are equal, false if rhs is NULL
+ * \brief check if e is a NumExpr with the same value
+ * \param e the node to compare with
  */
-bool NumExpr::equals(PTR(Expr) rhs) {
-    PTR(NumExpr) n = CAST(NumExpr)(rhs);
-    
-    if (n == nullptr) {
-        return false;
-    }
-    
-    return val_ == n->val_;
+bool NumExpr::same_node(Expr* e) {
+    NumExpr* n = dynamic_cast<NumExpr*>(e);
+
+    return n != nullptr && val_ == n->val_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the value of a NumExpr
  */
-PTR(Val) NumExpr::interp(PTR(Env) env) {
+PTR(Val) NumExpr::do_interp(PTR(Env) env) {
     return NEW(NumVal)(val_);
 }
 
@@ -94,22 +287,25 @@ PTR(Val) NumExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void NumExpr::print(std::ostream& ot) {
-    ot << std::to_string(val_);
+void NumExpr::print_part(std::ostream& ot, int i) {
+    write_int(ot, val_);
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void NumExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void NumExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
     ot << val_;
 }
 
@@ -122,26 +318,53 @@ AddExpr::AddExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
 }
 
 /**
- * \brief check if two AddExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two AddExprs are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool AddExpr::equals(PTR(Expr) rhs) {
-    PTR(AddExpr) a = CAST(AddExpr)(rhs);
-    
-    if (a == nullptr) {
-        return false;
+AddExpr::~AddExpr() {
+    dispose(lhs_);
+    dispose(rhs_);
+}
+
+/**
+ * \brief check if e is an AddExpr, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool AddExpr::same_node(Expr* e) {
+    return dynamic_cast<AddExpr*>(e) != nullptr;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int AddExpr::child_count() {
+    return 2;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* AddExpr::child(int i) {
+    if (i == 0) {
+        return &*lhs_;
     }
-    
-    return lhs_->equals(a->lhs_) && rhs_->equals(a->rhs_);
+
+    return &*rhs_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the sum of the subexpression values
  */
-PTR(Val) AddExpr::interp(PTR(Env) env) {
-    return lhs_->interp(env)->add_to(rhs_->interp(env));
+PTR(Val) AddExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs, rhs;
+    interp_operands(lhs_, rhs_, env, lhs, rhs);
+
+    if (typed_) {
+        return NEW(NumVal)(UNCHECKED_CAST(NumVal)(lhs)->val_ + UNCHECKED_CAST(NumVal)(rhs)->val_);
+    }
+
+    return lhs->add_to(rhs);
 }
 
 /**
@@ -165,36 +388,52 @@ PTR(Val) AddExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void AddExpr::print(std::ostream& ot) {
-    ot << "(";
-    lhs_->print(ot);
-    ot << "+";
-    rhs_->print(ot);
-    ot << ")";
+void AddExpr::print_part(std::ostream& ot, int i) {
+    ot << (i == 0 ? "(" : i == 1 ? "+" : ")");
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void AddExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if (p == prec_mult || (p == prec_add && left)) {
-        ot << "(";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void AddExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = at.p_ == prec_mult || (at.p_ == prec_add && at.left_);
+    // the rest of a chain such as 1 + 2 + 3 shares the block of its start,
+    // so that its lines fill up instead of stepping in
+    bool chained = at.p_ == prec_add && ! at.left_ && ! wrap;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        if (! chained) {
+            ot.open();
+        }
+        kid = {prec_add, true, true};
     }
-
-    lhs_->pretty_print_at(ot, prec_add, true, true, pos);
-    ot << " + ";
-    rhs_->pretty_print_at(ot, prec_add, false, false, pos);
-
-    if (p == prec_mult || (p == prec_add && left)) {
-        ot << ")";
+    else if (i == 1) {
+        ot << " +";
+        ot.optional_newline(1, 0);
+        // a _let, _if or _fun on the right would take in what follows the sum
+        kid = {prec_add, false, at.parenthesized_ && ! wrap};
+    }
+    else {
+        if (! chained) {
+            ot.close();
+        }
+        if (wrap) {
+            ot << ")";
+        }
     }
 }
 
@@ -207,26 +446,53 @@ MultExpr::MultExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
 }
 
 /**
- * \brief check if two MultExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two MultExprs are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool MultExpr::equals(PTR(Expr) rhs) {
-    PTR(MultExpr) m = CAST(MultExpr)(rhs);
-    
-    if (m == nullptr) {
-        return false;
+MultExpr::~MultExpr() {
+    dispose(lhs_);
+    dispose(rhs_);
+}
+
+/**
+ * \brief check if e is a MultExpr, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool MultExpr::same_node(Expr* e) {
+    return dynamic_cast<MultExpr*>(e) != nullptr;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int MultExpr::child_count() {
+    return 2;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* MultExpr::child(int i) {
+    if (i == 0) {
+        return &*lhs_;
     }
-    
-    return lhs_->equals(m->lhs_) && rhs_->equals(m->rhs_);
+
+    return &*rhs_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the product of the subexpression values
  */
-PTR(Val) MultExpr::interp(PTR(Env) env) {
-    return lhs_->interp(env)->mult_with(rhs_->interp(env));
+PTR(Val) MultExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs, rhs;
+    interp_operands(lhs_, rhs_, env, lhs, rhs);
+
+    if (typed_) {
+        return NEW(NumVal)(UNCHECKED_CAST(NumVal)(lhs)->val_ * UNCHECKED_CAST(NumVal)(rhs)->val_);
+    }
+
+    return lhs->mult_with(rhs);
 }
 
 /**
@@ -250,67 +516,130 @@ PTR(Val) MultExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void MultExpr::print(std::ostream& ot) {
-    ot << "(";
-    lhs_->print(ot);
-    ot << "*";
-    rhs_->print(ot);
-    ot << ")";
+void MultExpr::print_part(std::ostream& ot, int i) {
+    ot << (i == 0 ? "(" : i == 1 ? "*" : ")");
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void MultExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if (p == prec_mult && left) {
-        ot << "(";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void MultExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = at.p_ == prec_mult && at.left_;
+    // the rest of a chain such as 1 * 2 * 3 shares the block of its start
+    bool chained = at.p_ == prec_mult && ! at.left_ && ! wrap;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        if (! chained) {
+            ot.open();
+        }
+        kid = {prec_mult, true, false};
     }
-
-    lhs_->pretty_print_at(ot, prec_mult, true, false, pos);
-    ot << " * ";
-    rhs_->pretty_print_at(ot, prec_mult, false, parenthesized, pos);
-
-    if (p == prec_mult && left) {
-        ot << ")";
+    else if (i == 1) {
+        ot << " *";
+        ot.optional_newline(1, 0);
+        kid = {prec_mult, false, at.parenthesized_ && ! wrap};
+    }
+    else {
+        if (! chained) {
+            ot.close();
+        }
+        if (wrap) {
+            ot << ")";
+        }
     }
 }
 
 /*
  * VarExpr
  */
-VarExpr::VarExpr(std::string var) {
+VarExpr::VarExpr(std::string var) : cache_depth_(-1) {
     var_ = var;
 }
 
 /**
- * \brief check if two VarExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two VarExprs are equal, false if rhs is NULL
+ * \brief check if e is a VarExpr of the same variable
+ * \param e the node to compare with
  */
-bool VarExpr::equals(PTR(Expr) rhs) {
-    PTR(VarExpr) v = CAST(VarExpr)(rhs);
-    
-    if (v == nullptr) {
-        return false;
+bool VarExpr::same_node(Expr* e) {
+    VarExpr* v = dynamic_cast<VarExpr*>(e);
+
+    return v != nullptr && var_ == v->var_;
+}
+
+/**
+ * \brief the value of var_ in an environment, found through the inline
+ * cache when it is on; also used by the specialized nodes for their
+ * variable operands
+ * \param env the environment
+ * \return the value bound to var_
+ */
+PTR(Val) VarExpr::lookup(const PTR(Env)& env) {
+    if (! inline_cache) {
+        return env->lookup(var_);
     }
-    
-    return var_ == v->var_;
+
+    // a run of bindings made by the interpreter is the same sequence of
+    // names every time this node runs, so if the cached depth is reached
+    // through such bindings and binds var_, no binding before it does
+    int depth = cache_depth_.load(std::memory_order_relaxed);
+
+    if (depth >= 0) {
+        Env* e = env.get();
+        int i = 0;
+
+        while (i < depth && e != nullptr && e->lexical_) {
+            e = e->outer_;
+            i++;
+        }
+
+        if (i == depth && e != nullptr && e->binding_ != nullptr && *e->binding_ == var_) {
+            if (cache_stats) {
+                cache_hits.fetch_add(1, std::memory_order_relaxed);
+            }
+            // a call-by-need binding has no value until its first lookup
+            if (*e->bound_val_ != nullptr) {
+                return *e->bound_val_;
+            }
+            return e->lookup(var_);
+        }
+    }
+
+    if (cache_stats) {
+        cache_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    depth = 0;
+    for (Env* e = env.get(); e != nullptr; e = e->outer_, depth++) {
+        if (e->binding_ != nullptr && *e->binding_ == var_) {
+            cache_depth_.store(depth, std::memory_order_relaxed);
+            return e->lookup(var_);
+        }
+    }
+
+    // not bound, let the environment report it
+    return env->lookup(var_);
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return throw an std::runtime_error exception
  */
-PTR(Val) VarExpr::interp(PTR(Env) env) {
-    return env->lookup(var_);
+PTR(Val) VarExpr::do_interp(PTR(Env) env) {
+    return lookup(env);
 }
 
 /**
@@ -337,22 +666,25 @@ PTR(Val) VarExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void VarExpr::print(std::ostream& ot) {
+void VarExpr::print_part(std::ostream& ot, int i) {
     ot << var_;
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void VarExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void VarExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
     ot << var_;
 }
 
@@ -366,31 +698,62 @@ LetExpr::LetExpr(std::string var, PTR(Expr) rhs, PTR(Expr) body) {
 }
 
 /**
- * \brief check if two LetExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two LetExprs are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool LetExpr::equals(PTR(Expr) rhs) {
-    PTR(LetExpr) l = CAST(LetExpr)(rhs);
+LetExpr::~LetExpr() {
+    dispose(rhs_);
+    dispose(body_);
+}
 
-    if (l == nullptr) {
-        return false;
+/**
+ * \brief check if e is a LetExpr binding the same variable, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool LetExpr::same_node(Expr* e) {
+    LetExpr* l = dynamic_cast<LetExpr*>(e);
+
+    return l != nullptr && var_ == l->var_;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int LetExpr::child_count() {
+    return 2;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* LetExpr::child(int i) {
+    if (i == 0) {
+        return &*rhs_;
     }
 
-    return (var_ == l->var_) &&
-           (body_->equals(l->body_)) &&
-           (rhs_->equals(l->rhs_));
+    return &*body_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
+ *
+ * Under call_by_need the rhs is not evaluated here; it is forced by the
+ * first lookup of var_, so an rhs that is never used never raises an error.
  * \return the substitute interp of body_
  */
-PTR(Val) LetExpr::interp(PTR(Env) env) {
+PTR(Val) LetExpr::do_interp(PTR(Env) env) {
     try {
-        // catch the error thrown by rhs
-        PTR(Val) rhs = rhs_->interp(env);
-        PTR(Env) newEnv = NEW(ExtendedEnv)(var_, rhs, env);
+        PTR(Env) newEnv;
+
+        if (call_by_need) {
+            newEnv = NEW(LazyEnv)(var_, rhs_, env, env);
+        }
+        else {
+            // catch the error thrown by rhs
+            PTR(Val) rhs = rhs_->interp(env);
+            newEnv = NEW(ExtendedEnv)(var_, rhs, env);
+        }
+        newEnv->lexical_ = true;
 
         return body_->interp(newEnv);
     }
@@ -424,46 +787,51 @@ PTR(Val) LetExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void LetExpr::print(std::ostream& ot) {
-    ot << "(_let " << var_ << "=";
-    rhs_->print(ot);
-    ot << " _in ";
-    body_->print(ot);
-    ot << ")";
+void LetExpr::print_part(std::ostream& ot, int i) {
+    if (i == 0) {
+        ot << "(_let " << var_ << "=";
+    }
+    else {
+        ot << (i == 1 ? " _in " : ")");
+    }
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void LetExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if ((parenthesized && (! left)) || left) {
-        ot << "(";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void LetExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = (at.parenthesized_ && (! at.left_)) || at.left_;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        ot.open();
+        ot << "_let " << var_ << " =";
+        ot.optional_newline(1, 2);
     }
-
-    int indent = ot.tellp() - pos;
-
-    ot << "_let " << var_ << " = ";
-    rhs_->pretty_print_at(ot, prec_none, false, false, pos);
-    ot << "\n";
-    pos = ot.tellp();
-
-    // print spaces in the front of a new line
-    ot << std::string(indent, ' ');
-
-    ot << "_in ";
-    body_->pretty_print_at(ot, prec_none, false, false, pos);
-
-    if ((parenthesized && (! left)) || left) {
-        ot << ")";
+    else if (i == 1) {
+        ot.newline(0);
+        ot << "_in ";
+    }
+    else {
+        ot.close();
+        if (wrap) {
+            ot << ")";
+        }
     }
+    kid = {prec_none, false, false};
 }
 
 /*
@@ -474,25 +842,20 @@ BoolExpr::BoolExpr(bool var) {
 }
 
 /**
- * \brief check if two BoolExpr are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two BoolExpr are equal, false if rhs is NULL
+ * \brief check if e is a BoolExpr with the same value
+ * \param e the node to compare with
  */
-bool BoolExpr::equals(PTR(Expr) rhs) {
-    PTR(BoolExpr) b = CAST(BoolExpr)(rhs);
+bool BoolExpr::same_node(Expr* e) {
+    BoolExpr* b = dynamic_cast<BoolExpr*>(e);
 
-    if (b == nullptr) {
-        return false;
-    }
-
-    return var_ == b->var_;
+    return b != nullptr && var_ == b->var_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the substitute interp of body_
  */
-PTR(Val) BoolExpr::interp(PTR(Env) env) {
+PTR(Val) BoolExpr::do_interp(PTR(Env) env) {
     return NEW(BoolVal)(var_);
 }
 
@@ -516,28 +879,26 @@ PTR(Val) BoolExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void BoolExpr::print(std::ostream& ot) {
-    if (var_) {
-        ot << "_true";
-    }
-    else {
-        ot << "_false";
-    }
+void BoolExpr::print_part(std::ostream& ot, int i) {
+    ot << (var_ ? "_true" : "_false");
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void BoolExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    print(ot);
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void BoolExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    ot << (var_ ? "_true" : "_false");
 }
 
 /*
@@ -550,28 +911,53 @@ IfExpr::IfExpr(PTR(Expr) condition, PTR(Expr) then_expr, PTR(Expr) else_expr) {
 }
 
 /**
- * \brief check if two IfExpr are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two IfExpr are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool IfExpr::equals(PTR(Expr) rhs) {
-    PTR(IfExpr) i = CAST(IfExpr)(rhs);
+IfExpr::~IfExpr() {
+    dispose(condition_);
+    dispose(then_);
+    dispose(else_);
+}
 
-    if (i == nullptr) {
-        return false;
+/**
+ * \brief check if e is an IfExpr, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool IfExpr::same_node(Expr* e) {
+    return dynamic_cast<IfExpr*>(e) != nullptr;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int IfExpr::child_count() {
+    return 3;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* IfExpr::child(int i) {
+    if (i == 0) {
+        return &*condition_;
+    }
+    if (i == 1) {
+        return &*then_;
     }
 
-    return condition_->equals(i->condition_) &&
-           then_->equals(i->then_) &&
-           else_->equals(i->else_);
+    return &*else_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the substitute interp of body_
  */
-PTR(Val) IfExpr::interp(PTR(Env) env) {
-    if (condition_->interp(env)->is_true()) {
+PTR(Val) IfExpr::do_interp(PTR(Env) env) {
+    PTR(Val) condition = condition_->interp(env);
+    bool is_true = typed_ ? UNCHECKED_CAST(BoolVal)(condition)->bool_val_ : condition->is_true();
+
+    if (is_true) {
         return then_->interp(env);
     }
 
@@ -602,55 +988,47 @@ PTR(Val) IfExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void IfExpr::print(std::ostream& ot) {
-    ot << "(_if ";
-    condition_->print(ot);
-    ot << " _then ";
-    then_->print(ot);
-    ot << " _else ";
-    else_->print(ot);
-    ot << ")";
+void IfExpr::print_part(std::ostream& ot, int i) {
+    static const char* const parts[] = {"(_if ", " _then ", " _else ", ")"};
+
+    ot << parts[i];
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void IfExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if (parenthesized) {
-        ot << "(";
-    }
-
-    int if_indent = ot.tellp() - pos;
-    ot << "_if ";
-    condition_->pretty_print_at(ot, prec_none, false, false, pos);
-    ot << "\n";
-    pos = ot.tellp();
-
-    for (int i = 0; i < if_indent; ++i) {
-        ot << " ";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void IfExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = at.parenthesized_ || at.left_;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        ot.open();
+        ot << "_if ";
     }
-    ot << "_then ";
-    then_->pretty_print_at(ot, prec_none, false, false, pos);
-    ot << "\n";
-    pos = ot.tellp();
-
-    for (int i = 0; i < if_indent; ++i) {
-        ot << " ";
+    else if (i < 3) {
+        ot.newline(0);
+        ot << (i == 1 ? "_then " : "_else ");
     }
-    ot << "_else ";
-    else_->pretty_print_at(ot, prec_none, false, false, pos);
-
-    if (parenthesized) {
-        ot << ")";
+    else {
+        ot.close();
+        if (wrap) {
+            ot << ")";
+        }
     }
+    kid = {prec_none, false, false};
 }
 
 /*
@@ -662,27 +1040,49 @@ EqExpr::EqExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
 }
 
 /**
- * \brief check if two EqExpr are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two EqExpr are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool EqExpr::equals(PTR(Expr) rhs) {
-    PTR(EqExpr) e = CAST(EqExpr)(rhs);
+EqExpr::~EqExpr() {
+    dispose(lhs_);
+    dispose(rhs_);
+}
 
-    if (e == nullptr) {
-        return false;
+/**
+ * \brief check if e is an EqExpr, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool EqExpr::same_node(Expr* e) {
+    return dynamic_cast<EqExpr*>(e) != nullptr;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int EqExpr::child_count() {
+    return 2;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* EqExpr::child(int i) {
+    if (i == 0) {
+        return &*lhs_;
     }
 
-    return lhs_->equals(e->lhs_) &&
-           rhs_->equals(e->rhs_);
+    return &*rhs_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the substitute interp of body_
  */
-PTR(Val) EqExpr::interp(PTR(Env) env) {
-    return NEW(BoolVal)(lhs_->interp(env)->equals(rhs_->interp(env)));
+PTR(Val) EqExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs, rhs;
+    interp_operands(lhs_, rhs_, env, lhs, rhs);
+
+    return NEW(BoolVal)(lhs->equals(rhs));
 }
 
 /**
@@ -707,36 +1107,44 @@ PTR(Val) EqExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void EqExpr::print(std::ostream& ot) {
-    ot << "(";
-    lhs_->print(ot);
-    ot << "==";
-    rhs_->print(ot);
-    ot << ")";
+void EqExpr::print_part(std::ostream& ot, int i) {
+    ot << (i == 0 ? "(" : i == 1 ? "==" : ")");
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void EqExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if (p > prec_none) {
-        ot << "(";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void EqExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = at.p_ > prec_none;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        ot.open();
+        kid = {prec_add, false, true};
     }
-
-    lhs_->pretty_print_at(ot, prec_add, false, true, pos);
-    ot << " == ";
-    rhs_->pretty_print_at(ot, prec_none, false, false, pos);
-
-    if (p > prec_none) {
-        ot << ")";
+    else if (i == 1) {
+        ot << " ==";
+        ot.optional_newline(1, 0);
+        kid = {prec_none, false, false};
+    }
+    else {
+        ot.close();
+        if (wrap) {
+            ot << ")";
+        }
     }
 }
 
@@ -749,27 +1157,49 @@ FunExpr::FunExpr(PTR(VarExpr) arg, PTR(Expr) body) {
 }
 
 /**
- * \brief check if two FunExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two FunExprs are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool FunExpr::equals(PTR(Expr) rhs) {
-    PTR(FunExpr) f = CAST(FunExpr)(rhs);
+FunExpr::~FunExpr() {
+    dispose(body_);
+}
 
-    if (f == nullptr) {
-        return false;
-    }
+/**
+ * \brief check if e is a FunExpr with the same parameter, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool FunExpr::same_node(Expr* e) {
+    FunExpr* f = dynamic_cast<FunExpr*>(e);
+
+    return f != nullptr && arg_->var_ == f->arg_->var_;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int FunExpr::child_count() {
+    return 1;
+}
 
-    return (arg_->equals(f->arg_)) &&
-           (body_->equals(f->body_));
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* FunExpr::child(int i) {
+    return &*body_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
  * \return the substitute interp of body_
  */
-PTR(Val) FunExpr::interp(PTR(Env) env) {
-    return NEW(FunVal)(arg_, body_);
+PTR(Val) FunExpr::do_interp(PTR(Env) env) {
+    PTR(FunVal) f = NEW(FunVal)(arg_, body_, env);
+
+    if (use_jit) {
+        f->native_ = jit_closure(this, env);
+    }
+
+    return f;
 }
 
 /**
@@ -788,42 +1218,46 @@ PTR(Val) FunExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void FunExpr::print(std::ostream& ot) {
-    ot << "(_fun (";
-    arg_->print(ot);
-    ot << ") ";
-    body_->print(ot);
-    ot << ")";
+void FunExpr::print_part(std::ostream& ot, int i) {
+    if (i == 0) {
+        ot << "(_fun (" << arg_->var_ << ") ";
+    }
+    else {
+        ot << ")";
+    }
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void FunExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    if (parenthesized) {
-        ot << "(";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void FunExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    bool wrap = at.parenthesized_ || at.left_;
+
+    if (i == 0) {
+        if (wrap) {
+            ot << "(";
+        }
+        ot.open();
+        ot << "_fun (" << arg_->var_ << ")";
+        ot.newline(0);
+        kid = {prec_none, false, false};
     }
-
-    int indent = ot.tellp() - pos;
-
-    ot << "_fun (" << arg_->var_ << ")\n";
-    pos = ot.tellp();
-
-    // print spaces in the front of a new line
-    ot << std::string(indent, ' ');
-
-    body_->pretty_print_at(ot, prec_none, false, false, pos);
-
-    if (parenthesized) {
-        ot << ")";
+    else {
+        ot.close();
+        if (wrap) {
+            ot << ")";
+        }
     }
 }
 
@@ -836,27 +1270,67 @@ CallExpr::CallExpr(PTR(Expr) callee, PTR(Expr) arg) {
 }
 
 /**
- * \brief check if two CallExprs are equal
- * \param rhs rhs PTR(Expr) to be compared
- * \return true if two CallExprs are equal, false if rhs is NULL
+ * \brief free the subexpressions without recursing, see Expr::dispose()
  */
-bool CallExpr::equals(PTR(Expr) rhs) {
-    PTR(CallExpr) c = CAST(CallExpr)(rhs);
+CallExpr::~CallExpr() {
+    dispose(callee_);
+    dispose(arg_);
+}
 
-    if (c == nullptr) {
-        return false;
+/**
+ * \brief check if e is a CallExpr, leaving the
+ * subexpressions to Expr::equals()
+ * \param e the node to compare with
+ */
+bool CallExpr::same_node(Expr* e) {
+    return dynamic_cast<CallExpr*>(e) != nullptr;
+}
+
+/**
+ * \brief the number of subexpressions
+ */
+int CallExpr::child_count() {
+    return 2;
+}
+
+/**
+ * \brief subexpression i, in the order they are printed
+ */
+Expr* CallExpr::child(int i) {
+    if (i == 0) {
+        return &*callee_;
     }
 
-    return (callee_->equals(c->callee_)) &&
-           (arg_->equals(c->arg_));
+    return &*arg_;
 }
 
 /**
  * \brief returns a PTR(Val) for the value of an expression
+ *
+ * Under call_by_need an argument passed to a function is bound unevaluated;
+ * calling a non-function still evaluates the argument first, as before.
  * \return the substitute interp of body_
  */
-PTR(Val) CallExpr::interp(PTR(Env) env) {
-    return callee_->interp(env)->call(arg_->interp(env));
+PTR(Val) CallExpr::do_interp(PTR(Env) env) {
+    if (call_by_need) {
+        PTR(Val) callee = callee_->interp(env);
+        PTR(FunVal) f = CAST(FunVal)(callee);
+
+        if (f != nullptr) {
+            return f->call_by_need(arg_, env);
+        }
+
+        return callee->call(arg_->interp(env));
+    }
+
+    PTR(Val) callee, arg;
+    interp_operands(callee_, arg_, env, callee, arg);
+
+    if (typed_) {
+        return UNCHECKED_CAST(FunVal)(callee)->FunVal::call(arg);
+    }
+
+    return callee->call(arg);
 }
 
 /**
@@ -872,27 +1346,36 @@ PTR(Val) CallExpr::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief print the Expr
+ * \brief write the text of print() before subexpression i, or after the
+ * last one when i is child_count()
  * \param ot ostream
+ * \param i the part
  */
-void CallExpr::print(std::ostream& ot) {
-    callee_->print(ot);
-    ot << "(";
-    arg_->print(ot);
-    ot << ")";
+void CallExpr::print_part(std::ostream& ot, int i) {
+    ot << (i == 0 ? "" : i == 1 ? "(" : ")");
 }
 
 /**
- * \brief print the Expr in a pretty format
- * \param ot ostream
- * \param p precedence of the previous Expr
- * \param left if the current Expr is on the left hand side of the previous Expr
- * \param parenthesized if the previous Expr is parenthesized
- * \param pos the number of characters that have been written to the stream
- */
-void CallExpr::pretty_print_at(std::ostream& ot, precedence_t p, bool left, bool parenthesized, std::streampos& pos) {
-    callee_->pretty_print_at(ot, prec_none, false, true, pos);
-    ot << "(";
-    arg_->pretty_print_at(ot, prec_none, false, false, pos);
-    ot << ")";
+ * \brief write the text of pretty_print_at() before subexpression i, or
+ * after the last one when i is child_count(), and say where subexpression
+ * i goes
+ * \param ot where the text goes, and its column
+ * \param at where this Expr is printed
+ * \param i the part
+ * \param kid set to where subexpression i is printed
+ */
+void CallExpr::pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) {
+    if (i == 0) {
+        ot.open();
+        kid = {prec_mult, true, true};
+    }
+    else if (i == 1) {
+        ot << "(";
+        ot.optional_newline(0, 2);
+        kid = {prec_none, false, false};
+    }
+    else {
+        ot << ")";
+        ot.close();
+    }
 }
@@ -8,9 +8,16 @@
 
 #include "pointer.h"
 #include "env.h"
+#include "pretty.h"
+#include <atomic>
 #include <string>
 #include <ostream>
 
+// set to 0 to compile the --profile hook out of Expr::interp()
+#ifndef MSD_PROFILE
+# define MSD_PROFILE 1
+#endif
+
 typedef enum {
     prec_none,
     prec_add,
@@ -18,33 +25,94 @@ typedef enum {
 } precedence_t;
 
 class Val;
+class JitCode;
+
+// where a node is pretty printed: the precedence of the node around it,
+// and whether it is on the left of that node and inside its parentheses
+struct PrettyPlace {
+    precedence_t p_;
+    bool         left_;
+    bool         parenthesized_;
+};
 
 class Expr {
 public:
-    virtual bool      equals(PTR(Expr) e) = 0;
-    virtual PTR(Val)  interp(PTR(Env)) = 0;
+    // bind _let right-hand sides and call arguments as memoized thunks
+    static thread_local bool call_by_need;
+
+    // estimated cost of evaluating this subtree, see annotate_cost()
+    int cost_ = 0;
+
+    // set by typecheck(): the operands are known to have the types this
+    // node needs, so interp() can skip the runtime type checks
+    bool typed_ = false;
+
+    // where the parser read the expression: offsets of its first character
+    // and one past its last in the input, and the 1-based line and column
+    // of the first character, or -1 and 0 for expressions built in code
+    int pos_ = -1;
+    int end_ = -1;
+    int line_ = 0;
+    int column_ = 0;
+
+    // record every interp() call for --profile, see Profiler
+    static bool profiling;
+
+    virtual ~Expr() = default;
+    bool              equals(PTR(Expr) e);
+    PTR(Val)          interp(const PTR(Env)& env);
+    virtual PTR(Val)  do_interp(PTR(Env)) = 0;
 //    virtual bool      has_variable() = 0;
 //    virtual PTR(Expr) subst(std::string parameter, PTR(Expr) e) = 0;
-    virtual void      print(std::ostream& ot) = 0;
-    void              pretty_print(std::ostream& ot);
-    virtual void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) = 0;
+    void              print(std::ostream& ot);
+    void              pretty_print(std::ostream& ot, int width = PrettyWriter::default_width);
+    void              pretty_print_at(PrettyWriter& ot, precedence_t p, bool left, bool parenthesized);
     std::string       to_string();
-    std::string       to_pretty_string();
+    std::string       to_pretty_string(int width = PrettyWriter::default_width);
+    int               depth();
+
+    // the pieces equals(), print() and pretty_print_at() are made of, so
+    // that they walk the tree with a stack of their own instead of the C++
+    // stack, which deep trees overflow
+    virtual int       child_count();
+    virtual Expr*     child(int i);
+    virtual bool      same_node(Expr* e) = 0;
+    virtual void      print_part(std::ostream& ot, int i) = 0;
+    virtual void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) = 0;
+
+protected:
+    static void       dispose(PTR(Expr)& kid);
+
+private:
+    PTR(Val)          profiled_interp(const PTR(Env)& env);
 };
 
+/**
+ * \brief evaluate the expression in an environment
+ * \param env the values of the free variables
+ * \return the value of the expression
+ */
+inline PTR(Val) Expr::interp(const PTR(Env)& env) {
+#if MSD_PROFILE
+    if (__builtin_expect(profiling, false)) {
+        return profiled_interp(env);
+    }
+#endif
+
+    return do_interp(env);
+}
+
 class NumExpr : public Expr {
 public:
     int val_;
 
     NumExpr(int val);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class AddExpr : public Expr {
@@ -53,14 +121,15 @@ public:
     PTR(Expr) rhs_;
 
     AddExpr(PTR(Expr) lhs, PTR(Expr) rhs);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~AddExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class MultExpr : public Expr {
@@ -69,29 +138,38 @@ public:
     PTR(Expr) rhs_;
 
     MultExpr(PTR(Expr) lhs, PTR(Expr) rhs);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~MultExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class VarExpr : public Expr {
 public:
     std::string var_;
+    // depth in the environment chain where var_ was found last time, or -1
+    std::atomic<int> cache_depth_;
+
+    // look variables up through cache_depth_
+    static bool              inline_cache;
+    // count cache hits and misses, for --stats
+    static bool              cache_stats;
+    static std::atomic<long> cache_hits;
+    static std::atomic<long> cache_misses;
 
     VarExpr(std::string var);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    PTR(Val)  lookup(const PTR(Env)& env);
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class LetExpr : public Expr {
@@ -101,14 +179,15 @@ public:
     PTR(Expr) body_;
 
     LetExpr(std::string var, PTR(Expr) rhs, PTR(Expr) body);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~LetExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class BoolExpr : public Expr {
@@ -116,14 +195,12 @@ public:
     bool var_;
 
     BoolExpr(bool var);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class IfExpr : public Expr {
@@ -133,14 +210,15 @@ public:
     PTR(Expr) else_;
 
     IfExpr(PTR(Expr) condition, PTR(Expr) then_expr, PTR(Expr) else_expr);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~IfExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class EqExpr : public Expr {
@@ -149,29 +227,37 @@ public:
     PTR(Expr) rhs_;
 
     EqExpr(PTR(Expr) lhs, PTR(Expr) rhs);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~EqExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    bool      has_variable();
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class FunExpr : public Expr {
 public:
     PTR(VarExpr) arg_;
     PTR(Expr) body_;
+    // native code for the closures of this function, see jit_compile()
+    PTR(JitCode) jit_;
+    bool         jit_tried_ = false;
+
+    // give closures native code under --engine=jit
+    static thread_local bool use_jit;
 
     FunExpr(PTR(VarExpr) arg, PTR(Expr) body);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~FunExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
 
 class CallExpr : public Expr {
@@ -180,11 +266,12 @@ public:
     PTR(Expr) arg_;
 
     CallExpr(PTR(Expr) callee, PTR(Expr) arg);
-    bool      equals(PTR(Expr) rhs) override;
-    PTR(Val)  interp(PTR(Env)) override;
+    ~CallExpr();
+    PTR(Val)  do_interp(PTR(Env)) override;
 //    PTR(Expr) subst(std::string parameter, PTR(Expr) e);
-    void      print(std::ostream& ot) override;
-
-private:
-    void      pretty_print_at(std::ostream& , precedence_t, bool, bool, std::streampos&) override;
+    bool      same_node(Expr* e) override;
+    int       child_count() override;
+    Expr*     child(int i) override;
+    void      print_part(std::ostream& ot, int i) override;
+    void      pretty_part(PrettyWriter& ot, PrettyPlace& at, int i, PrettyPlace& kid) override;
 };
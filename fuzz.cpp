@@ -0,0 +1,827 @@
+/**
+ * \file fuzz.cpp
+ * \brief Definitions of the in-process differential fuzzer behind --fuzz
+ * \author Laura Zhang
+ *
+ * Each case is a random program made from a seed of its own, so a failing
+ * case can be made again from its seed alone. The program is printed,
+ * parsed back, pretty printed, also to a narrow width, and parsed again,
+ * which must give the same expression each time, and is then run on every
+ * engine: the tree walker, the closure compiler, the specialized tree, the
+ * JIT, the work-stealing pool, call-by-need evaluation, and the typed tree
+ * when the type checker accepts it. Every engine must give the value or
+ * error message the tree walker gives, except that call-by-need may skip
+ * an error. All of this happens in the process, on as many threads as
+ * asked for, instead of forking msdscript a few times per case as
+ * tests.cpp does. A failing program is shrunk by replacing its nodes with
+ * their children and with smaller constants for as long as it keeps
+ * failing.
+ *
+ * The generators never pass a function as an argument, so no function can
+ * reach itself and every program terminates, except that a quarter of the
+ * typed programs also get the template
+ * _let r = _fun (f) _fun (n) _if n == 0 _then c _else ... f(f)(n + -1) ...
+ * _in r(r)(k) with a small k, the self-recursion the JIT compiles.
+ */
+
+#include "fuzz.h"
+#include "expr.h"
+#include "parse.h"
+#include "val.h"
+#include "env.h"
+#include "parallel.h"
+#include "typecheck.h"
+#include "compile.h"
+#include "specialize.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a variable in scope where a node is generated
+struct Binding {
+    std::string name_;
+    // bound by a _let whose value may be a function
+    bool        may_be_fun_;
+};
+
+typedef std::vector<Binding> Scope;
+
+static const char* const names[] = {"x", "y", "z", "f", "g"};
+
+int Fuzzer::max_size = 40;
+int Fuzzer::max_depth = 64;
+
+static int pick(std::mt19937_64& rng, int n) {
+    return (int) (rng() % (unsigned long) n);
+}
+
+/**
+ * \brief the innermost binding of each variable in scope, leaving out the
+ * ones that may hold a function when first_order is set
+ */
+static std::vector<Binding> visible(const Scope& scope, bool first_order) {
+    std::vector<Binding> found;
+    std::vector<std::string> seen;
+
+    for (auto b = scope.rbegin(); b != scope.rend(); ++b) {
+        if (std::find(seen.begin(), seen.end(), b->name_) != seen.end()) {
+            continue;
+        }
+        seen.push_back(b->name_);
+        if (! first_order || ! b->may_be_fun_) {
+            found.push_back(*b);
+        }
+    }
+
+    return found;
+}
+
+static PTR(Expr) random_leaf(std::mt19937_64& rng, const Scope& scope, bool first_order) {
+    std::vector<Binding> vars = visible(scope, first_order);
+    int r = pick(rng, 10);
+
+    if (r < 4 && ! vars.empty()) {
+        return NEW(VarExpr)(vars[pick(rng, (int) vars.size())].name_);
+    }
+    if (r == 4) {
+        return NEW(BoolExpr)(pick(rng, 2) == 0);
+    }
+    if (r == 5 && pick(rng, 4) == 0) {
+        // a free variable
+        return NEW(VarExpr)("w");
+    }
+    if (r == 6 && pick(rng, 4) == 0) {
+        // a large number, for arithmetic that wraps
+        return NEW(NumExpr)((int) ((long) (rng() % 4000000001ul) - 2000000000));
+    }
+
+    return NEW(NumExpr)(pick(rng, 41) - 20);
+}
+
+/**
+ * \brief a random expression
+ * \param rng the random numbers
+ * \param size the number of nodes to make
+ * \param scope the variables it may refer to
+ * \param first_order leave out functions and calls, and variables that may
+ * hold a function, so the value is never a function
+ */
+static PTR(Expr) random_expr(std::mt19937_64& rng, int size, const Scope& scope, bool first_order) {
+    if (size <= 1) {
+        return random_leaf(rng, scope, first_order);
+    }
+
+    int rest = size - 1;
+    int lhs = rest == 1 ? 1 : 1 + pick(rng, rest - 1);
+    int kind = pick(rng, first_order ? 5 : 7);
+
+    if (rest == 1) {
+        // only _fun has one child
+        if (first_order) {
+            return random_leaf(rng, scope, first_order);
+        }
+        kind = 5;
+    }
+    else if (kind == 3 && rest < 3) {
+        kind = 0;
+    }
+
+    switch (kind) {
+    case 0:
+        return NEW(AddExpr)(random_expr(rng, lhs, scope, first_order),
+                            random_expr(rng, rest - lhs, scope, first_order));
+    case 1:
+        return NEW(MultExpr)(random_expr(rng, lhs, scope, first_order),
+                             random_expr(rng, rest - lhs, scope, first_order));
+    case 2:
+        return NEW(EqExpr)(random_expr(rng, lhs, scope, first_order),
+                           random_expr(rng, rest - lhs, scope, first_order));
+    case 3: {
+        int condition = 1 + pick(rng, rest - 2);
+        int then_size = (rest - condition) / 2;
+
+        return NEW(IfExpr)(random_expr(rng, condition, scope, first_order),
+                           random_expr(rng, then_size, scope, first_order),
+                           random_expr(rng, rest - condition - then_size, scope, first_order));
+    }
+    case 4: {
+        std::string var = names[pick(rng, 5)];
+        Scope inner = scope;
+
+        inner.push_back({var, ! first_order});
+
+        return NEW(LetExpr)(var, random_expr(rng, lhs, scope, first_order),
+                            random_expr(rng, rest - lhs, inner, first_order));
+    }
+    case 5: {
+        std::string arg = names[pick(rng, 5)];
+        Scope inner = scope;
+
+        inner.push_back({arg, false});
+
+        return NEW(FunExpr)(NEW(VarExpr)(arg), random_expr(rng, rest, inner, false));
+    }
+    default: {
+        // mostly call something that is a function
+        std::vector<Binding> funs;
+        for (const Binding& b : visible(scope, false)) {
+            if (b.may_be_fun_) {
+                funs.push_back(b);
+            }
+        }
+
+        PTR(Expr) callee;
+        if (! funs.empty() && pick(rng, 2) == 0) {
+            callee = NEW(VarExpr)(funs[pick(rng, (int) funs.size())].name_);
+            lhs = 1;
+        }
+        else if (lhs >= 2 && pick(rng, 4) != 0) {
+            std::string arg = names[pick(rng, 5)];
+            Scope inner = scope;
+
+            inner.push_back({arg, false});
+            callee = NEW(FunExpr)(NEW(VarExpr)(arg), random_expr(rng, lhs - 1, inner, false));
+        }
+        else {
+            callee = random_expr(rng, lhs, scope, false);
+        }
+
+        return NEW(CallExpr)(callee, random_expr(rng, rest - lhs, scope, true));
+    }
+    }
+}
+
+/**
+ * \brief a random program with no free variables except, rarely, w
+ * \param rng the random numbers
+ * \param size the number of nodes to make, sometimes a few less since a
+ * part that cannot be a function has no node with one child
+ */
+PTR(Expr) Fuzzer::random_program(std::mt19937_64& rng, int size) {
+    return random_expr(rng, size, Scope(), false);
+}
+
+// the types the typed generator makes values of
+typedef enum {
+    gen_int,
+    gen_bool,
+    gen_int_to_int,
+    gen_int_to_bool,
+    gen_bool_to_int,
+    // int -> int -> int
+    gen_int_to_fun,
+    gen_type_count,
+} gen_type_t;
+
+static const gen_type_t arg_type[] = {gen_int, gen_bool, gen_int, gen_int, gen_bool, gen_int};
+static const gen_type_t ret_type[] = {gen_int, gen_bool, gen_int, gen_bool, gen_int, gen_int_to_int};
+
+// largest _fun body the typed generator makes, in nodes
+static const int max_body = 24;
+
+// a typed variable in scope where a node is generated
+struct TypedBinding {
+    std::string name_;
+    gen_type_t  type_;
+};
+
+/**
+ * \brief makes well-typed programs whose evaluation takes time linear in
+ * their size: function bodies are small and call no function they did
+ * not make themselves, so no call can set off a chain of calls, except
+ * for the countdowns of recursion(), which make at most 11 calls
+ */
+class TypedGenerator {
+public:
+
+    TypedGenerator(std::mt19937_64& rng, int max_depth, bool recursive)
+            : rng_(rng), max_depth_(max_depth), recursive_(recursive) {
+    }
+
+    PTR(Expr) generate(gen_type_t type, int size, int depth);
+
+private:
+    std::mt19937_64&          rng_;
+    int                       max_depth_;
+    // also make the countdowns of recursion()
+    bool                      recursive_;
+    std::vector<TypedBinding> scope_;
+    // number of _fun bodies the node being made is in
+    int                       bodies_ = 0;
+
+    std::string name_for(gen_type_t type);
+    PTR(Expr)   variable(gen_type_t type);
+    PTR(Expr)   leaf(gen_type_t type, int depth);
+    PTR(Expr)   function(gen_type_t type, int size, int depth);
+    PTR(Expr)   call(gen_type_t type, int size, int depth);
+    PTR(Expr)   recursion();
+};
+
+/**
+ * \brief a name for a new variable, short and often shadowing another
+ */
+std::string TypedGenerator::name_for(gen_type_t type) {
+    static const char* const values[] = {"x", "y", "z", "n", "b"};
+    static const char* const functions[] = {"f", "g", "h", "k"};
+
+    if (type == gen_int || type == gen_bool) {
+        return values[pick(rng_, 5)];
+    }
+
+    return functions[pick(rng_, 4)];
+}
+
+/**
+ * \brief a variable in scope of the type, or nullptr
+ */
+PTR(Expr) TypedGenerator::variable(gen_type_t type) {
+    std::vector<std::string> found;
+    std::vector<std::string> seen;
+
+    for (auto b = scope_.rbegin(); b != scope_.rend(); ++b) {
+        if (std::find(seen.begin(), seen.end(), b->name_) != seen.end()) {
+            continue;
+        }
+        seen.push_back(b->name_);
+        if (b->type_ == type) {
+            found.push_back(b->name_);
+        }
+    }
+    if (found.empty()) {
+        return nullptr;
+    }
+
+    return NEW(VarExpr)(found[pick(rng_, (int) found.size())]);
+}
+
+/**
+ * \brief the smallest expressions of a type: a variable, a constant, or a
+ * function returning one
+ */
+PTR(Expr) TypedGenerator::leaf(gen_type_t type, int depth) {
+    // outside of _fun bodies, often call a function bound earlier, so that
+    // the functions a program makes are used
+    if (bodies_ == 0 && (type == gen_int || type == gen_bool) && pick(rng_, 2) == 0) {
+        gen_type_t callee_type = type == gen_int ? gen_int_to_int : gen_int_to_bool;
+        PTR(Expr) callee = variable(callee_type);
+
+        if (callee != nullptr) {
+            return NEW(CallExpr)(callee, NEW(NumExpr)(pick(rng_, 201) - 100));
+        }
+    }
+
+    PTR(Expr) var = variable(type);
+
+    if (var != nullptr && pick(rng_, 2) == 0) {
+        return var;
+    }
+    if (type == gen_int) {
+        return NEW(NumExpr)(pick(rng_, 201) - 100);
+    }
+    if (type == gen_bool) {
+        return NEW(BoolExpr)(pick(rng_, 2) == 0);
+    }
+
+    return var != nullptr ? var : function(type, 2, depth);
+}
+
+/**
+ * \brief a _fun of a function type
+ */
+PTR(Expr) TypedGenerator::function(gen_type_t type, int size, int depth) {
+    std::string arg = name_for(arg_type[type]);
+
+    scope_.push_back({arg, arg_type[type]});
+    bodies_++;
+    PTR(Expr) body = generate(ret_type[type], std::min(size - 1, max_body), depth + 1);
+    bodies_--;
+    scope_.pop_back();
+
+    return NEW(FunExpr)(NEW(VarExpr)(arg), body);
+}
+
+/**
+ * \brief a call returning the type, or nullptr when no function type of
+ * the generator returns it
+ */
+PTR(Expr) TypedGenerator::call(gen_type_t type, int size, int depth) {
+    std::vector<gen_type_t> callees;
+
+    for (int t = gen_int_to_int; t < gen_type_count; t++) {
+        if (ret_type[t] == type) {
+            callees.push_back((gen_type_t) t);
+        }
+    }
+    if (callees.empty() || size < 3) {
+        return nullptr;
+    }
+
+    gen_type_t callee_type = callees[pick(rng_, (int) callees.size())];
+    PTR(Expr) callee = bodies_ == 0 ? variable(callee_type) : nullptr;
+    int callee_size = 1;
+
+    if (callee == nullptr || pick(rng_, 3) == 0) {
+        callee_size = 2 + pick(rng_, size - 2);
+        callee = generate(callee_type, callee_size, depth + 1);
+    }
+
+    return NEW(CallExpr)(callee, generate(arg_type[callee_type], std::max(1, size - 1 - callee_size), depth + 1));
+}
+
+/**
+ * \brief a self-recursive countdown over a small n, which the type checker
+ * rejects but the other engines run, the JIT through its recursive code
+ */
+PTR(Expr) TypedGenerator::recursion() {
+    auto n = [] { return NEW(VarExpr)("n"); };
+    PTR(Expr) again = NEW(CallExpr)(NEW(CallExpr)(NEW(VarExpr)("f"), NEW(VarExpr)("f")),
+                                    NEW(AddExpr)(n(), NEW(NumExpr)(-1)));
+    PTR(Expr) other;
+
+    switch (pick(rng_, 3)) {
+    case 0:
+        other = n();
+        break;
+    case 1:
+        other = NEW(NumExpr)(pick(rng_, 10));
+        break;
+    default:
+        other = NEW(MultExpr)(n(), NEW(NumExpr)(pick(rng_, 10)));
+        break;
+    }
+
+    PTR(Expr) step;
+    if (pick(rng_, 2) == 0) {
+        step = pick(rng_, 2) == 0 ? NEW(AddExpr)(other, again) : NEW(AddExpr)(again, other);
+    }
+    else {
+        step = pick(rng_, 2) == 0 ? NEW(MultExpr)(other, again) : NEW(MultExpr)(again, other);
+    }
+
+    PTR(Expr) body = NEW(IfExpr)(NEW(EqExpr)(n(), NEW(NumExpr)(0)), NEW(NumExpr)(pick(rng_, 10)), step);
+
+    return NEW(LetExpr)("r", NEW(FunExpr)(NEW(VarExpr)("f"), NEW(FunExpr)(n(), body)),
+                        NEW(CallExpr)(NEW(CallExpr)(NEW(VarExpr)("r"), NEW(VarExpr)("r")),
+                                      NEW(NumExpr)(pick(rng_, 11))));
+}
+
+/**
+ * \brief a random expression of a type
+ * \param type the type
+ * \param size the number of nodes to make, about
+ * \param depth how deep in the program the expression is
+ */
+PTR(Expr) TypedGenerator::generate(gen_type_t type, int size, int depth) {
+    if (size <= 1 || depth >= max_depth_) {
+        return leaf(type, depth);
+    }
+
+    int rest = size - 1;
+    int lhs = rest == 1 ? 1 : 1 + pick(rng_, rest - 1);
+
+    for (;;) {
+        // an _if runs one branch, so it is the rarest node and only made
+        // small, keeping most of a large program on the evaluated path
+        switch (pick(rng_, 8)) {
+        case 0:
+        case 1:
+        case 2:
+            // + and * on integers, == on booleans, a _fun otherwise
+            if (type == gen_int) {
+                if (pick(rng_, 2) == 0) {
+                    return NEW(AddExpr)(generate(gen_int, lhs, depth + 1), generate(gen_int, rest - lhs, depth + 1));
+                }
+                return NEW(MultExpr)(generate(gen_int, lhs, depth + 1), generate(gen_int, rest - lhs, depth + 1));
+            }
+            if (type == gen_bool) {
+                gen_type_t operands = pick(rng_, 4) == 0 ? gen_bool : gen_int;
+                return NEW(EqExpr)(generate(operands, lhs, depth + 1), generate(operands, rest - lhs, depth + 1));
+            }
+            if (size - 1 > max_body) {
+                continue;
+            }
+            return function(type, size, depth);
+        case 3: {
+            if (rest < 3 || rest > max_body) {
+                continue;
+            }
+
+            int condition = 1 + pick(rng_, std::min(rest - 2, 8));
+            int then_size = (rest - condition) / 2;
+
+            return NEW(IfExpr)(generate(gen_bool, condition, depth + 1),
+                               generate(type, then_size, depth + 1),
+                               generate(type, rest - condition - then_size, depth + 1));
+        }
+        case 4:
+        case 5: {
+            // bind a function more often than a value, so there is something to call
+            gen_type_t bound = (gen_type_t) (pick(rng_, 3) == 0 ? pick(rng_, 2) : 2 + pick(rng_, 4));
+            std::string var = name_for(bound);
+            PTR(Expr) rhs = generate(bound, lhs, depth + 1);
+
+            scope_.push_back({var, bound});
+            PTR(Expr) body = generate(type, rest - lhs, depth + 1);
+            scope_.pop_back();
+
+            return NEW(LetExpr)(var, rhs, body);
+        }
+        default: {
+            if (recursive_ && type == gen_int && bodies_ == 0 && rest >= 20 && pick(rng_, 8) == 0) {
+                return recursion();
+            }
+
+            PTR(Expr) c = call(type, size, depth);
+
+            if (c != nullptr) {
+                return c;
+            }
+        }
+        }
+    }
+}
+
+/**
+ * \brief a random program the type checker accepts, using every kind of
+ * expression, whose value is an integer
+ * \param rng the random numbers
+ * \param size the number of nodes to make, about; the parts are balanced
+ * so this can be millions
+ * \param max_depth the deepest nesting of expressions, below which only
+ * leaves are made
+ * \param recursive also make self-recursive countdowns, which the type
+ * checker rejects
+ */
+PTR(Expr) Fuzzer::random_typed_program(std::mt19937_64& rng, int size, int max_depth, bool recursive) {
+    TypedGenerator generator(rng, max_depth, recursive);
+
+    return generator.generate(gen_int, size, 0);
+}
+
+/**
+ * \brief the value of an evaluation, or its error, as text to compare
+ */
+static std::string outcome(const std::function<PTR(Val)()>& run) {
+    try {
+        return "value " + run()->to_string();
+    }
+    catch (std::exception& exn) {
+        return std::string("error \"") + exn.what() + "\"";
+    }
+}
+
+// width check() also pretty prints every program at, narrow enough that
+// most optional newlines are taken
+static const int narrow_width = 16;
+
+/**
+ * \brief check that a program prints, pretty prints and evaluates the same
+ * way in every engine
+ * \param src the program
+ * \return "" when it does, or what went wrong
+ */
+std::string Fuzzer::check(const std::string& src) {
+    // the pool of this thread, kept across cases
+    static thread_local std::unique_ptr<WorkStealingPool> pool;
+
+    if (pool == nullptr) {
+        pool.reset(new WorkStealingPool(2, 1));
+    }
+
+    try {
+        PTR(Expr) e = parse_str(src);
+        std::string printed = e->to_string();
+        std::string pretty = e->to_pretty_string();
+        PTR(Expr) reparsed = parse_str(pretty);
+
+        if (! parse_str(printed)->equals(e)) {
+            return "print gives a different expression: " + printed;
+        }
+        if (! reparsed->equals(e)) {
+            return "pretty_print gives a different expression:\n" + pretty;
+        }
+        if (reparsed->to_pretty_string() != pretty) {
+            return "pretty_print changes when printed again:\n" + pretty;
+        }
+
+        // lines broken to fit a narrow width must read back the same too
+        std::string narrow = e->to_pretty_string(narrow_width);
+        if (! parse_str(narrow)->equals(e)) {
+            return "pretty_print at width " + std::to_string(narrow_width) + " gives a different expression:\n" + narrow;
+        }
+    }
+    catch (std::exception& exn) {
+        return std::string("cannot parse what was printed: ") + exn.what();
+    }
+
+    // the engines that leave the tree as it is share one parse, the JIT
+    // and the type checker annotate theirs and the specializer rewrites it
+    PTR(Expr) e = parse_str(src);
+    std::string expected = outcome([&] { return e->interp(Env::empty); });
+    std::string got;
+
+    auto differs = [&](const std::string& engine) {
+        return engine + " gives " + got + " but the tree engine gives " + expected;
+    };
+
+    got = outcome([&] { return compile(e)->run(); });
+    if (got != expected) {
+        return differs("--engine=closure");
+    }
+
+    got = outcome([&] { return pool->run(e, Env::empty); });
+    if (got != expected) {
+        return differs("--engine=parallel");
+    }
+
+    // call-by-need may skip an error in a value that is never used
+    Expr::call_by_need = true;
+    got = outcome([&] { return e->interp(Env::empty); });
+    Expr::call_by_need = false;
+    if (got != expected && expected.rfind("value ", 0) == 0) {
+        return differs("--lazy");
+    }
+
+    got = outcome([&] {
+        Specializer specializer;
+        return specializer.rewrite(e)->interp(Env::empty);
+    });
+    if (got != expected) {
+        return differs("--specialize");
+    }
+
+    FunExpr::use_jit = true;
+    got = outcome([&] { return parse_str(src)->interp(Env::empty); });
+    FunExpr::use_jit = false;
+    if (got != expected) {
+        return differs("--engine=jit");
+    }
+
+    PTR(Expr) typed = parse_str(src);
+    try {
+        typecheck(typed);
+    }
+    catch (std::runtime_error&) {
+        return "";
+    }
+    if (expected.rfind("value ", 0) != 0) {
+        return "--typecheck accepts a program the tree engine fails with " + expected;
+    }
+
+    got = outcome([&] { return typed->interp(Env::empty); });
+    if (got != expected) {
+        return differs("--typecheck");
+    }
+
+    return "";
+}
+
+static std::vector<PTR(Expr)> children(PTR(Expr) e) {
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        return {a->lhs_, a->rhs_};
+    }
+    if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        return {m->lhs_, m->rhs_};
+    }
+    if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        return {q->lhs_, q->rhs_};
+    }
+    if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        return {i->condition_, i->then_, i->else_};
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        return {l->rhs_, l->body_};
+    }
+    if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        return {f->body_};
+    }
+    if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        return {c->callee_, c->arg_};
+    }
+
+    return {};
+}
+
+/**
+ * \brief a copy of e with other children
+ */
+static PTR(Expr) rebuild(PTR(Expr) e, const std::vector<PTR(Expr)>& c) {
+    if (CAST(AddExpr)(e)) {
+        return NEW(AddExpr)(c[0], c[1]);
+    }
+    if (CAST(MultExpr)(e)) {
+        return NEW(MultExpr)(c[0], c[1]);
+    }
+    if (CAST(EqExpr)(e)) {
+        return NEW(EqExpr)(c[0], c[1]);
+    }
+    if (CAST(IfExpr)(e)) {
+        return NEW(IfExpr)(c[0], c[1], c[2]);
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        return NEW(LetExpr)(l->var_, c[0], c[1]);
+    }
+    if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        return NEW(FunExpr)(f->arg_, c[0]);
+    }
+
+    return NEW(CallExpr)(c[0], c[1]);
+}
+
+/**
+ * \brief the expressions one step smaller than e: e replaced by one of its
+ * children or by 0, a number moved towards 0, or a child made smaller
+ */
+static void smaller(PTR(Expr) e, std::vector<PTR(Expr)>& out) {
+    std::vector<PTR(Expr)> kids = children(e);
+
+    for (PTR(Expr) kid : kids) {
+        out.push_back(kid);
+    }
+    if (CAST(NumExpr)(e) == nullptr) {
+        out.push_back(NEW(NumExpr)(0));
+    }
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        if (n->val_ != 0) {
+            out.push_back(NEW(NumExpr)(n->val_ / 2));
+        }
+    }
+
+    for (size_t i = 0; i < kids.size(); i++) {
+        std::vector<PTR(Expr)> kid_smaller;
+        smaller(kids[i], kid_smaller);
+
+        for (PTR(Expr) s : kid_smaller) {
+            std::vector<PTR(Expr)> replaced = kids;
+            replaced[i] = s;
+            out.push_back(rebuild(e, replaced));
+        }
+    }
+}
+
+/**
+ * \brief make a failing program as small as it goes while still failing
+ * \param e the program
+ * \param fails whether a program still fails
+ * \return the smallest failing program found
+ */
+PTR(Expr) Fuzzer::shrink(PTR(Expr) e, const std::function<bool(PTR(Expr))>& fails) {
+    bool progress = true;
+
+    while (progress) {
+        std::vector<PTR(Expr)> candidates;
+        smaller(e, candidates);
+        progress = false;
+
+        for (PTR(Expr) candidate : candidates) {
+            if (fails(candidate)) {
+                e = candidate;
+                progress = true;
+                break;
+            }
+        }
+    }
+
+    return e;
+}
+
+/**
+ * \brief the number of nodes in an expression
+ */
+int Fuzzer::size(PTR(Expr) e) {
+    int n = 1;
+
+    for (PTR(Expr) kid : children(e)) {
+        n += size(kid);
+    }
+
+    return n;
+}
+
+/**
+ * \brief check random programs until one fails
+ * \param cases the number of programs
+ * \param seed case i is made from seed + i
+ * \param threads the number of threads checking programs
+ * \param out where to print the result
+ * \param checker what a program is checked with, check() but for tests
+ * \return true if every program passed
+ */
+bool Fuzzer::run(long cases, unsigned long seed, int threads, std::ostream& out,
+                 const std::function<std::string(const std::string&)>& checker) {
+    std::atomic<long> next(0);
+    std::atomic<long> checked(0);
+    std::atomic<bool> stop(false);
+    std::mutex failure_lock;
+    long failed_case = -1;
+    std::string failed_src;
+    std::string reason;
+
+    auto start = std::chrono::steady_clock::now();
+    auto work = [&] {
+        for (long i = next++; i < cases && ! stop; i = next++) {
+            std::mt19937_64 rng(seed + i);
+            // sizes spread evenly on a log scale, so most programs are small
+            // but every order of magnitude up to max_size comes up
+            int size = (int) std::exp(std::uniform_real_distribution<double>(0, std::log(max_size + 1))(rng));
+            // every other program is well-typed, for the typed engines, and
+            // every other of those has self-recursion, for the JIT; the kind
+            // goes by the case's own seed so --seed=seed+i makes it again
+            unsigned long kind = (seed + i) % 4;
+            std::string src = (kind % 2 == 0 ? random_program(rng, size)
+                                             : random_typed_program(rng, size, max_depth, kind == 3))->to_string();
+            std::string why = checker(src);
+
+            if (! why.empty()) {
+                std::lock_guard<std::mutex> guard(failure_lock);
+
+                if (failed_case < 0 || i < failed_case) {
+                    failed_case = i;
+                    failed_src = src;
+                    reason = why;
+                }
+                stop = true;
+            }
+            checked++;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (failed_case >= 0) {
+        PTR(Expr) shrunk = shrink(parse_str(failed_src), [&](PTR(Expr) candidate) {
+            return ! checker(candidate->to_string()).empty();
+        });
+
+        out << "case " << failed_case << " failed, run it again with --seed=" << seed + failed_case
+            << " --fuzz=1" << std::endl;
+        out << "  program: " << failed_src << std::endl;
+        out << "  " << reason << std::endl;
+        out << "  shrunk to " << size(shrunk) << " nodes: " << shrunk->to_string() << std::endl;
+        out << "  " << checker(shrunk->to_string()) << std::endl;
+
+        return false;
+    }
+
+    out << checked << " cases from seed " << seed << " in " << std::fixed << std::setprecision(2) << seconds
+        << " s on " << threads << " thread" << (threads == 1 ? "" : "s") << ", "
+        << std::setprecision(0) << checked / std::max(seconds, 1e-9) << " per second, all engines agree"
+        << std::endl;
+
+    return true;
+}
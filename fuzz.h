@@ -0,0 +1,32 @@
+/**
+ * \file fuzz.h
+ * \brief Declarations of the in-process differential fuzzer behind --fuzz
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+
+class Expr;
+
+class Fuzzer {
+public:
+    // largest program run() makes, in nodes
+    static int max_size;
+    // deepest nesting of the typed programs run() makes
+    static int max_depth;
+
+    static PTR(Expr)   random_program(std::mt19937_64& rng, int size);
+    static PTR(Expr)   random_typed_program(std::mt19937_64& rng, int size, int max_depth = 64,
+                                            bool recursive = false);
+    static std::string check(const std::string& src);
+    static PTR(Expr)   shrink(PTR(Expr) e, const std::function<bool(PTR(Expr))>& fails);
+    static int         size(PTR(Expr) e);
+    static bool        run(long cases, unsigned long seed, int threads, std::ostream& out,
+                           const std::function<std::string(const std::string&)>& checker = check);
+};
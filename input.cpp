@@ -0,0 +1,105 @@
+/**
+ * \file input.cpp
+ * \brief Definitions of MappedFile, the memory-mapped input behind --file
+ * \author Laura Zhang
+ *
+ * Standard input is read a line at a time, so a program cannot span
+ * lines, and parse() reads a whole stream into a string before parsing
+ * it. A file given with --file is mapped instead and parsed in place.
+ * The kernel is told the mapping is read in order, and the pages the
+ * parser has gone past are given back as it goes, so a huge program costs
+ * about the memory of its tree, not that plus a copy of its text.
+ */
+
+#include "input.h"
+#include "parse.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * \brief map the file at path
+ * \param path the file
+ */
+MappedFile::MappedFile(const std::string& path) : data_(""), size_(0), released_(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        throw std::runtime_error("cannot read " + path + ": " + strerror(errno));
+    }
+    if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)) {
+        close(fd);
+        throw std::runtime_error("cannot read " + path + ": not a regular file");
+    }
+
+    // an empty file cannot be mapped, and has nothing to map anyway
+    if (st.st_size > 0) {
+        void* data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("cannot map " + path + ": " + strerror(error));
+        }
+        madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+        data_ = (const char*) data;
+        size_ = (size_t) st.st_size;
+    }
+
+    // the mapping stays when the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (size_ > 0) {
+        munmap((void*) data_, size_);
+    }
+}
+
+/**
+ * \brief the contents of the file
+ */
+const char* MappedFile::data() const {
+    return data_;
+}
+
+/**
+ * \brief the length of the file
+ */
+size_t MappedFile::size() const {
+    return size_;
+}
+
+/**
+ * \brief give back the pages before offset, which will not be read again;
+ * reading them anyway reads the file again
+ * \param offset bytes from the start of the file
+ */
+void MappedFile::release(size_t offset) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t end = offset / page * page;
+
+    if (end > released_) {
+        madvise((void*) (data_ + released_), end - released_, MADV_DONTNEED);
+        released_ = end;
+    }
+}
+
+/**
+ * \brief parse the whole file at path as one program, which may span
+ * many lines
+ * \param path the file
+ * \return the expression
+ */
+PTR(Expr) parse_file(const std::string& path) {
+    MappedFile file(path);
+
+    return parse_text(file.data(), file.size(), [&](size_t offset) {
+        file.release(offset);
+    });
+}
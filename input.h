@@ -0,0 +1,38 @@
+/**
+ * \file input.h
+ * \brief Declarations of MappedFile, the memory-mapped input behind --file
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <cstddef>
+#include <string>
+
+class Expr;
+
+/**
+ * \brief a file mapped read-only into memory, so that it can be parsed
+ * where it lies instead of being read into a string first
+ */
+class MappedFile {
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    const char* data() const;
+    size_t      size() const;
+    void        release(size_t offset);
+
+private:
+    const char* data_;
+    size_t      size_;
+    // bytes at the start whose pages have been given back
+    size_t      released_;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+PTR(Expr) parse_file(const std::string& path);
@@ -0,0 +1,476 @@
+/**
+ * \file jit.cpp
+ * \brief Definitions of the x86-64 JIT for integer functions
+ * \author Laura Zhang
+ *
+ * A function is compiled when it takes an integer and its body only uses
+ * numbers, booleans, +, *, ==, _if, _let and calls to itself written as
+ * f(f)(arg), where f is the function the closure was made from. Its body
+ * is type checked first, so the generated code needs no type checks; any
+ * other function is left to the interpreter.
+ */
+
+#include "jit.h"
+#include "expr.h"
+#include "val.h"
+#include "env.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * JitCode
+ */
+
+JitCode::JitCode(void* mem, size_t mapped, size_t size, bool returns_bool, std::string self) {
+    mem_ = mem;
+    mapped_ = mapped;
+    size_ = size;
+    fn_ = (jit_fn_t) mem;
+    returns_bool_ = returns_bool;
+    self_ = self;
+}
+
+JitCode::~JitCode() {
+    munmap(mem_, mapped_);
+}
+
+/**
+ * \brief run the native code
+ * \param arg the integer argument
+ * \return the result as a NumVal or BoolVal
+ */
+PTR(Val) JitCode::call(int arg) {
+    int result = fn_(arg);
+
+    if (returns_bool_) {
+        return NEW(BoolVal)(result != 0);
+    }
+
+    return NEW(NumVal)(result);
+}
+
+/*
+ * JitCompiler
+ */
+
+typedef enum {
+    jit_unknown,
+    jit_int,
+    jit_bool,
+} jit_type_t;
+
+// thrown inside the compiler when the function is outside the supported subset
+struct JitReject {};
+
+class JitCompiler {
+public:
+    std::vector<unsigned char> code_;
+    std::string                self_;
+    jit_type_t                 ret_;
+    int                        max_slots_;
+
+    JitCompiler(std::string param);
+
+    void       push_scope(std::string name, jit_type_t type);
+    void       pop_scope();
+    jit_type_t check(PTR(Expr) e);
+    void       emit_function(PTR(Expr) body);
+
+private:
+    struct Slot {
+        std::string name_;
+        jit_type_t  type_;
+    };
+
+    std::string       param_;
+    std::vector<Slot> scope_;
+    std::vector<int>  scope_slots_;
+    int               next_slot_;
+
+    int        find(std::string name);
+    bool       is_self_call(PTR(CallExpr) c);
+    void       expect(jit_type_t found, jit_type_t expected);
+    void       emit(PTR(Expr) e);
+    void       byte(int b);
+    void       bytes(std::initializer_list<int> bs);
+    void       imm32(int v);
+    int        slot_disp(int slot);
+    void       patch_rel32(size_t at, size_t target);
+};
+
+JitCompiler::JitCompiler(std::string param) {
+    param_ = param;
+    ret_ = jit_unknown;
+    max_slots_ = 0;
+    next_slot_ = 0;
+}
+
+void JitCompiler::push_scope(std::string name, jit_type_t type) {
+    scope_.push_back({name, type});
+    scope_slots_.push_back(next_slot_++);
+
+    if (next_slot_ > max_slots_) {
+        max_slots_ = next_slot_;
+    }
+}
+
+void JitCompiler::pop_scope() {
+    scope_.pop_back();
+    scope_slots_.pop_back();
+    next_slot_--;
+}
+
+/**
+ * \brief find the innermost binding of a name
+ * \return its index in scope_, or -1
+ */
+int JitCompiler::find(std::string name) {
+    for (int i = (int) scope_.size() - 1; i >= 0; i--) {
+        if (scope_[i].name_ == name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * \brief recognize the self-application f(f)(arg) that recursive functions
+ * are written with, where f is not bound inside the function
+ */
+bool JitCompiler::is_self_call(PTR(CallExpr) c) {
+    PTR(CallExpr) inner = CAST(CallExpr)(c->callee_);
+
+    if (inner == nullptr) {
+        return false;
+    }
+
+    PTR(VarExpr) f = CAST(VarExpr)(inner->callee_);
+    PTR(VarExpr) g = CAST(VarExpr)(inner->arg_);
+
+    if (f == nullptr || g == nullptr || f->var_ != g->var_ || find(f->var_) != -1) {
+        return false;
+    }
+    if (self_.empty()) {
+        self_ = f->var_;
+    }
+
+    return f->var_ == self_;
+}
+
+void JitCompiler::expect(jit_type_t found, jit_type_t expected) {
+    // a recursive call has an unknown type until the first pass is done
+    if (found != expected && found != jit_unknown) {
+        throw JitReject();
+    }
+}
+
+/**
+ * \brief type check the body; a call to the function itself has type ret_
+ * \param e the expression
+ * \return its type
+ */
+jit_type_t JitCompiler::check(PTR(Expr) e) {
+    if (CAST(NumExpr)(e) != nullptr) {
+        return jit_int;
+    }
+    if (CAST(BoolExpr)(e) != nullptr) {
+        return jit_bool;
+    }
+    if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        int i = find(v->var_);
+
+        if (i == -1) {
+            throw JitReject();
+        }
+
+        return scope_[i].type_;
+    }
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        expect(check(a->lhs_), jit_int);
+        expect(check(a->rhs_), jit_int);
+        return jit_int;
+    }
+    if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        expect(check(m->lhs_), jit_int);
+        expect(check(m->rhs_), jit_int);
+        return jit_int;
+    }
+    if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        jit_type_t lhs = check(q->lhs_);
+        jit_type_t rhs = check(q->rhs_);
+
+        if (lhs == jit_unknown && rhs == jit_unknown) {
+            throw JitReject();
+        }
+        expect(lhs, rhs == jit_unknown ? lhs : rhs);
+        expect(rhs, lhs == jit_unknown ? rhs : lhs);
+        return jit_bool;
+    }
+    if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        expect(check(i->condition_), jit_bool);
+        jit_type_t then_type = check(i->then_);
+        jit_type_t else_type = check(i->else_);
+
+        if (then_type == jit_unknown) {
+            return else_type;
+        }
+        expect(else_type, then_type);
+        return then_type;
+    }
+    if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        jit_type_t rhs = check(l->rhs_);
+
+        if (rhs == jit_unknown) {
+            throw JitReject();
+        }
+
+        push_scope(l->var_, rhs);
+        jit_type_t body = check(l->body_);
+        pop_scope();
+        return body;
+    }
+    if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        if (! is_self_call(c)) {
+            throw JitReject();
+        }
+
+        expect(check(c->arg_), jit_int);
+        return ret_;
+    }
+
+    throw JitReject();
+}
+
+void JitCompiler::byte(int b) {
+    code_.push_back((unsigned char) b);
+}
+
+void JitCompiler::bytes(std::initializer_list<int> bs) {
+    for (int b : bs) {
+        byte(b);
+    }
+}
+
+void JitCompiler::imm32(int v) {
+    unsigned char b[4];
+    memcpy(b, &v, 4);
+    code_.insert(code_.end(), b, b + 4);
+}
+
+int JitCompiler::slot_disp(int slot) {
+    return -8 * (slot + 1);
+}
+
+void JitCompiler::patch_rel32(size_t at, size_t target) {
+    int rel = (int) target - (int) (at + 4);
+    memcpy(&code_[at], &rel, 4);
+}
+
+/**
+ * \brief emit int fn(int) with the argument in slot 0 of the frame
+ * \param body the checked body
+ */
+void JitCompiler::emit_function(PTR(Expr) body) {
+    int frame = ((max_slots_ * 8) + 15) & ~15;
+
+    bytes({0x55});                          // push rbp
+    bytes({0x48, 0x89, 0xe5});              // mov rbp, rsp
+    bytes({0x48, 0x81, 0xec});              // sub rsp, frame
+    imm32(frame);
+    bytes({0x89, 0xbd});                    // mov [rbp + disp], edi
+    imm32(slot_disp(0));
+
+    push_scope(param_, jit_int);
+    emit(body);
+    pop_scope();
+
+    bytes({0xc9});                          // leave
+    bytes({0xc3});                          // ret
+}
+
+/**
+ * \brief emit code leaving the value of e in eax
+ * \param e a checked expression
+ */
+void JitCompiler::emit(PTR(Expr) e) {
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        byte(0xb8);                         // mov eax, imm32
+        imm32(n->val_);
+    }
+    else if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        byte(0xb8);
+        imm32(b->var_ ? 1 : 0);
+    }
+    else if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        bytes({0x8b, 0x85});                // mov eax, [rbp + disp]
+        imm32(slot_disp(scope_slots_[find(v->var_)]));
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        emit(l->rhs_);
+        push_scope(l->var_, jit_unknown);
+        bytes({0x89, 0x85});                // mov [rbp + disp], eax
+        imm32(slot_disp(scope_slots_.back()));
+        emit(l->body_);
+        pop_scope();
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        emit(i->condition_);
+        bytes({0x85, 0xc0});                // test eax, eax
+        bytes({0x0f, 0x84});                // je else
+        size_t to_else = code_.size();
+        imm32(0);
+        emit(i->then_);
+        byte(0xe9);                         // jmp end
+        size_t to_end = code_.size();
+        imm32(0);
+        patch_rel32(to_else, code_.size());
+        emit(i->else_);
+        patch_rel32(to_end, code_.size());
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        emit(c->arg_);
+        bytes({0x89, 0xc7});                // mov edi, eax
+        byte(0xe8);                         // call start
+        imm32(0);
+        patch_rel32(code_.size() - 4, 0);
+    }
+    else {
+        PTR(Expr) lhs, rhs;
+
+        if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+            lhs = a->lhs_;
+            rhs = a->rhs_;
+        }
+        else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+            lhs = m->lhs_;
+            rhs = m->rhs_;
+        }
+        else {
+            PTR(EqExpr) q = CAST(EqExpr)(e);
+            lhs = q->lhs_;
+            rhs = q->rhs_;
+        }
+
+        emit(lhs);
+        byte(0x50);                         // push rax
+        emit(rhs);
+        bytes({0x89, 0xc1});                // mov ecx, eax
+        byte(0x58);                         // pop rax
+
+        if (CAST(AddExpr)(e) != nullptr) {
+            bytes({0x01, 0xc8});            // add eax, ecx
+        }
+        else if (CAST(MultExpr)(e) != nullptr) {
+            bytes({0x0f, 0xaf, 0xc1});      // imul eax, ecx
+        }
+        else {
+            bytes({0x39, 0xc8});            // cmp eax, ecx
+            bytes({0x0f, 0x94, 0xc0});      // sete al
+            bytes({0x0f, 0xb6, 0xc0});      // movzx eax, al
+        }
+    }
+}
+
+/**
+ * \brief compile a function to native code, once per FunExpr
+ * \param f the function
+ * \return the code, or nullptr if f is outside the supported subset or
+ * executable memory is not available
+ */
+PTR(JitCode) jit_compile(FunExpr* f) {
+    if (f->jit_tried_) {
+        return f->jit_;
+    }
+
+    f->jit_tried_ = true;
+
+#if defined(__x86_64__)
+    JitCompiler compiler(f->arg_->var_);
+
+    try {
+        // the first pass finds the result type, the second checks the
+        // recursive calls against it
+        compiler.push_scope(f->arg_->var_, jit_int);
+        compiler.ret_ = compiler.check(f->body_);
+        if (compiler.ret_ == jit_unknown) {
+            return nullptr;
+        }
+        compiler.check(f->body_);
+        compiler.pop_scope();
+
+        compiler.emit_function(f->body_);
+    }
+    catch (JitReject) {
+        return nullptr;
+    }
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = compiler.code_.size();
+    size_t mapped = (size + page - 1) / page * page;
+    void* mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+
+    memcpy(mem, compiler.code_.data(), size);
+
+    if (mprotect(mem, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, mapped);
+        return nullptr;
+    }
+
+    f->jit_ = NEW(JitCode)(mem, mapped, size, compiler.ret_ == jit_bool, compiler.self_);
+#endif
+
+    return f->jit_;
+}
+
+/**
+ * \brief the value bound to a name, without forcing a call-by-need binding
+ * \param env the environment
+ * \param name the name
+ * \return the value, or nullptr if the name is unbound or its binding has
+ * not been evaluated yet
+ */
+static PTR(Val) bound_value(Env* env, const std::string& name) {
+    for (; env != nullptr; env = env->outer_) {
+        if (env->binding_ != nullptr && *env->binding_ == name) {
+            return *env->bound_val_;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * \brief the native code a closure of f made in env may use
+ *
+ * A recursive body assumes f(f) is itself, so the code is only used when
+ * the name it recurses through is bound to a closure of the function that
+ * returned f, which is the case for _let g = _fun (f) _fun (n) ... _in g(g).
+ * The binding is not forced: under --lazy an argument the body never uses
+ * may not terminate, so an unevaluated one means interpreting the closure.
+ * \param f the function
+ * \param env the environment the closure captures
+ * \return the code, or nullptr to interpret the closure
+ */
+PTR(JitCode) jit_closure(FunExpr* f, PTR(Env) env) {
+    PTR(JitCode) code = jit_compile(f);
+
+    if (code == nullptr || code->self_.empty()) {
+        return code;
+    }
+
+    PTR(FunVal) self = CAST(FunVal)(bound_value(env.get(), code->self_));
+
+    if (self != nullptr && self->body_.get() == f) {
+        return code;
+    }
+
+    return nullptr;
+}
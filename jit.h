@@ -0,0 +1,38 @@
+/**
+ * \file jit.h
+ * \brief Declarations of the x86-64 JIT for integer functions
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <cstddef>
+#include <string>
+
+class Val;
+class Env;
+class FunExpr;
+
+typedef int (*jit_fn_t)(int);
+
+class JitCode {
+public:
+    jit_fn_t    fn_;
+    bool        returns_bool_;
+    // name through which the body calls itself, as in f(f)(n), or ""
+    std::string self_;
+    size_t      size_;
+
+    JitCode(void* mem, size_t mapped, size_t size, bool returns_bool, std::string self);
+    ~JitCode();
+
+    PTR(Val) call(int arg);
+
+private:
+    void*  mem_;
+    size_t mapped_;
+};
+
+PTR(JitCode) jit_compile(FunExpr* f);
+PTR(JitCode) jit_closure(FunExpr* f, PTR(Env) env);
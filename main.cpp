@@ -12,13 +12,317 @@
 #include "cmdline.h"
 #include "val.h"
 #include "env.h"
+#include "parallel.h"
+#include "typecheck.h"
+#include "jit.h"
+#include "emit_cpp.h"
+#include "compile.h"
+#include "specialize.h"
+#include "profile.h"
+#include "sample.h"
+#include "trace.h"
+#include "memstats.h"
+#include "stats.h"
+#include "fuzz.h"
+#include "complexity.h"
+#include "output.h"
+#include "input.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static engine_t engine = engine_tree;
+static int threads = (int) std::thread::hardware_concurrency();
+static int grain = 100;
+static bool type_check = false;
+static bool specialize = false;
+static bool print_stats = false;
+static std::string flamegraph_path;
+// deepest expression --interp and --emit-cpp take, see check_depth()
+static const int max_eval_depth = 10000;
+static int sample_rate = 1000;
+static std::string trace_path;
+static std::string input_path;
+static unsigned long fuzz_seed = (unsigned long) time(nullptr);
 
 bool run_tests() {
      const char *argv[] = {"arith"};
      return (Catch::Session().run(1, argv) == 0);
 }
 
+/**
+ * \brief evaluate an expression with the engine chosen by --engine
+ * \param e the expression
+ * \param line the input line it came from, for --trace
+ * \return the value of the expression
+ */
+static PTR(Val) run_engine(PTR(Expr) e, int line) {
+    if (engine == engine_parallel) {
+        if (Expr::profiling) {
+            throw std::runtime_error("--profile cannot be used with --engine=parallel");
+        }
+
+        static std::unique_ptr<WorkStealingPool> pool(new WorkStealingPool(threads, grain));
+        TraceSpan span("evaluate", line);
+
+        return pool->run(e, Env::empty);
+    }
+    if (engine == engine_closure) {
+        PTR(Compiled) code;
+        {
+            TraceSpan span("compile", line);
+            code = compile(e);
+        }
+        TraceSpan span("evaluate", line);
+
+        return code->run();
+    }
+
+    TraceSpan span("evaluate", line);
+
+    return e->interp(Env::empty);
+}
+
+/**
+ * \brief reject an expression nested deeper than the engines can take:
+ * they recurse once per level, and max_eval_depth levels fit in the
+ * default 8 MB stack even with --profile, which needs the most per level
+ * \param e the expression
+ * \return e
+ * \throw std::runtime_error if e is nested too deeply
+ */
+static PTR(Expr) check_depth(PTR(Expr) e) {
+    if (e->depth() > max_eval_depth) {
+        throw std::runtime_error("input nested too deeply");
+    }
+
+    return e;
+}
+
+/**
+ * \brief interpret an expression with the engine chosen by --engine, after
+ * specializing it if --specialize was given and type checking it if
+ * --typecheck was given, and print --stats to standard error
+ * \param e the expression
+ * \return the value of the expression
+ */
+PTR(Val) interp_with_engine(PTR(Expr) e) {
+    check_depth(e);
+
+    Specializer specializer;
+    int line = Profiler::line_offset + 1;
+
+    {
+        TraceSpan span("optimize", line);
+
+        if (specialize) {
+            e = specializer.rewrite(e);
+        }
+        if (type_check) {
+            typecheck(e);
+        }
+    }
+    if (! flamegraph_path.empty() || Trace::calls) {
+        Sampler::name_functions(e, Profiler::line_offset);
+    }
+    if (! flamegraph_path.empty() && ! Sampler::enabled) {
+        Sampler::start(sample_rate);
+    }
+
+    long hits_before = VarExpr::cache_hits;
+    long misses_before = VarExpr::cache_misses;
+
+    PTR(Val) v = run_engine(e, line);
+
+    if (! flamegraph_path.empty() || Trace::calls) {
+        Sampler::forget_functions();
+    }
+
+    if (print_stats) {
+        long hits = VarExpr::cache_hits - hits_before;
+        long lookups = hits + VarExpr::cache_misses - misses_before;
+
+        std::cerr << "variable cache: " << hits << " hits, " << lookups - hits << " misses";
+        if (lookups > 0) {
+            std::cerr << " (" << std::fixed << std::setprecision(1) << 100.0 * hits / lookups << "% hit rate)";
+        }
+        std::cerr << std::endl;
+
+        std::cerr << "specialized nodes: " << specializer.total();
+        for (auto& count : specializer.counts_) {
+            if (count.second > 0) {
+                std::cerr << ", " << count.first << " " << count.second;
+            }
+        }
+        std::cerr << std::endl;
+    }
+
+    return v;
+}
+
+/**
+ * \brief write what --interp, --print or --pretty-print makes of an
+ * expression to standard output, after the line of dashes its input
+ * starts with
+ * \param mode do_interp, do_print or do_pretty_print
+ * \param e the expression
+ */
+static void write_result(run_mode_t mode, PTR(Expr) e) {
+    if (mode == do_interp) {
+        PTR(Val) v = interp_with_engine(e);
+        std::cout << "interp value: " << v->to_string() << '\n';
+    }
+    else if (mode == do_print) {
+        std::cout << "print value: ";
+        e->print(std::cout);
+        std::cout << '\n';
+    }
+    else {
+        std::cout << "pretty print value: \n";
+        e->pretty_print(std::cout);
+        std::cout << '\n';
+    }
+    std::cout << "--------------------\n\n";
+    Output::end_result(std::cout);
+}
+
+/**
+ * \brief read expressions from standard input, one per line, and write
+ * what --interp, --print or --pretty-print makes of each to standard output
+ * \param mode do_interp, do_print or do_pretty_print
+ */
+static void run_lines(run_mode_t mode) {
+    std::cout << "Type your expression here: ";
+    Output::end_result(std::cout);
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(std::cin, line)) {
+        std::cout << "--------------------\n";
+        Profiler::line_offset = line_number++;
+        PTR(Expr) e;
+        {
+            TraceSpan span("parse", line_number);
+            e = parse_str(line);
+        }
+        write_result(mode, e);
+    }
+}
+
+/**
+ * \brief read one expression, which may span many lines, from the file
+ * given with --file, and write what --interp, --print or --pretty-print
+ * makes of it to standard output
+ * \param mode do_interp, do_print or do_pretty_print
+ */
+static void run_file(run_mode_t mode) {
+    std::cout << "--------------------\n";
+    Profiler::line_offset = 0;
+    PTR(Expr) e;
+    {
+        TraceSpan span("parse", 1);
+        e = parse_file(input_path);
+    }
+    write_result(mode, e);
+}
+
+/**
+ * \brief answer framed requests as if each were the standard input of a
+ * fresh msdscript run in `mode`, so that one process serves many inputs.
+ * A request is a decimal byte count and a newline followed by that many
+ * bytes; the reply is "CODE OUTLEN ERRLEN\n" followed by OUTLEN bytes of
+ * standard output and ERRLEN bytes of standard error. Stops at the end
+ * of `frames`.
+ * \param mode do_interp, do_print or do_pretty_print
+ * \param frames the requests
+ * \param replies where the replies go
+ */
+void serve_worker(run_mode_t mode, std::istream& frames, std::ostream& replies) {
+    std::string header;
+
+    while (std::getline(frames, header)) {
+        if (header.empty() || header.size() > 18 || header.find_first_not_of("0123456789") != std::string::npos) {
+            throw std::runtime_error("bad worker request: " + header);
+        }
+
+        std::string input(std::stoull(header), '\0');
+        if (! frames.read(&input[0], input.size())) {
+            throw std::runtime_error("truncated worker request");
+        }
+
+        std::istringstream in(input);
+        std::ostringstream out;
+        std::ostringstream err;
+        std::streambuf* old_in = std::cin.rdbuf(in.rdbuf());
+        std::streambuf* old_out = std::cout.rdbuf(out.rdbuf());
+        std::streambuf* old_err = std::cerr.rdbuf(err.rdbuf());
+        int code = 0;
+
+        try {
+            run_lines(mode);
+        }
+        catch (std::runtime_error exn) {
+            std::cerr << exn.what() << std::endl;
+            code = 1;
+        }
+
+        std::cin.rdbuf(old_in);
+        std::cin.clear();
+        std::cout.rdbuf(old_out);
+        std::cerr.rdbuf(old_err);
+
+        std::string o = out.str();
+        std::string e = err.str();
+        replies << code << " " << o.size() << " " << e.size() << "\n" << o << e;
+        replies.flush();
+    }
+}
+
+/**
+ * \brief parse a positive integer given to an option such as --threads=N
+ * \param option the option name, for the error message
+ * \param value the text after '='
+ * \return the integer
+ */
+static int option_int(const std::string& option, const std::string& value) {
+    if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos || std::stoi(value) < 1) {
+        std::cerr << "Error: " << option << " expects a positive integer." << std::endl;
+        exit(1);
+    }
+
+    return std::stoi(value);
+}
+
+/**
+ * \brief parse the seed given to --seed, which can be any unsigned long
+ * like the time it defaults to
+ * \param value the text after '='
+ * \return the seed
+ */
+static unsigned long option_seed(const std::string& value) {
+    if (! value.empty() && value.size() <= 20 && value.find_first_not_of("0123456789") == std::string::npos) {
+        try {
+            return std::stoul(value);
+        }
+        catch (std::out_of_range&) {
+        }
+    }
+
+    std::cerr << "Error: --seed expects an integer from 0 to " << ULONG_MAX << "." << std::endl;
+    exit(1);
+}
+
 run_mode_t use_arguments(int argc, const char * argv[]) {
     if (argc > 1) {
         bool tested = false;
@@ -34,6 +338,31 @@ run_mode_t use_arguments(int argc, const char * argv[]) {
                 std::cout << "    --interp <accept a single expression and print the result>" << std::endl;
                 std::cout << "    --print <accept a single expression and print it to standard output>" << std::endl;
                 std::cout << "    --pretty-print <accept a single expression and print it to standard output using the pretty_print method>" << std::endl;
+                std::cout << "    --file=PATH <read one expression, which may span lines, from PATH instead of one per line from standard input, for --interp, --print, --pretty-print and --emit-cpp; must come before them>" << std::endl;
+                std::cout << "    --width=N <break --pretty-print lines that would run past N columns where the layout allows, no limit by default>" << std::endl;
+                std::cout << "    --worker=MODE <serve framed inputs for interp, print or pretty-print, one after another, for test harnesses>" << std::endl;
+                std::cout << "    --emit-cpp[=NAME] <translate a whole script from standard input to a C++ function NAME, msd_main by default>" << std::endl;
+                std::cout << "    --lazy <evaluate _let values and function arguments on first use, must come before --interp>" << std::endl;
+                std::cout << "    --specialize <replace common shapes such as x + 1 with faster nodes before --interp evaluates them>" << std::endl;
+                std::cout << "    --profile <print evaluation counts, times and allocations per node type and source location to standard error at exit>" << std::endl;
+                std::cout << "    --flamegraph=FILE <sample the MSDScript call stack while --interp runs and write collapsed stacks to FILE at exit>" << std::endl;
+                std::cout << "    --sample-rate=N <samples per second of CPU time for --flamegraph, 1000 by default>" << std::endl;
+                std::cout << "    --trace=FILE <write the parse, optimize, compile and evaluate phases of each --interp line to FILE as Chrome trace-event JSON at exit>" << std::endl;
+                std::cout << "    --trace-calls <also record every function call in --trace>" << std::endl;
+                std::cout << "    --mem-stats <print live, peak and total counts and bytes of the objects made per type to standard error at exit>" << std::endl;
+                std::cout << "    --stats <print interpreter statistics to standard error after each --interp expression>" << std::endl;
+                std::cout << "    --typecheck <reject ill-typed expressions before --interp evaluates them>" << std::endl;
+                std::cout << "    --engine=tree|parallel|jit|closure <choose how --interp evaluates, tree by default>" << std::endl;
+                std::cout << "    --flush=result|full <write standard output after every result, or only when its buffer fills up; result on a terminal, full otherwise; a crash loses the results buffered under full>" << std::endl;
+                std::cout << "    --threads=N <number of threads for --engine=parallel>" << std::endl;
+                std::cout << "    --grain=N <smallest estimated subtree cost that --engine=parallel runs in parallel>" << std::endl;
+                std::cout << "    --fuzz=N <check N random programs on every engine and shrink the first that fails, on --threads threads>" << std::endl;
+                std::cout << "    --fuzz-size=N <largest program --fuzz makes, in nodes, 40 by default>" << std::endl;
+                std::cout << "    --seed=N <seed of the first --fuzz program or --complexity structure, or of --generate, the time by default, must come first>" << std::endl;
+                std::cout << "    --generate=N <print a random well-typed program of about N nodes, for load testing>" << std::endl;
+                std::cout << "    --max-depth=N <deepest nesting of the well-typed programs --fuzz and --generate make, 64 by default>" << std::endl;
+                std::cout << "    --complexity=N <time parse, print, pretty-print, equals, typecheck and interp on N random structures grown to several sizes, and flag any that grows faster than n log n>" << std::endl;
+                std::cout << "    --complexity-depth=N <deepest nesting --complexity grows a structure to, 4096 by default>" << std::endl;
 
                 exit(0);
             }
@@ -51,45 +380,207 @@ run_mode_t use_arguments(int argc, const char * argv[]) {
 
                 tested = true;
             }
-            else if (cur_cmd == "--interp") {
-                std::cout << "Type your expression here: ";
+            else if (cur_cmd == "--lazy") {
+                Expr::call_by_need = true;
+            }
+            else if (cur_cmd == "--specialize") {
+                specialize = true;
+            }
+            else if (cur_cmd == "--profile") {
+                Profiler::enable();
+                VarExpr::cache_stats = true;
+                std::atexit([] {
+                    Profiler::report(std::cerr);
+                });
+            }
+            else if (cur_cmd.rfind("--flamegraph=", 0) == 0) {
+                flamegraph_path = cur_cmd.substr(13);
+                if (flamegraph_path.empty()) {
+                    std::cerr << "Error: --flamegraph expects a file name." << std::endl;
+                    exit(1);
+                }
+                std::atexit([] {
+                    Sampler::stop();
+                    std::ofstream out(flamegraph_path);
+                    Sampler::write(out);
+                    if (! out) {
+                        std::cerr << "Error: cannot write " << flamegraph_path << std::endl;
+                    }
+                });
+            }
+            else if (cur_cmd.rfind("--sample-rate=", 0) == 0) {
+                sample_rate = option_int("--sample-rate", cur_cmd.substr(14));
+            }
+            else if (cur_cmd.rfind("--trace=", 0) == 0) {
+                trace_path = cur_cmd.substr(8);
+                if (trace_path.empty()) {
+                    std::cerr << "Error: --trace expects a file name." << std::endl;
+                    exit(1);
+                }
+                Trace::start();
+                std::atexit([] {
+                    Trace::enabled = false;
+                    Trace::calls = false;
+                    std::ofstream out(trace_path);
+                    Trace::write(out);
+                    if (! out) {
+                        std::cerr << "Error: cannot write " << trace_path << std::endl;
+                    }
+                });
+            }
+            else if (cur_cmd == "--trace-calls") {
+                if (trace_path.empty()) {
+                    std::cerr << "Error: --trace-calls must come after --trace=FILE." << std::endl;
+                    exit(1);
+                }
+                Trace::calls = true;
+            }
+            else if (cur_cmd == "--mem-stats") {
+                MemStats::enable();
+                std::atexit([] {
+                    MemStats::report(std::cerr);
+                });
+            }
+            else if (cur_cmd == "--stats") {
+                print_stats = true;
+                VarExpr::cache_stats = true;
+            }
+            else if (cur_cmd == "--typecheck") {
+                type_check = true;
+            }
+            else if (cur_cmd == "--engine=tree") {
+                engine = engine_tree;
+            }
+            else if (cur_cmd == "--engine=parallel") {
+                engine = engine_parallel;
+            }
+            else if (cur_cmd == "--engine=closure") {
+                engine = engine_closure;
+            }
+            else if (cur_cmd == "--engine=jit") {
+                engine = engine_jit;
+                FunExpr::use_jit = true;
+            }
+            else if (cur_cmd.rfind("--file=", 0) == 0) {
+                input_path = cur_cmd.substr(7);
 
-                std::string line;
-                while (std::getline(std::cin, line)) {
-                    std::cout << "--------------------" << std::endl;
-                    std::cout << "interp value: " << parse_str(line)->interp(Env::empty) << std::endl;
-                    std::cout << "--------------------" << std::endl << std::endl;
+                if (input_path.empty()) {
+                    std::cerr << "Error: --file expects a file name." << std::endl;
+                    exit(1);
+                }
+            }
+            else if (cur_cmd.rfind("--width=", 0) == 0) {
+                PrettyWriter::default_width = option_int("--width", cur_cmd.substr(8));
+            }
+            else if (cur_cmd == "--flush=result") {
+                Output::policy = flush_result;
+            }
+            else if (cur_cmd == "--flush=full") {
+                Output::policy = flush_full;
+            }
+            else if (cur_cmd.rfind("--threads=", 0) == 0) {
+                threads = option_int("--threads", cur_cmd.substr(10));
+            }
+            else if (cur_cmd.rfind("--grain=", 0) == 0) {
+                grain = option_int("--grain", cur_cmd.substr(8));
+            }
+            else if (cur_cmd.rfind("--seed=", 0) == 0) {
+                fuzz_seed = option_seed(cur_cmd.substr(7));
+            }
+            else if (cur_cmd.rfind("--fuzz-size=", 0) == 0) {
+                Fuzzer::max_size = option_int("--fuzz-size", cur_cmd.substr(12));
+            }
+            else if (cur_cmd.rfind("--complexity-depth=", 0) == 0) {
+                Complexity::max_depth = option_int("--complexity-depth", cur_cmd.substr(19));
+            }
+            else if (cur_cmd.rfind("--complexity=", 0) == 0) {
+                long structures = option_int("--complexity", cur_cmd.substr(13));
+
+                if (! Complexity::run(structures, fuzz_seed, std::cout)) {
+                    exit(1);
+                }
+
+                return do_fuzz;
+            }
+            else if (cur_cmd.rfind("--max-depth=", 0) == 0) {
+                Fuzzer::max_depth = option_int("--max-depth", cur_cmd.substr(12));
+            }
+            else if (cur_cmd.rfind("--generate=", 0) == 0) {
+                std::mt19937_64 rng(fuzz_seed);
+
+                Fuzzer::random_typed_program(rng, option_int("--generate", cur_cmd.substr(11)), Fuzzer::max_depth)->print(std::cout);
+                std::cout << '\n';
+
+                return do_fuzz;
+            }
+            else if (cur_cmd.rfind("--fuzz=", 0) == 0) {
+                long cases = option_int("--fuzz", cur_cmd.substr(7));
+
+                if (! Fuzzer::run(cases, fuzz_seed, threads, std::cout)) {
+                    exit(1);
+                }
+
+                return do_fuzz;
+            }
+            else if (cur_cmd == "--interp") {
+                if (input_path.empty()) {
+                    run_lines(do_interp);
+                }
+                else {
+                    run_file(do_interp);
                 }
 
                 return do_interp;
             }
             else if (cur_cmd == "--print") {
-                std::cout << "Type your expression here: ";
-
-                std::string line;
-                while (std::getline(std::cin, line)) {
-                    std::cout << "--------------------" << std::endl;
-                    std::cout << "print value: ";
-                    parse_str(line)->print(std::cout);
-                    std::cout << std::endl;
-                    std::cout << "--------------------" << std::endl << std::endl;
+                if (input_path.empty()) {
+                    run_lines(do_print);
+                }
+                else {
+                    run_file(do_print);
                 }
 
                 return do_print;
             }
             else if (cur_cmd == "--pretty-print") {
-                std::cout << "Type your expression here: ";
-
-                std::string line;
-                while (std::getline(std::cin, line)) {
-                    std::cout << "--------------------" << std::endl;
-                    std::cout << "pretty print value: " << std::endl;
-                    std::cout << parse_str(line)->to_pretty_string() << std::endl;
-                    std::cout << "--------------------" << std::endl << std::endl;
+                if (input_path.empty()) {
+                    run_lines(do_pretty_print);
+                }
+                else {
+                    run_file(do_pretty_print);
                 }
 
                 return do_pretty_print;
             }
+            else if (cur_cmd.rfind("--worker=", 0) == 0) {
+                std::string name = cur_cmd.substr(9);
+                run_mode_t mode = name == "interp" ? do_interp
+                                : name == "print" ? do_print
+                                : name == "pretty-print" ? do_pretty_print
+                                : do_nothing;
+
+                if (mode == do_nothing) {
+                    std::cerr << "Error: --worker expects interp, print or pretty-print." << std::endl;
+                    exit(1);
+                }
+
+                serve_worker(mode, std::cin, std::cout);
+
+                return do_worker;
+            }
+            else if (cur_cmd == "--emit-cpp" || cur_cmd.rfind("--emit-cpp=", 0) == 0) {
+                std::string name = cur_cmd == "--emit-cpp" ? "msd_main" : cur_cmd.substr(11);
+
+                if (name.empty() || isdigit(name[0]) || name.find_first_not_of(
+                        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != std::string::npos) {
+                    std::cerr << "Error: --emit-cpp expects a C++ identifier." << std::endl;
+                    exit(1);
+                }
+
+                std::cout << emit_cpp(check_depth(input_path.empty() ? parse(std::cin) : parse_file(input_path)), name);
+
+                return do_emit_cpp;
+            }
             else {
                 std::cerr << "Error: Invalid command." << std::endl;
                 exit(1);
@@ -107,6 +598,7 @@ run_mode_t use_arguments(int argc, const char * argv[]) {
 
 int main(int argc, const char * argv[]) {
     try {
+        Output::install();
         use_arguments(argc, argv);
 
         exit(0);
@@ -781,3 +1273,1084 @@ TEST_CASE("env") {
     CHECK_THROWS_WITH((NEW(ExtendedEnv)("x", NEW(NumVal)(1), NEW(ExtendedEnv)("y", NEW(NumVal)(99), Env::empty)))->lookup("b"), "free variable: b");
     CHECK((NEW(ExtendedEnv)("x", NEW(NumVal)(1), NEW(ExtendedEnv)("y", NEW(NumVal)(99), Env::empty)))->lookup("y")->equals(NEW(NumVal)(99)));
 }
+
+TEST_CASE("closures") {
+    CHECK(parse_str("_let y = 8 _in _let f = _fun (x) x + y _in f(2)")->interp(Env::empty)->to_string() == "10");
+    CHECK(parse_str("_let add = _fun (x) _fun (y) x + y _in add(3)(4)")->interp(Env::empty)->to_string() == "7");
+    CHECK(parse_str("_let fact = _fun (f) _fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1) _in fact(fact)(5)")
+                  ->interp(Env::empty)->to_string() == "120");
+}
+
+TEST_CASE("call by need") {
+    Expr::call_by_need = true;
+
+    // unused bindings are never evaluated, so their errors never surface
+    CHECK(parse_str("_let x = _true + 1 _in 5")->interp(Env::empty)->to_string() == "5");
+    CHECK(parse_str("(_fun (x) 5)(_true + 1)")->interp(Env::empty)->to_string() == "5");
+    CHECK(parse_str("_let x = _true + 1\n"
+                    "_in  _if _true\n"
+                    "     _then 5\n"
+                    "     _else x")->interp(Env::empty)->to_string() == "5");
+
+    // used bindings raise the same error as eager evaluation, at first use
+    CHECK_THROWS_WITH(parse_str("_let x = _true + 1 _in x * 2")->interp(Env::empty), "invalid type for BoolVal::add_to()");
+    CHECK_THROWS_WITH(parse_str("_let x = y _in x")->interp(Env::empty), "free variable: y");
+    CHECK_THROWS_WITH(parse_str("1(_true + 1)")->interp(Env::empty), "invalid type for BoolVal::add_to()");
+
+    // values agree with eager evaluation
+    CHECK(parse_str("_let x = 2 + 3 _in x * x")->interp(Env::empty)->equals(NEW(NumVal)(25)));
+    CHECK(parse_str("_let y = 8 _in _let f = _fun (x) x + y _in f(2)")->interp(Env::empty)->to_string() == "10");
+    CHECK(parse_str("_let fact = _fun (f) _fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1) _in fact(fact)(5)")
+                  ->interp(Env::empty)->to_string() == "120");
+
+    // the argument is evaluated in the caller's environment, not the callee's
+    CHECK(parse_str("_let x = 1 _in _let f = _fun (y) _let x = 100 _in y _in f(x + 1)")
+                  ->interp(Env::empty)->to_string() == "2");
+
+    // forcing is memoized: a shared thunk is evaluated once per binding
+    PTR(LazyEnv) env = NEW(LazyEnv)("x", parse_str("1 + 2"), Env::empty, Env::empty);
+    CHECK(env->lookup("x")->equals(NEW(NumVal)(3)));
+    CHECK(env->expr_ == nullptr);
+    CHECK(env->lookup("x") == env->lookup("x"));
+
+    Expr::call_by_need = false;
+}
+
+TEST_CASE("parallel engine") {
+    // a grain of 1 forks every pair of operands that contains a call
+    WorkStealingPool pool(4, 1);
+    std::string fib = "_let fib = _fun (f) _fun (n)\n"
+                      "            _if n == 0 _then 0\n"
+                      "            _else _if n == 1 _then 1\n"
+                      "            _else f(f)(n + -1) + f(f)(n + -2)\n"
+                      "_in ";
+
+    CHECK(pool.run(parse_str("1 + 2 * 3"), Env::empty)->equals(NEW(NumVal)(7)));
+    CHECK(pool.run(parse_str(fib + "fib(fib)(15)"), Env::empty)->equals(NEW(NumVal)(610)));
+    CHECK(pool.run(parse_str(fib + "fib(fib)(10) == fib(fib)(10)"), Env::empty)->equals(NEW(BoolVal)(true)));
+    CHECK(pool.run(parse_str(fib + "(_fun (x) x * 2)(fib(fib)(10))"), Env::empty)->equals(NEW(NumVal)(110)));
+
+    // the leftmost failure is reported whichever subtree finishes first
+    for (int i = 0; i < 20; i++) {
+        CHECK_THROWS_WITH(pool.run(parse_str(fib + "(fib(fib)(8) + x) + (fib(fib)(8) + _true)"), Env::empty), "free variable: x");
+        CHECK_THROWS_WITH(pool.run(parse_str(fib + "(fib(fib)(8) + _true) + (fib(fib)(8) + x)"), Env::empty), "invalid type for NumVal::add_to()");
+        CHECK_THROWS_WITH(pool.run(parse_str(fib + "fib(fib)(8)(fib(fib)(8) + y)"), Env::empty), "free variable: y");
+    }
+
+    // idle workers park instead of spinning, and the next fork wakes them
+    for (int i = 0; i < 2000 && pool.parked() < 3; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(pool.parked() == 3);
+    long steals = pool.steals();
+    CHECK(pool.run(parse_str(fib + "fib(fib)(15)"), Env::empty)->equals(NEW(NumVal)(610)));
+    CHECK(pool.steals() > steals);
+
+    // estimated costs drive the forks
+    PTR(Expr) e = parse_str("(_fun (x) x)(1) + 2 * 3");
+    CHECK(annotate_cost(e) == 1 + (1 + CALL_COST + 1 + 1) + 3);
+
+    Expr::call_by_need = true;
+    CHECK_THROWS_WITH(pool.run(parse_str("1"), Env::empty), "call-by-need evaluation cannot run in parallel");
+    Expr::call_by_need = false;
+}
+
+TEST_CASE("typecheck") {
+    CHECK(typecheck(parse_str("1 + 2 * 3"))->to_string() == "int");
+    CHECK(typecheck(parse_str("1 == _true"))->to_string() == "bool");
+    CHECK(typecheck(parse_str("_if 1 == 2 _then 5 _else 6"))->to_string() == "int");
+    CHECK(typecheck(parse_str("_fun (x) x + 1"))->to_string() == "int -> int");
+    CHECK(typecheck(parse_str("_fun (x) x"))->to_string() == "'a -> 'a");
+    CHECK(typecheck(parse_str("_fun (f) _fun (x) f(f(x))"))->to_string() == "('a -> 'a) -> 'a -> 'a");
+    CHECK(typecheck(parse_str("_let add = _fun (x) _fun (y) x + y _in add(3)"))->to_string() == "int -> int");
+
+    // _let-bound functions are polymorphic, function parameters are not
+    CHECK(typecheck(parse_str("_let id = _fun (x) x _in _if id(_true) _then id(1) _else 2"))->to_string() == "int");
+    CHECK_THROWS_WITH(typecheck(parse_str("(_fun (id) _if id(_true) _then id(1) _else 2)(_fun (x) x)")),
+                      "type error: expected int -> 'a but found bool -> bool for id in id(1)");
+
+    // the argument types unify before the results clash, and the message
+    // still shows the parameter type unbound
+    CHECK_THROWS_WITH(typecheck(parse_str("_let apply = _fun (h) h(1) + 1 _in _fun (f) _fun (x) _if f(x) _then apply(f) _else 0")),
+                      "type error: expected ('b -> bool) -> 'a but found (int -> int) -> int for apply in apply(f)");
+    CHECK_THROWS_WITH(typecheck(parse_str("_true + 1")), "type error: expected int but found bool for _true in (_true+1)");
+    CHECK_THROWS_WITH(typecheck(parse_str("_if 1 + 2 _then 3 _else 4")),
+                      "type error: expected bool but found int for (1+2) in (_if (1+2) _then 3 _else 4)");
+    CHECK_THROWS_WITH(typecheck(parse_str("_if _true _then 3 _else _false")),
+                      "type error: expected int but found bool for _false in (_if _true _then 3 _else _false)");
+    CHECK_THROWS_WITH(typecheck(parse_str("1(2)")), "type error: cannot call int 1 in 1(2)");
+    CHECK_THROWS_WITH(typecheck(parse_str("_fun (f) f(f)")), "type error: f would need a recursive type in f(f)");
+    CHECK_THROWS_WITH(typecheck(parse_str("_if _true _then 1 _else x")), "free variable: x");
+
+    // checked programs evaluate the same through the unchecked fast paths
+    PTR(Expr) e = parse_str("_let f = _fun (x) _if x == 0 _then 1 _else x * 2 _in f(0) + f(5)");
+    typecheck(e);
+    CHECK(e->typed_);
+    CHECK(e->interp(Env::empty)->equals(NEW(NumVal)(11)));
+
+    TypeInference ti;
+    ti.allow_free_ = true;
+    CHECK(ti.infer(parse_str("_if b _then x + 1 _else y"))->to_string() == "int");
+    CHECK(ti.free_vars()["b"]->to_string() == "bool");
+    CHECK(ti.free_vars()["y"]->to_string() == "int");
+}
+
+TEST_CASE("jit") {
+    FunExpr::use_jit = true;
+
+    SECTION("compiled functions agree with the tree walker") {
+        std::string programs[] = {
+                "_let fact = _fun (f) _fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1)\n"
+                "_in fact(fact)(10)",
+                "_let fib = _fun (f) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1\n"
+                "                             _else f(f)(n + -1) + f(f)(n + -2)\n"
+                "_in fib(fib)(20)",
+                "_let even = _fun (f) _fun (n) _if n == 0 _then _true _else _if n == 1 _then _false\n"
+                "                              _else f(f)(n + -2)\n"
+                "_in even(even)(17)",
+                "_let sq = _fun (x) _let y = x * x _in _let b = y == 16 _in _if b _then y + 1 _else y\n"
+                "_in sq(4) + sq(5)",
+                "_let id = _fun (x) x _in id(2147483647) + id(1)",
+        };
+
+        for (const std::string& src : programs) {
+            FunExpr::use_jit = false;
+            std::string tree = parse_str(src)->interp(Env::empty)->to_string();
+            FunExpr::use_jit = true;
+            CHECK(parse_str(src)->interp(Env::empty)->to_string() == tree);
+        }
+    }
+
+    SECTION("which functions are compiled") {
+        PTR(FunExpr) fact = CAST(FunExpr)(parse_str("_fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1)"));
+        PTR(JitCode) code = jit_compile(fact.get());
+        REQUIRE(code != nullptr);
+        CHECK(code->self_ == "f");
+        CHECK(! code->returns_bool_);
+
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) x == 1")).get())->returns_bool_);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) x + y")).get()) == nullptr);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) _fun (y) x")).get()) == nullptr);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) _if x _then 1 _else 2")).get()) == nullptr);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) _if x == 1 _then 1 _else _true")).get()) == nullptr);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) g(x)")).get()) == nullptr);
+        CHECK(jit_compile(CAST(FunExpr)(parse_str("_fun (x) f(f)(x)")).get()) == nullptr);
+    }
+
+    SECTION("closures fall back to the interpreter") {
+        // the recursion goes through a function other than the one that made the closure
+        CHECK(parse_str("_let other = _fun (f) _fun (n) n * 100\n"
+                        "_in _let g = _fun (f) _fun (n) _if n == 0 _then 1 _else f(f)(n + -1)\n"
+                        "_in g(other)(3)")->interp(Env::empty)->to_string() == "200");
+        CHECK_THROWS_WITH(parse_str("_let sq = _fun (x) x * x _in sq(_true)")->interp(Env::empty),
+                          "invalid type for BoolVal::mult_with()");
+    }
+
+    SECTION("a call-by-need self argument is not forced") {
+        // the recursion parameter would loop forever, but n == 0 never uses it
+        Expr::call_by_need = true;
+        CHECK(parse_str("_let g = _fun (f) _fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1)\n"
+                        "_in g(_let w = _fun (x) x(x) _in w(w))(0)")->interp(Env::empty)->to_string() == "1");
+        CHECK(parse_str("_let fact = _fun (f) _fun (n) _if n == 0 _then 1 _else n * f(f)(n + -1)\n"
+                        "_in fact(fact)(10)")->interp(Env::empty)->to_string() == "3628800");
+        Expr::call_by_need = false;
+    }
+
+    FunExpr::use_jit = false;
+}
+
+TEST_CASE("emit cpp") {
+    SECTION("typed scripts use int, bool and interface structs") {
+        CppEmitter emitter("area");
+        std::string src = emitter.emit(parse_str("_let sq = _fun (x) x * x _in _if wide _then sq(w) _else sq(h) + 1"));
+
+        CHECK(emitter.typed_);
+        CHECK(src.find("//     int area(int v_h, int v_w, bool v_wide);") != std::string::npos);
+        CHECK(src.find("struct Fii {") != std::string::npos);
+        CHECK(src.find("struct closure_0 : msd::Fii {") != std::string::npos);
+        CHECK(src.find("MSD_RUNTIME") == std::string::npos);
+    }
+
+    SECTION("closures capture the variables they use") {
+        std::string src = emit_cpp(parse_str("_let k = 3 _in _fun (x) x + k"), "adder");
+
+        CHECK(src.find("//     std::shared_ptr<msd::Fii> adder();") != std::string::npos);
+        CHECK(src.find("    closure_0(int k_0) : k_0(k_0) { shape_ = 0; }") != std::string::npos);
+        CHECK(src.find("std::make_shared<adder_impl::closure_0>(k_0)") != std::string::npos);
+    }
+
+    SECTION("untyped scripts use the checked runtime") {
+        CppEmitter emitter("msd_main");
+        std::string src = emitter.emit(parse_str("_let f = _fun (f) _fun (n) _if n == 0 _then 0 _else f(f)(n + -1) _in f(f)(n)"));
+
+        CHECK(! emitter.typed_);
+        CHECK(src.find("//     msd::Value msd_main(msd::Value v_n);") != std::string::npos);
+        CHECK(src.find("#ifndef MSD_RUNTIME") != std::string::npos);
+        CHECK(src.find("msd::call(") != std::string::npos);
+    }
+}
+
+TEST_CASE("closure compilation") {
+    std::string programs[] = {
+            "_let fib = _fun (f) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1\n"
+            "                             _else f(f)(n + -1) + f(f)(n + -2)\n"
+            "_in fib(fib)(15)",
+            "_let x = 1 _in _let g = _fun (y) x + y _in _let x = 10 _in g(x)",
+            "_let add = _fun (a) _fun (b) _fun (c) a + b * c _in add(1)(2)(3)",
+            "_let f = _fun (x) _let y = x * 2 _in _let z = y + x _in z == 9 _in f(3)",
+            "2 * 3 + 4",
+            "_fun (x) x + 1",
+            "(_fun (x) x) == (_fun (x) x)",
+            "_if 1 == 1 _then _true _else _false",
+    };
+
+    for (const std::string& src : programs) {
+        PTR(Expr) e = parse_str(src);
+        CHECK(compile(e)->run()->to_string() == e->interp(Env::empty)->to_string());
+    }
+
+    // compiled closures compare equal to interpreted ones with the same code
+    CHECK(compile(parse_str("_fun (x) x + 1"))->run()->equals(parse_str("_fun (x) x + 1")->interp(Env::empty)));
+
+    // the compiled code can be run again and gives the same value
+    PTR(Compiled) code = compile(parse_str(programs[0]));
+    CHECK(code->run()->to_string() == "610");
+    CHECK(code->run()->to_string() == "610");
+
+    CHECK_THROWS_WITH(compile(parse_str("x + 1"))->run(), "free variable: x");
+    CHECK_THROWS_WITH(compile(parse_str("_true + 1"))->run(), "invalid type for BoolVal::add_to()");
+    CHECK_THROWS_WITH(compile(parse_str("1 + _true"))->run(), "invalid type for NumVal::add_to()");
+    CHECK_THROWS_WITH(compile(parse_str("_let f = 1 _in f(2)"))->run(), "invalid type for NumVal::call()");
+    CHECK_THROWS_WITH(compile(parse_str("_if 1 _then 2 _else 3"))->run(), "invalid type for NumVal::is_true()");
+}
+
+TEST_CASE("specialize") {
+    SECTION("nodes are replaced and counted") {
+        Specializer specializer;
+        PTR(Expr) e = specializer.rewrite(parse_str(
+                "_let f = _fun (n) _if n == 0 _then 1 _else n * 2 + n * n _in f(3) == f(x + 1) + (x == y)"));
+
+        CHECK(specializer.counts_["if-eq-const"] == 1);
+        CHECK(specializer.counts_["eq-var-const"] == 0);
+        CHECK(specializer.counts_["mult-var-const"] == 1);
+        CHECK(specializer.counts_["mult-var-var"] == 1);
+        CHECK(specializer.counts_["add-var-const"] == 1);
+        CHECK(specializer.counts_["eq-var-var"] == 1);
+        CHECK(specializer.total() == 5);
+
+        // the rewritten expression prints and compares like the original
+        CHECK(e->equals(parse_str(
+                "_let f = _fun (n) _if n == 0 _then 1 _else n * 2 + n * n _in f(3) == f(x + 1) + (x == y)")));
+    }
+
+    SECTION("specialized nodes agree with the tree walker") {
+        std::string programs[] = {
+                "_let fib = _fun (f) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1\n"
+                "                             _else f(f)(n + -1) + f(f)(n + -2)\n"
+                "_in fib(fib)(15)",
+                "_let x = 3 _in _let y = 4 _in (x * y + x * 2 == 18) == (x == 3)",
+                "_let b = _true _in _if b == 1 _then 1 _else 2",
+                "_let f = _fun (x) x _in _let g = _fun (x) x _in f == g",
+        };
+
+        for (const std::string& src : programs) {
+            Specializer specializer;
+            std::string tree = parse_str(src)->interp(Env::empty)->to_string();
+            CHECK(specializer.rewrite(parse_str(src))->interp(Env::empty)->to_string() == tree);
+            CHECK(specializer.total() > 0);
+        }
+    }
+
+    SECTION("errors match the original nodes") {
+        Specializer specializer;
+
+        CHECK_THROWS_WITH(specializer.rewrite(parse_str("_let b = _true _in b + 1"))->interp(Env::empty),
+                          "invalid type for BoolVal::add_to()");
+        CHECK_THROWS_WITH(specializer.rewrite(parse_str("_let b = _true _in _let n = 1 _in n * b"))->interp(Env::empty),
+                          "invalid type for NumVal::mult_with()");
+        CHECK_THROWS_WITH(specializer.rewrite(parse_str("x == 1"))->interp(Env::empty), "free variable: x");
+    }
+}
+
+TEST_CASE("variable inline cache") {
+    VarExpr::cache_stats = true;
+    VarExpr::cache_hits = 0;
+    VarExpr::cache_misses = 0;
+
+    PTR(Expr) fib = parse_str("_let fib = _fun (f) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1\n"
+                              "                             _else f(f)(n + -1) + f(f)(n + -2)\n"
+                              "_in fib(fib)(15)");
+    CHECK(fib->interp(Env::empty)->to_string() == "610");
+
+    // each of the variable nodes misses once and then hits
+    CHECK(VarExpr::cache_misses == 10);
+    CHECK(VarExpr::cache_hits > 9000);
+
+    // the operands of specialized nodes keep the cache of their VarExpr
+    VarExpr::cache_hits = 0;
+    VarExpr::cache_misses = 0;
+    Specializer specializer;
+    PTR(Expr) fast_fib = specializer.rewrite(parse_str(fib->to_string()));
+    CHECK(specializer.total() == 4);
+    CHECK(fast_fib->interp(Env::empty)->to_string() == "610");
+    CHECK(VarExpr::cache_misses == 10);
+    CHECK(VarExpr::cache_hits > 9000);
+
+    // shadowed names resolve to the innermost binding
+    CHECK(parse_str("_let x = 1 _in _let f = _fun (y) x + y _in _let x = 10 _in f(x) + x")
+                  ->interp(Env::empty)->to_string() == "21");
+
+    // environments built by hand are walked instead of trusted
+    PTR(Expr) x = parse_str("x");
+    PTR(Env) outer = NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty);
+    CHECK(x->interp(NEW(ExtendedEnv)("w", NEW(NumVal)(0), outer))->to_string() == "1");
+    CHECK(x->interp(NEW(ExtendedEnv)("x", NEW(NumVal)(9), outer))->to_string() == "9");
+    CHECK_THROWS_WITH(x->interp(Env::empty), "free variable: x");
+
+    VarExpr::cache_stats = false;
+}
+
+TEST_CASE("source spans") {
+    PTR(Expr) e = parse_str("_let x = 5\n_in  x + 12");
+    PTR(LetExpr) let = CAST(LetExpr)(e);
+    PTR(AddExpr) add = CAST(AddExpr)(let->body_);
+
+    CHECK(e->pos_ == 0);
+    CHECK(e->end_ == 22);
+    CHECK(let->rhs_->pos_ == 9);
+    CHECK(let->rhs_->line_ == 1);
+    CHECK(let->rhs_->column_ == 10);
+
+    CHECK(add->pos_ == 16);
+    CHECK(add->line_ == 2);
+    CHECK(add->column_ == 6);
+    CHECK(add->rhs_->pos_ == 20);
+    CHECK(add->rhs_->end_ == 22);
+
+    // parentheses are not part of the span, calls end after their argument
+    PTR(CallExpr) call = CAST(CallExpr)(parse_str("(f)(1)"));
+    CHECK(call->callee_->pos_ == 1);
+    CHECK(call->pos_ == 1);
+    CHECK(call->end_ == 6);
+
+    // expressions built in code have no span
+    CHECK(NEW(NumExpr)(1)->line_ == 0);
+}
+
+TEST_CASE("profile") {
+    Profiler::reset();
+    Profiler::enable();
+
+    PTR(Expr) e = parse_str("_let f = _fun (n) n + 1\n_in f(1) + f(2)");
+    CHECK(e->interp(Env::empty)->to_string() == "5");
+    CHECK_THROWS_WITH(parse_str("1 + _true")->interp(Env::empty), "invalid type for NumVal::add_to()");
+
+    Expr::profiling = false;
+    MemStats::disable();
+
+    std::map<std::string, Profiler::Entry> types = Profiler::by_type();
+    CHECK(types["LetExpr"].count_ == 1);
+    CHECK(types["CallExpr"].count_ == 2);
+    CHECK(types["AddExpr"].count_ == 4);
+    CHECK(types["NumExpr"].count_ == 5);
+    CHECK(types["BoolExpr"].count_ == 1);
+    CHECK(types["NumExpr"].allocations_ > 0);
+
+    // the whole program is the inclusive time of the _let, and everything
+    // evaluated in it adds up to the same time
+    double exclusive = 0;
+    for (auto& type : types) {
+        exclusive += type.second.exclusive_ms_;
+        CHECK(type.second.exclusive_ms_ <= type.second.inclusive_ms_);
+    }
+    CHECK(types["LetExpr"].inclusive_ms_ <= exclusive);
+
+    std::map<std::string, Profiler::Entry> locations = Profiler::by_location();
+    CHECK(locations["1:19 AddExpr"].count_ == 2);
+    CHECK(locations["1:19 AddExpr"].source_ == "(n+1)");
+    CHECK(locations["2:5 AddExpr"].count_ == 1);
+
+    std::stringstream report;
+    Profiler::report(report);
+    CHECK(report.str().find("profile by node type:") == 0);
+    CHECK(report.str().find("CallExpr") != std::string::npos);
+
+    Profiler::reset();
+}
+
+TEST_CASE("sampling profiler") {
+    PTR(Expr) e = parse_str("_let f = _fun (x) _fun (y) x + y _in _let g = _fun (z) f(z)(1) _in g(2)");
+    PTR(FunExpr) f = CAST(FunExpr)(CAST(LetExpr)(e)->rhs_);
+    PTR(FunExpr) f_inner = CAST(FunExpr)(f->body_);
+    PTR(FunExpr) g = CAST(FunExpr)(CAST(LetExpr)(CAST(LetExpr)(e)->body_)->rhs_);
+
+    SECTION("a sample is the shadow stack of the interrupted thread") {
+        // slow enough that the timer does not fire by itself
+        Sampler::start(1);
+        Sampler::name_functions(e, 0);
+
+        Sampler::push(g->body_.get());
+        Sampler::push(f_inner->body_.get());
+        raise(SIGPROF);
+        raise(SIGPROF);
+        Sampler::pop();
+        Sampler::push(f->body_.get());
+        raise(SIGPROF);
+        Sampler::pop();
+        Sampler::pop();
+        raise(SIGPROF);
+        Sampler::stop();
+
+        std::stringstream out;
+        Sampler::write(out);
+        CHECK(Sampler::samples() == 4);
+        CHECK(Sampler::dropped() == 0);
+        CHECK(out.str() == "msdscript 1\n"
+                           "msdscript;g@1:47;f@1:10 1\n"
+                           "msdscript;g@1:47;f@1:19 2\n");
+    }
+
+    SECTION("calls push and pop the functions they run") {
+        Sampler::start(1);
+        Sampler::name_functions(e, 10);
+
+        CHECK(e->interp(Env::empty)->to_string() == "3");
+        CHECK_THROWS_WITH(parse_str("_let h = _fun (x) x + _true _in h(1)")->interp(Env::empty),
+                          "invalid type for NumVal::add_to()");
+        raise(SIGPROF);
+        Sampler::stop();
+
+        std::stringstream out;
+        Sampler::write(out);
+        CHECK(out.str() == "msdscript 1\n");
+    }
+
+    SECTION("samples keep their names after the functions are forgotten") {
+        Sampler::start(1);
+        Sampler::name_functions(e, 0);
+
+        Sampler::push(g->body_.get());
+        raise(SIGPROF);
+        Sampler::pop();
+        Sampler::forget_functions();
+
+        CHECK(Sampler::label(g->body_.get()) == "_fun");
+        Sampler::name_functions(e, 5);
+        Sampler::push(g->body_.get());
+        raise(SIGPROF);
+        Sampler::pop();
+        Sampler::forget_functions();
+        Sampler::stop();
+
+        std::stringstream out;
+        Sampler::write(out);
+        CHECK(out.str() == "msdscript;g@1:47 1\n"
+                           "msdscript;g@6:47 1\n");
+    }
+
+    SECTION("forgetting the functions lets go of the expression") {
+        PTR(Expr) other = parse_str("_let h = _fun (x) x _in h(1)");
+        std::weak_ptr<Expr> watch = other;
+
+        Sampler::name_functions(other, 0);
+        other = nullptr;
+        CHECK(! watch.expired());
+        Sampler::forget_functions();
+        CHECK(watch.expired());
+    }
+
+    SECTION("the timer samples running code") {
+        PTR(Expr) fib = parse_str("_let fib = _fun (f) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1\n"
+                                  "                             _else f(f)(n + -1) + f(f)(n + -2)\n"
+                                  "_in fib(fib)(18)");
+        Sampler::start(1000);
+        Sampler::name_functions(fib, 0);
+        for (int i = 0; i < 200 && Sampler::samples() < 3; i++) {
+            fib->interp(Env::empty);
+        }
+        Sampler::stop();
+
+        std::stringstream out;
+        Sampler::write(out);
+        CHECK(Sampler::samples() >= 3);
+        CHECK(out.str().find("msdscript;fib@1:") == 0);
+    }
+}
+
+TEST_CASE("trace") {
+    SECTION("phases and calls become complete events") {
+        Trace::start();
+        Trace::calls = true;
+
+        PTR(Expr) e = parse_str("_let twice = _fun (x) x * 2 _in twice(twice(3))");
+        Sampler::name_functions(e, 0);
+        {
+            TraceSpan span("evaluate", 7);
+            CHECK(e->interp(Env::empty)->to_string() == "12");
+        }
+        Trace::calls = false;
+        Trace::enabled = false;
+
+        std::stringstream out;
+        Trace::write(out);
+        std::string json = out.str();
+
+        CHECK(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") == 0);
+        CHECK(json.substr(json.size() - 4) == "\n]}\n");
+        CHECK(json.find("\"cat\":\"phase\",\"name\":\"evaluate\",\"args\":{\"line\":7}}") != std::string::npos);
+
+        int calls = 0;
+        for (size_t at = json.find("\"name\":\"twice@1:14\""); at != std::string::npos;
+             at = json.find("\"name\":\"twice@1:14\"", at + 1)) {
+            calls++;
+        }
+        CHECK(calls == 2);
+        CHECK(Trace::dropped() == 0);
+    }
+
+    SECTION("calls keep their names after the functions are forgotten") {
+        Trace::start();
+        Trace::calls = true;
+
+        PTR(Expr) e = parse_str("_let twice = _fun (x) x * 2 _in twice(3)");
+        Sampler::name_functions(e, 4);
+        CHECK(e->interp(Env::empty)->to_string() == "6");
+        Sampler::forget_functions();
+        e = nullptr;
+        Trace::calls = false;
+        Trace::enabled = false;
+
+        std::stringstream out;
+        Trace::write(out);
+        CHECK(out.str().find("\"cat\":\"call\",\"name\":\"twice@5:14\"") != std::string::npos);
+    }
+
+    SECTION("a full ring keeps the newest events") {
+        Trace::start(4);
+        for (int i = 1; i <= 6; i++) {
+            TraceSpan span("parse", i);
+        }
+        Trace::enabled = false;
+
+        std::stringstream out;
+        Trace::write(out);
+        CHECK(Trace::dropped() == 2);
+        CHECK(out.str().find("\"line\":2}") == std::string::npos);
+        CHECK(out.str().find("\"line\":3}") != std::string::npos);
+        CHECK(out.str().find("\"line\":6}") != std::string::npos);
+
+        Trace::start();
+        Trace::enabled = false;
+    }
+
+    SECTION("spans are free when tracing is off") {
+        Trace::start();
+        Trace::enabled = false;
+        {
+            TraceSpan span("parse", 1);
+        }
+
+        std::stringstream out;
+        Trace::write(out);
+        CHECK(out.str().find("\"ph\":\"X\"") == std::string::npos);
+    }
+}
+
+TEST_CASE("memory stats") {
+    MemStats::enable();
+    MemStats::reset_peaks();
+    MemUsage nums = MemStats::usage("NumVal");
+    MemUsage envs = MemStats::usage("ExtendedEnv");
+    MemUsage funs = MemStats::usage("FunVal");
+
+    {
+        PTR(Expr) e = parse_str("_let f = _fun (x) x + 1 _in f(1) + f(2)");
+        PTR(Val) v = e->interp(Env::empty);
+        CHECK(v->to_string() == "5");
+
+        // 1 and 2 as arguments, two x + 1 and the sum, of which only the
+        // sum is still referenced
+        CHECK(MemStats::usage("NumVal").total_ - nums.total_ == 7);
+        CHECK(MemStats::usage("NumVal").live_ - nums.live_ == 1);
+        CHECK(MemStats::usage("FunVal").total_ - funs.total_ == 1);
+        CHECK(MemStats::usage("ExtendedEnv").total_ - envs.total_ == 3);
+        CHECK(MemStats::usage("ExtendedEnv").peak_ - envs.live_ >= 2);
+
+        // the nodes of the parsed expression are alive while e is
+        MemUsage adds = MemStats::usage("AddExpr");
+        CHECK(adds.live_ >= 2);
+        CHECK(adds.live_bytes_ >= adds.live_ * (long) sizeof(AddExpr));
+        CHECK(adds.peak_bytes_ >= adds.live_bytes_);
+    }
+
+    CHECK(MemStats::usage("NumVal").live_ == nums.live_);
+    CHECK(MemStats::usage("ExtendedEnv").live_ == envs.live_);
+    CHECK(MemStats::usage("FunVal").live_ == funs.live_);
+
+    // objects made while counting are taken off when freed later
+    MemStats::disable();
+    long counted = MemStats::usage("NumVal").total_;
+    {
+        PTR(Val) n = NEW(NumVal)(1);
+        CHECK(MemStats::usage("NumVal").total_ == counted);
+    }
+    CHECK(MemStats::usage("NumVal").live_ == nums.live_);
+
+    std::stringstream report;
+    MemStats::report(report);
+    CHECK(report.str().find("memory by type:") == 0);
+    CHECK(report.str().find("ExtendedEnv") != std::string::npos);
+}
+
+TEST_CASE("benchmark statistics") {
+    CHECK(median({3, 1, 2}) == 2);
+    CHECK(median({4, 1, 3, 2}) == 2.5);
+    CHECK_THROWS_WITH(median({}), "median of no samples");
+
+    // every run of a is faster than every run of b, but three runs each
+    // are too few to rule out chance
+    MannWhitney small = mann_whitney({1, 2, 3}, {4, 5, 6});
+    CHECK(small.u_ == 0);
+    CHECK(small.p_ == Approx(0.0809).epsilon(0.01));
+    CHECK(mann_whitney({4, 5, 6}, {1, 2, 3}).u_ == 9);
+    CHECK(mann_whitney({1, 3, 5}, {2, 4, 6}).u_ == 3);
+
+    std::vector<double> fast, slow;
+    for (int i = 0; i < 15; i++) {
+        fast.push_back(10 + i % 5);
+        slow.push_back(13 + i % 5);
+    }
+    CHECK(mann_whitney(fast, slow).p_ < 0.001);
+    CHECK(mann_whitney(fast, fast).p_ == Approx(1));
+
+    // ties share their rank
+    CHECK(mann_whitney({1, 1, 1}, {1, 1, 1}).p_ == 1);
+    CHECK(mann_whitney({1, 2}, {2, 3}).u_ == 0.5);
+    CHECK_THROWS_WITH(mann_whitney({}, {1}), "Mann-Whitney test of an empty sample");
+}
+
+TEST_CASE("differential fuzzer") {
+    // the same seed makes the same program
+    std::mt19937_64 rng1(42), rng2(42);
+    std::string program = Fuzzer::random_program(rng1, 30)->to_string();
+    CHECK(Fuzzer::random_program(rng2, 30)->to_string() == program);
+    CHECK(Fuzzer::size(parse_str(program)) <= 30);
+    CHECK(Fuzzer::size(parse_str(program)) >= 25);
+
+    CHECK(Fuzzer::check("_let f = _fun (x) x + 1 _in f(2) * 3") == "");
+    CHECK(Fuzzer::check("(_fun (x) 0) * 0") == "");
+    CHECK(Fuzzer::check("(1 + 2)(3)") == "");
+    CHECK(Fuzzer::check("_if _true _then w _else 1") == "");
+
+    std::stringstream out;
+    CHECK(Fuzzer::run(500, 1, 2, out));
+    CHECK(out.str().find("500 cases from seed 1") == 0);
+
+    // the seed printed for a failure makes the same failure again, also
+    // for seeds past what fits in an int, like the time it defaults to
+    auto has_product = [](const std::string& src) {
+        return src.find('*') != std::string::npos ? std::string("has a product") : std::string();
+    };
+    std::stringstream failed;
+    CHECK(! Fuzzer::run(1000, 1792387736ul, 1, failed, has_product));
+    std::string report = failed.str();
+    size_t at = report.find("--seed=");
+    REQUIRE(at != std::string::npos);
+    unsigned long seed = option_seed(report.substr(at + 7, report.find(' ', at) - at - 7));
+    CHECK(seed >= 1792387736ul);
+    size_t program_at = report.find("program: ");
+    std::string failing = report.substr(program_at, report.find('\n', program_at) - program_at);
+
+    std::stringstream again;
+    CHECK(! Fuzzer::run(1, seed, 1, again, has_product));
+    CHECK(again.str().find("case 0 failed, run it again with --seed=" + std::to_string(seed) + " --fuzz=1") == 0);
+    CHECK(again.str().find(failing) != std::string::npos);
+    CHECK(option_seed("0") == 0);
+    CHECK(option_seed("18446744073709551615") == ULONG_MAX);
+
+    // shrinking keeps only what makes the program fail, here a product
+    PTR(Expr) shrunk = Fuzzer::shrink(parse_str("_let x = 5 _in (x + 7 * (_if _true _then 3 _else 4)) + 2"),
+                                      [](PTR(Expr) e) {
+                                          return e->to_string().find('*') != std::string::npos;
+                                      });
+    CHECK(shrunk->to_string() == "(0*0)");
+}
+
+TEST_CASE("typed program generator") {
+    for (unsigned long seed = 1; seed <= 200; seed++) {
+        std::mt19937_64 rng(seed);
+        PTR(Expr) e = Fuzzer::random_typed_program(rng, 1 + (int) (seed % 60), 8);
+
+        // well-typed, with an integer value
+        CHECK(typecheck(e)->to_string() == "int");
+        CHECK(CAST(NumVal)(e->interp(Env::empty)) != nullptr);
+    }
+
+    // recursive programs count down through f(f), and the JIT agrees
+    // with the tree walker on them
+    int recursive = 0;
+    for (unsigned long seed = 1; seed <= 100; seed++) {
+        std::mt19937_64 rng(seed);
+        std::string src = Fuzzer::random_typed_program(rng, 200, 64, true)->to_string();
+
+        if (src.find("f(f)((n+-1))") != std::string::npos) {
+            recursive++;
+            CHECK(Fuzzer::check(src) == "");
+        }
+    }
+    CHECK(recursive >= 20);
+
+    // every kind of expression comes up
+    std::mt19937_64 rng(7);
+    std::string program = Fuzzer::random_typed_program(rng, 2000)->to_string();
+    for (const char* part : {"_fun", "_if", "==", "_let", "_true", "+", "*", ")("}) {
+        CHECK(program.find(part) != std::string::npos);
+    }
+
+    // large programs stay within the depth limit
+    std::mt19937_64 large_rng(3);
+    PTR(Expr) large = Fuzzer::random_typed_program(large_rng, 100000, 40);
+    CHECK(Fuzzer::size(large) > 50000);
+    CHECK(large->interp(Env::empty) != nullptr);
+}
+
+TEST_CASE("worker protocol") {
+    std::istringstream frames(std::string("4\n1+2\n") + "8\n_let x\n\n" + "0\n");
+    std::ostringstream replies;
+    serve_worker(do_interp, frames, replies);
+
+    std::string ok = "Type your expression here: --------------------\ninterp value: 3\n--------------------\n\n";
+    std::string empty = "Type your expression here: ";
+    std::string bad = "Type your expression here: --------------------\n";
+    CHECK(replies.str() == "0 " + std::to_string(ok.size()) + " 0\n" + ok
+                         + "1 " + std::to_string(bad.size()) + " 10\n" + bad + "bad input\n"
+                         + "0 " + std::to_string(empty.size()) + " 0\n" + empty);
+
+    // every request is on its own: the second sees nothing of the first
+    std::istringstream print_frames("2\n1\n" + std::string("6\n2 * 3\n"));
+    std::ostringstream print_replies;
+    serve_worker(do_print, print_frames, print_replies);
+    CHECK(print_replies.str().find("print value: 1\n") != std::string::npos);
+    CHECK(print_replies.str().find("print value: (2*3)\n") != std::string::npos);
+
+    std::istringstream truncated("10\n1+2");
+    std::ostringstream ignored;
+    CHECK_THROWS_WITH(serve_worker(do_interp, truncated, ignored), "truncated worker request");
+}
+
+TEST_CASE("complexity fuzzer") {
+    // a seed grows one structure, deeper versions extending shallower ones
+    for (unsigned long seed = 1; seed <= 40; seed++) {
+        std::string shallow = Complexity::grow(seed, 8)->to_string();
+        std::string deep = Complexity::grow(seed, 64)->to_string();
+        CHECK(Complexity::grow(seed, 64)->to_string() == deep);
+        CHECK(Fuzzer::size(parse_str(deep)) > Fuzzer::size(parse_str(shallow)));
+        CHECK(CAST(NumVal)(parse_str(deep)->interp(Env::empty)) != nullptr);
+        CHECK(! Complexity::describe(seed).empty());
+    }
+
+    CHECK(growth_exponent({10, 100, 1000}, {3, 30, 300}) == Approx(1));
+    CHECK(growth_exponent({10, 100, 1000}, {1, 100, 10000}) == Approx(2));
+
+    // at small depths nothing grows fast enough to flag
+    int saved_depth = Complexity::max_depth;
+    std::string saved_path = Complexity::seeds_path;
+    Complexity::max_depth = 64;
+    Complexity::seeds_path = "/dev/null";
+    std::stringstream out;
+    Complexity::run(2, 1, out);
+    CHECK(out.str().find("seed 1 (" + Complexity::describe(1)) == 0);
+    CHECK(out.str().find("interp n^") != std::string::npos);
+    Complexity::max_depth = saved_depth;
+    Complexity::seeds_path = saved_path;
+}
+
+TEST_CASE("pretty printing to a stream that cannot seek") {
+    // like a pipe: tellp() on it fails
+    class PipeBuf : public std::streambuf {
+    public:
+        std::string text_;
+
+    protected:
+        int_type overflow(int_type c) override {
+            text_ += (char) c;
+            return c;
+        }
+    };
+
+    PTR(Expr) e = parse_str("1 + (_let x = _if _true _then 2 _else 3 _in (_fun (y) x * y)(4)) * 5");
+    PipeBuf pipe;
+    std::ostream out(&pipe);
+    CHECK(out.tellp() == std::streampos(-1));
+
+    e->pretty_print(out);
+    CHECK(pipe.text_ == e->to_pretty_string());
+    CHECK(pipe.text_ == "1 + (_let x = _if _true\n"
+                        "              _then 2\n"
+                        "              _else 3\n"
+                        "     _in (_fun (y)\n"
+                        "          x * y)(4)) * 5");
+
+    // indentation is counted from where the writer starts
+    std::stringstream prefixed;
+    prefixed << "value: ";
+    e->pretty_print(prefixed);
+    CHECK(prefixed.str() == "value: " + e->to_pretty_string());
+
+    // a newline goes to the column its block opened at
+    std::stringstream blocks;
+    PrettyWriter writer(blocks);
+    writer << "ab";
+    writer.open();
+    writer << 12;
+    writer.newline(1);
+    writer << "x";
+    writer.close();
+    writer.newline(0);
+    writer << "y";
+    writer.finish();
+    CHECK(blocks.str() == "ab12\n   x\ny");
+}
+
+TEST_CASE("deep trees") {
+    // far deeper than the C++ stack allows a recursive walk to go
+    const int depth = 500000;
+    PTR(Expr) a = NEW(NumExpr)(1);
+    PTR(Expr) b = NEW(NumExpr)(1);
+    PTR(Expr) c = NEW(NumExpr)(2);
+    for (int i = 0; i < depth; i++) {
+        a = i % 2 == 0 ? (PTR(Expr)) NEW(AddExpr)(a, NEW(VarExpr)("x")) : NEW(CallExpr)(a, NEW(NumExpr)(i));
+        b = i % 2 == 0 ? (PTR(Expr)) NEW(AddExpr)(b, NEW(VarExpr)("x")) : NEW(CallExpr)(b, NEW(NumExpr)(i));
+        c = i % 2 == 0 ? (PTR(Expr)) NEW(AddExpr)(c, NEW(VarExpr)("x")) : NEW(CallExpr)(c, NEW(NumExpr)(i));
+    }
+
+    CHECK(a->equals(b));
+    CHECK(! a->equals(c));
+
+    std::string printed = a->to_string();
+    CHECK(printed.size() > (size_t) 4 * depth);
+    CHECK(printed.compare(0, 3, "(((") == 0);
+    CHECK(printed.compare(printed.size() - 8, 8, "(499999)") == 0);
+
+    std::string pretty = a->to_pretty_string();
+    CHECK(pretty.size() > (size_t) 4 * depth);
+    CHECK(pretty.find('\n') == std::string::npos);
+
+    // freeing them must not recurse either
+    a = nullptr;
+    b = nullptr;
+    c = nullptr;
+
+    // the parts put together give what the recursive printers gave
+    PTR(Expr) e = parse_str("_let f = _fun (x) _if x == 0 _then 1 _else x * f(x + -1) _in f(5) + (1 == 2)");
+    CHECK(e->to_string() == "(_let f=(_fun (x) (_if (x==0) _then 1 _else (x*f((x+-1))))) _in (f(5)+(1==2)))");
+    CHECK(e->equals(parse_str(e->to_string())));
+    CHECK(! e->equals(parse_str("_let g = _fun (x) _if x == 0 _then 1 _else x * f(x + -1) _in f(5) + (1 == 2)")));
+}
+
+TEST_CASE("buffered output") {
+    char text[max_int_chars];
+    CHECK(std::string(text, format_int(text, 0)) == "0");
+    CHECK(std::string(text, format_int(text, -42)) == "-42");
+    CHECK(std::string(text, format_int(text, LONG_MIN)) == "-9223372036854775808");
+    CHECK(NEW(NumVal)(INT_MIN)->to_string() == "-2147483648");
+    CHECK(NEW(MultExpr)(NEW(NumExpr)(-7), NEW(NumExpr)(INT_MAX))->to_string() == "(-7*2147483647)");
+
+    // a buffer much smaller than what goes through it, so that it fills up,
+    // and one write bigger than the whole buffer
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::string expected;
+    {
+        OutputBuf buf(fds[1], 16);
+        std::ostream ot(&buf);
+
+        for (int i = 0; i < 100; i++) {
+            write_int(ot, i * 37 - 500);
+            ot << ' ';
+            expected += std::to_string(i * 37 - 500) + " ";
+        }
+        std::string big(100, 'z');
+        ot << big << '\n';
+        expected += big + "\n";
+        ot.flush();
+        CHECK(ot.good());
+    }
+    close(fds[1]);
+
+    std::string got;
+    char chunk[256];
+    ssize_t n;
+    while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+        got.append(chunk, n);
+    }
+    close(fds[0]);
+    CHECK(got == expected);
+}
+
+TEST_CASE("results lost to a crash") {
+    flush_t saved_policy = Output::policy;
+
+    // a child writes one result and dies before anything flushes its buffer
+    auto written_before_crash = [](flush_t policy) {
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+
+        pid_t child = fork();
+        if (child == 0) {
+            close(fds[0]);
+            OutputBuf buf(fds[1], 1 << 10);
+            std::ostream ot(&buf);
+
+            Output::policy = policy;
+            ot << "interp value: 3\n--------------------\n\n";
+            Output::end_result(ot);
+            _exit(1);
+        }
+        close(fds[1]);
+
+        std::string got;
+        char chunk[256];
+        ssize_t n;
+        while ((n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+            got.append(chunk, n);
+        }
+        close(fds[0]);
+        waitpid(child, nullptr, 0);
+
+        return got;
+    };
+
+    CHECK(written_before_crash(flush_result) == "interp value: 3\n--------------------\n\n");
+    CHECK(written_before_crash(flush_full) == "");
+
+    Output::policy = saved_policy;
+}
+
+TEST_CASE("pretty printing to a width") {
+    PTR(Expr) sum = parse_str("1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12");
+    CHECK(sum->to_pretty_string() == "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12");
+    CHECK(sum->to_pretty_string(30) == "1 + 2 + 3 + 4 + 5 + 6 + 7 +\n"
+                                       "8 + 9 + 10 + 11 + 12");
+
+    PTR(Expr) calls = parse_str("f(aaaa + bbbbbbbb)(cccccccc * dddddddd + eeeeeeee)(ffff)");
+    CHECK(calls->to_pretty_string(20) == "f(aaaa + bbbbbbbb)(\n"
+                                         "  cccccccc *\n"
+                                         "  dddddddd +\n"
+                                         "  eeeeeeee)(ffff)");
+
+    // an optional newline after _let x =, and the _in still lined up
+    // with the _let
+    PTR(Expr) let = parse_str("_let x = 111111111 + 22222222 + 33333333 + 444444 _in x * x * x * x * x * x");
+    CHECK(let->to_pretty_string(20) == "_let x =\n"
+                                       "  111111111 +\n"
+                                       "  22222222 +\n"
+                                       "  33333333 + 444444\n"
+                                       "_in x * x * x * x *\n"
+                                       "    x * x");
+
+    // whatever the width, the parentheses stay and the text reads back
+    // as the same expression
+    PTR(Expr) e = parse_str("1 + (_let x = _if _true _then 2 _else 3 _in (_fun (y) x * y)(4)) * 5 == f(g(h(1)))");
+    for (int width = 1; width <= 60; width++) {
+        std::string pretty = e->to_pretty_string(width);
+        CHECK(parse_str(pretty)->equals(e));
+    }
+    CHECK(e->to_pretty_string(1000) == e->to_pretty_string());
+}
+
+TEST_CASE("deeply nested input") {
+    // far deeper than the C++ stack would allow one call per level
+    std::string sum = "1";
+    std::string lets = "x";
+    std::string parens = "1";
+    for (int i = 0; i < 200000; i++) {
+        sum += " + 1";
+    }
+    for (int i = 0; i < 200000; i++) {
+        lets = "_let x = 1 _in " + std::move(lets);
+    }
+    parens = std::string(200000, '(') + parens + std::string(200000, ')');
+
+    PTR(Expr) e = parse_str(sum);
+    CHECK(e->depth() == 200001);
+    CHECK(parse_str(e->to_string())->equals(e));
+    CHECK(parse_str(e->to_pretty_string())->equals(e));
+    CHECK(CAST(AddExpr)(e)->rhs_->pos_ == 4);
+    CHECK(parse_str(lets)->depth() == 200001);
+    CHECK(parse_str(parens)->depth() == 1);
+
+    // the engines recurse, so --interp stops short of what they cannot take
+    CHECK_THROWS_WITH(interp_with_engine(e), "input nested too deeply");
+    std::string shallow = "1";
+    for (int i = 0; i < 5000; i++) {
+        shallow += " + 1";
+    }
+    CHECK(interp_with_engine(parse_str(shallow))->to_string() == "5001");
+
+    // the same grammar as ever: precedence, calls and where bodies end
+    CHECK(parse_str("1 * 2 + 3 == 5")->equals(NEW(EqExpr)(NEW(AddExpr)(NEW(MultExpr)(NEW(NumExpr)(1), NEW(NumExpr)(2)),
+                                                                        NEW(NumExpr)(3)),
+                                                          NEW(NumExpr)(5))));
+    CHECK(parse_str("_fun (x) x(1)(2) * 3")->to_string() == "(_fun (x) (x(1)(2)*3))");
+    CHECK(parse_str("(_if _true _then f _else g)(1) + _let y = 2 _in y * y")->to_string()
+          == "((_if _true _then f _else g)(1)+(_let y=2 _in (y*y)))");
+    CHECK_THROWS_WITH(parse_str("(1 + 2"), "bad input");
+    CHECK_THROWS_WITH(parse_str("_let x = 1 _on x"), "bad input");
+    CHECK_THROWS_WITH(parse_str("_if 1 _then 2 _elsa 3"), "bad input");
+    CHECK_THROWS_WITH(parse_str("1 = 2"), "consume_str error");
+    CHECK_THROWS_WITH(parse_str("1 + 2 )"), "invalid input");
+}
+
+TEST_CASE("parsing a mapped file") {
+    char path[] = "/tmp/msdscriptXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    // one program over many lines, bigger than the window the parser reads at a time
+    std::mt19937_64 rng(7);
+    PTR(Expr) e = Fuzzer::random_typed_program(rng, 400000);
+    std::string text = e->to_string();
+    std::replace(text.begin(), text.end(), ' ', '\n');
+    REQUIRE(text.size() > (1 << 21));
+    {
+        std::ofstream out(path);
+        out << "\n  " << text << "\n";
+    }
+
+    // positions come out as they do from the same text in a string
+    PTR(Expr) parsed = parse_file(path);
+    PTR(Expr) from_string = parse_str("\n  " + text + "\n");
+    CHECK(parsed->equals(e));
+    CHECK(parsed->line_ == from_string->line_);
+    CHECK(parsed->column_ == from_string->column_);
+    CHECK(parsed->pos_ == from_string->pos_);
+    CHECK(parsed->line_ == 2);
+
+    MappedFile file(path);
+    CHECK(file.size() == text.size() + 4);
+    CHECK(std::string(file.data() + 3, 10) == text.substr(0, 10));
+
+    // the parser says how far it has gone, in order, before reaching the end
+    std::vector<size_t> passed;
+    CHECK(parse_text(file.data(), file.size(), [&](size_t offset) { passed.push_back(offset); })->equals(e));
+    CHECK(passed.size() >= 2);
+    CHECK(std::is_sorted(passed.begin(), passed.end()));
+    CHECK(passed.back() < file.size());
+    remove(path);
+
+    CHECK_THROWS_WITH(parse_file("/nonexistent/program.msd"), "cannot read /nonexistent/program.msd: No such file or directory");
+
+    // a program may span lines, and an empty file is no program
+    char small[] = "/tmp/msdscriptXXXXXX";
+    fd = mkstemp(small);
+    REQUIRE(fd >= 0);
+    std::string program = "_let x = 5\n_in\n  x + 1\n";
+    REQUIRE(write(fd, program.data(), program.size()) == (ssize_t) program.size());
+    close(fd);
+    CHECK(parse_file(small)->equals(parse_str("_let x = 5 _in x + 1")));
+    std::ofstream(small, std::ios::trunc).close();
+    CHECK_THROWS(parse_file(small));
+    remove(small);
+}
@@ -0,0 +1,169 @@
+/**
+ * \file memstats.cpp
+ * \brief Definitions of the allocation counts behind --mem-stats
+ * \author Laura Zhang
+ *
+ * NEW(T) is make_counted<T>, which uses allocate_shared with a
+ * CountingAllocator while counting is on, so every NumVal, FunVal,
+ * ExtendedEnv or Expr node made from then on is charged to its type until
+ * the last pointer to it goes away. The allocator is stored in the control
+ * block, so an object made while counting is on is still uncounted when it
+ * is freed after counting is turned off, and one made before is never
+ * counted at all.
+ */
+
+#include "memstats.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <typeindex>
+
+bool count_allocations = false;
+std::atomic<long> allocation_count(0);
+
+static std::mutex counters_mutex;
+
+static std::map<std::type_index, MemCounter*>& counters() {
+    // never destroyed, objects can be freed after static destructors run
+    static std::map<std::type_index, MemCounter*>* counters = new std::map<std::type_index, MemCounter*>();
+
+    return *counters;
+}
+
+/**
+ * \brief raise an atomic peak to at least a value
+ */
+static void raise_peak(std::atomic<long>& peak, long value) {
+    long seen = peak.load(std::memory_order_relaxed);
+
+    while (value > seen && ! peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+void MemCounter::allocated(long bytes) {
+    raise_peak(peak_, live_.fetch_add(1, std::memory_order_relaxed) + 1);
+    raise_peak(peak_bytes_, live_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    total_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemCounter::freed(long bytes) {
+    live_.fetch_sub(1, std::memory_order_relaxed);
+    live_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * \brief the counter of a type, made the first time the type is asked for
+ * \param type the type of the objects
+ */
+MemCounter& mem_counter(const std::type_info& type) {
+    std::lock_guard<std::mutex> lock(counters_mutex);
+    MemCounter*& counter = counters()[std::type_index(type)];
+
+    if (counter == nullptr) {
+        counter = new MemCounter();
+    }
+
+    return *counter;
+}
+
+/**
+ * \brief count the objects NEW makes from now on
+ */
+void MemStats::enable() {
+    count_allocations = true;
+}
+
+/**
+ * \brief stop counting new objects; those already counted are still
+ * taken off when they are freed
+ */
+void MemStats::disable() {
+    count_allocations = false;
+}
+
+/**
+ * \brief lower every peak to the current live count, to measure the peak
+ * of one part of a run
+ */
+void MemStats::reset_peaks() {
+    std::lock_guard<std::mutex> lock(counters_mutex);
+
+    for (auto& entry : counters()) {
+        entry.second->peak_ = entry.second->live_.load();
+        entry.second->peak_bytes_ = entry.second->live_bytes_.load();
+    }
+}
+
+/**
+ * \brief the counts of every type NEW has made while counting, by type name
+ */
+std::vector<MemUsage> MemStats::snapshot() {
+    std::lock_guard<std::mutex> lock(counters_mutex);
+    std::vector<MemUsage> usages;
+
+    for (auto& entry : counters()) {
+        int status;
+        char* demangled = abi::__cxa_demangle(entry.first.name(), nullptr, nullptr, &status);
+        MemCounter* counter = entry.second;
+
+        usages.push_back({status == 0 ? demangled : entry.first.name(),
+                          counter->live_, counter->peak_, counter->total_,
+                          counter->live_bytes_, counter->peak_bytes_});
+        free(demangled);
+    }
+
+    std::sort(usages.begin(), usages.end(), [](const MemUsage& a, const MemUsage& b) {
+        return a.type_ < b.type_;
+    });
+
+    return usages;
+}
+
+/**
+ * \brief the counts of one type
+ * \param type the type name, such as "NumVal"
+ * \return the counts, all 0 if NEW has not made the type while counting
+ */
+MemUsage MemStats::usage(const std::string& type) {
+    for (const MemUsage& u : snapshot()) {
+        if (u.type_ == type) {
+            return u;
+        }
+    }
+
+    return {type, 0, 0, 0, 0, 0};
+}
+
+/**
+ * \brief print the counts of every type, most peak bytes first
+ * \param out where to print
+ */
+void MemStats::report(std::ostream& out) {
+    std::vector<MemUsage> usages = snapshot();
+    long peak_bytes = 0;
+
+    std::stable_sort(usages.begin(), usages.end(), [](const MemUsage& a, const MemUsage& b) {
+        return a.peak_bytes_ > b.peak_bytes_;
+    });
+
+    out << "memory by type:\n";
+    out << std::left << std::setw(24) << "type" << std::right
+        << std::setw(12) << "live"
+        << std::setw(12) << "peak"
+        << std::setw(12) << "total"
+        << std::setw(14) << "live bytes"
+        << std::setw(14) << "peak bytes" << "\n";
+    for (const MemUsage& u : usages) {
+        out << std::left << std::setw(24) << u.type_ << std::right
+            << std::setw(12) << u.live_
+            << std::setw(12) << u.peak_
+            << std::setw(12) << u.total_
+            << std::setw(14) << u.live_bytes_
+            << std::setw(14) << u.peak_bytes_ << "\n";
+        peak_bytes += u.peak_bytes_;
+    }
+    out << "sum of peak bytes: " << peak_bytes << "\n";
+}
@@ -0,0 +1,32 @@
+/**
+ * \file memstats.h
+ * \brief Declarations of the allocation counts behind --mem-stats
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// the counts of one type at the time of MemStats::snapshot()
+struct MemUsage {
+    std::string type_;
+    long        live_;
+    long        peak_;
+    long        total_;
+    long        live_bytes_;
+    long        peak_bytes_;
+};
+
+class MemStats {
+public:
+    static void enable();
+    static void disable();
+    static void reset_peaks();
+    static std::vector<MemUsage> snapshot();
+    static MemUsage usage(const std::string& type);
+    static void report(std::ostream& out);
+};
@@ -0,0 +1,148 @@
+/**
+ * \file output.cpp
+ * \brief Definitions of the buffered standard output that every mode
+ * writes through, and of fast integer formatting
+ * \author Laura Zhang
+ *
+ * Results used to end in std::endl, so every line of output cost a write
+ * call, and std::cout synchronized with stdio went through it a character
+ * at a time. Now std::cout writes into one large buffer that is handed to
+ * the file descriptor when it fills up, and a result only forces a write
+ * under flush_result, the policy for a terminal. std::cerr stays tied to
+ * std::cout, so whatever was printed before an error still comes first.
+ *
+ * Numbers are formatted with std::to_chars into a small array on the
+ * stack, without the locale lookups of operator<< or the string that
+ * std::to_string makes.
+ */
+
+#include "output.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+size_t Output::capacity = 1 << 20;
+flush_t Output::policy = flush_full;
+
+OutputBuf::OutputBuf(int fd, size_t capacity) : fd_(fd), buffer_(capacity) {
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+/**
+ * \brief write size bytes straight to the file descriptor, retrying after
+ * signals and short writes
+ * \return false if the write failed
+ */
+bool OutputBuf::write_out(const char* text, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd_, text, size);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        text += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/**
+ * \brief write out what the buffer holds and empty it
+ * \return false if the write failed
+ */
+bool OutputBuf::drain() {
+    bool written = write_out(pbase(), pptr() - pbase());
+
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+
+    return written;
+}
+
+OutputBuf::int_type OutputBuf::overflow(int_type c) {
+    if (! drain()) {
+        return traits_type::eof();
+    }
+    if (! traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+std::streamsize OutputBuf::xsputn(const char* text, std::streamsize size) {
+    if (size <= epptr() - pptr()) {
+        memcpy(pptr(), text, size);
+        pbump((int) size);
+
+        return size;
+    }
+    if (! drain()) {
+        return 0;
+    }
+    // too big to be worth copying: write it as it is
+    if ((size_t) size >= buffer_.size()) {
+        return write_out(text, size) ? size : 0;
+    }
+
+    memcpy(pptr(), text, size);
+    pbump((int) size);
+
+    return size;
+}
+
+int OutputBuf::sync() {
+    return drain() ? 0 : -1;
+}
+
+/**
+ * \brief make std::cout write through an OutputBuf of capacity bytes,
+ * stop synchronizing the standard streams with stdio, and pick the
+ * flush policy: flush_result if standard output is a terminal, flush_full
+ * otherwise. Call it before any input or output.
+ */
+void Output::install() {
+    // never freed: std::cout flushes through it as the program exits
+    static OutputBuf* buf = new OutputBuf(STDOUT_FILENO, capacity);
+
+    std::ios::sync_with_stdio(false);
+    std::cout.rdbuf(buf);
+    // reading a line must not write out the buffer; run_lines flushes the
+    // prompt itself when the policy asks for it
+    std::cin.tie(nullptr);
+    policy = isatty(STDOUT_FILENO) ? flush_result : flush_full;
+}
+
+/**
+ * \brief mark the end of a result written to ot, flushing it under
+ * flush_result
+ */
+void Output::end_result(std::ostream& ot) {
+    if (policy == flush_result) {
+        ot.flush();
+    }
+}
+
+/**
+ * \brief write n in decimal starting at first, which must have room for
+ * max_int_chars characters
+ * \return the end of what was written
+ */
+char* format_int(char* first, long n) {
+    return std::to_chars(first, first + max_int_chars, n).ptr;
+}
+
+/**
+ * \brief write n in decimal to ot
+ */
+void write_int(std::ostream& ot, long n) {
+    char text[max_int_chars];
+
+    ot.write(text, format_int(text, n) - text);
+}
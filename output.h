@@ -0,0 +1,60 @@
+/**
+ * \file output.h
+ * \brief Declarations of the buffered standard output that every mode
+ * writes through, and of fast integer formatting
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+// when buffered standard output is written out
+typedef enum {
+    // after every result, for a person at a terminal
+    flush_result,
+    // only when the buffer fills up and at exit, for pipes and files; what
+    // is still buffered is lost if the process dies
+    flush_full,
+} flush_t;
+
+// characters format_int may write, enough for any long
+static const int max_int_chars = 20;
+
+/**
+ * \brief a stream buffer that collects output in one large buffer and
+ * hands it to a file descriptor in as few write calls as it can
+ */
+class OutputBuf : public std::streambuf {
+public:
+    OutputBuf(int fd, size_t capacity);
+
+protected:
+    int_type        overflow(int_type c) override;
+    std::streamsize xsputn(const char* text, std::streamsize size) override;
+    int             sync() override;
+
+private:
+    int               fd_;
+    std::vector<char> buffer_;
+
+    bool              drain();
+    bool              write_out(const char* text, size_t size);
+};
+
+class Output {
+public:
+    // bytes standard output collects before it is written out
+    static size_t  capacity;
+    // when standard output is written out, set by install()
+    static flush_t policy;
+
+    static void    install();
+    static void    end_result(std::ostream& ot);
+};
+
+char* format_int(char* first, long n);
+void  write_int(std::ostream& ot, long n);
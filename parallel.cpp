@@ -0,0 +1,306 @@
+/**
+ * \file parallel.cpp
+ * \brief Definitions of the work-stealing pool behind the parallel engine
+ * \author Laura Zhang
+ */
+
+#include "parallel.h"
+#include "expr.h"
+#include "val.h"
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+thread_local WorkStealingPool* WorkStealingPool::current = nullptr;
+thread_local int WorkStealingPool::index_ = 0;
+
+// failed steals in a row before a worker parks until the next fork
+static const int idle_spins = 64;
+
+/**
+ * \brief store the estimated evaluation cost of every node in cost_
+ *
+ * The estimate is the subtree size, with calls counted as CALL_COST because
+ * the work they do depends on the function called. A function body is
+ * annotated for later calls but creating the closure itself costs 1.
+ * \param e the root of the tree
+ * \return the estimated cost of e
+ */
+int annotate_cost(PTR(Expr) e) {
+    long cost = 1;
+
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        cost += annotate_cost(a->lhs_) + annotate_cost(a->rhs_);
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        cost += annotate_cost(m->lhs_) + annotate_cost(m->rhs_);
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        cost += annotate_cost(q->lhs_) + annotate_cost(q->rhs_);
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        cost += annotate_cost(l->rhs_) + annotate_cost(l->body_);
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        cost += annotate_cost(i->condition_) +
+                std::max(annotate_cost(i->then_), annotate_cost(i->else_));
+    }
+    else if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        annotate_cost(f->body_);
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        cost += CALL_COST + annotate_cost(c->callee_) + annotate_cost(c->arg_);
+    }
+
+    e->cost_ = (int) std::min(cost, (long) INT_MAX / 4);
+
+    return e->cost_;
+}
+
+WorkStealingPool::Task::Task(PTR(Expr) expr, PTR(Env) env) : done_(false) {
+    expr_ = expr;
+    env_ = env;
+}
+
+/**
+ * \brief start the worker threads
+ * \param threads total number of threads, including the one calling run()
+ * \param grain minimum estimated cost of a subtree worth forking
+ */
+WorkStealingPool::WorkStealingPool(int threads, int grain) : forks_(0), parked_(0), stop_(false), steals_(0) {
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    grain_ = grain;
+
+    for (int i = 0; i < threads; i++) {
+        deques_.emplace_back(new WorkDeque());
+    }
+
+    // deque 0 belongs to the thread calling run()
+    for (int i = 1; i < threads; i++) {
+        threads_.emplace_back(&WorkStealingPool::worker_main, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        stop_ = true;
+    }
+    idle_cv_.notify_all();
+
+    for (std::thread& t : threads_) {
+        t.join();
+    }
+}
+
+/**
+ * \brief evaluate an expression using every thread of the pool
+ *
+ * Only one run() may be active at a time. Errors are the same as for
+ * sequential evaluation: when several subexpressions fail, the leftmost
+ * failure is the one reported.
+ * \param e the expression
+ * \param env the environment
+ * \return the value of the expression
+ */
+PTR(Val) WorkStealingPool::run(PTR(Expr) e, PTR(Env) env) {
+    if (Expr::call_by_need) {
+        throw std::runtime_error("call-by-need evaluation cannot run in parallel");
+    }
+
+    annotate_cost(e);
+
+    WorkStealingPool* saved_pool = current;
+    int saved_index = index_;
+    current = this;
+    index_ = 0;
+
+    PTR(Val) result;
+    std::exception_ptr error;
+
+    try {
+        result = e->interp(env);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    current = saved_pool;
+    index_ = saved_index;
+
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+
+    return result;
+}
+
+/**
+ * \brief evaluate lhs on this thread while rhs is offered to other threads
+ *
+ * rhs is pushed on the bottom of this thread's deque, where idle threads can
+ * steal it from the top, and a parked worker is woken to look for it. If
+ * nobody took it by the time lhs is done it is
+ * evaluated here; otherwise this thread runs stolen work until it finishes.
+ * \param lhs the left operand
+ * \param rhs the right operand
+ * \param env the environment of both operands
+ * \param lhs_val receives the value of lhs
+ * \param rhs_val receives the value of rhs
+ */
+void WorkStealingPool::fork_join(PTR(Expr) lhs, PTR(Expr) rhs, PTR(Env) env,
+                                 PTR(Val)& lhs_val, PTR(Val)& rhs_val) {
+    int self = index_;
+    Task t(rhs, env);
+
+    {
+        std::lock_guard<std::mutex> guard(deques_[self]->lock_);
+        deques_[self]->tasks_.push_back(&t);
+    }
+    forks_++;
+    if (parked_.load() > 0) {
+        // taking the lock makes sure a worker about to park sees forks_
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        idle_cv_.notify_one();
+    }
+
+    std::exception_ptr lhs_error;
+
+    try {
+        lhs_val = lhs->interp(env);
+    }
+    catch (...) {
+        lhs_error = std::current_exception();
+    }
+
+    if (take_back(self, &t)) {
+        // the rhs cannot change which error is reported once the lhs failed
+        if (lhs_error == nullptr) {
+            execute(&t);
+        }
+    }
+    else {
+        // t lives in this frame, so wait for the thief even after a failure
+        while (! t.done_.load(std::memory_order_acquire)) {
+            Task* other = steal(self);
+
+            if (other != nullptr) {
+                execute(other);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    if (lhs_error != nullptr) {
+        std::rethrow_exception(lhs_error);
+    }
+    if (t.error_ != nullptr) {
+        std::rethrow_exception(t.error_);
+    }
+
+    rhs_val = t.val_;
+}
+
+/**
+ * \brief number of tasks taken from another thread's deque so far
+ */
+long WorkStealingPool::steals() {
+    return steals_.load();
+}
+
+/**
+ * \brief number of workers parked until the next fork
+ */
+int WorkStealingPool::parked() {
+    return parked_.load();
+}
+
+void WorkStealingPool::worker_main(int index) {
+    current = this;
+    index_ = index;
+    int failed = 0;
+
+    while (true) {
+        // read before stealing, so a fork made after the steal wakes us
+        long forks = forks_.load();
+        Task* t = steal(index);
+
+        if (t != nullptr) {
+            execute(t);
+            failed = 0;
+        }
+        else if (++failed < idle_spins) {
+            std::this_thread::yield();
+        }
+        else {
+            std::unique_lock<std::mutex> lock(idle_lock_);
+
+            parked_++;
+            idle_cv_.wait(lock, [this, forks] { return stop_ || forks_.load() != forks; });
+            parked_--;
+            failed = 0;
+
+            if (stop_) {
+                return;
+            }
+        }
+    }
+}
+
+void WorkStealingPool::execute(Task* t) {
+    try {
+        t->val_ = t->expr_->interp(t->env_);
+    }
+    catch (...) {
+        t->error_ = std::current_exception();
+    }
+
+    t->done_.store(true, std::memory_order_release);
+}
+
+/**
+ * \brief take the oldest task of another thread, which is the biggest one
+ * \param thief index of the stealing thread
+ * \return the task, or nullptr if every other deque is empty
+ */
+WorkStealingPool::Task* WorkStealingPool::steal(int thief) {
+    int n = (int) deques_.size();
+
+    for (int i = 1; i < n; i++) {
+        WorkDeque& victim = *deques_[(thief + i) % n];
+        std::lock_guard<std::mutex> guard(victim.lock_);
+
+        if (! victim.tasks_.empty()) {
+            Task* t = victim.tasks_.front();
+            victim.tasks_.pop_front();
+            steals_++;
+
+            return t;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * \brief pop t from the bottom of a deque unless it has been stolen
+ * \param index the owner of the deque
+ * \param t the task pushed last by the owner
+ * \return true if t was still there
+ */
+bool WorkStealingPool::take_back(int index, Task* t) {
+    WorkDeque& own = *deques_[index];
+    std::lock_guard<std::mutex> guard(own.lock_);
+
+    if (! own.tasks_.empty() && own.tasks_.back() == t) {
+        own.tasks_.pop_back();
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,78 @@
+/**
+ * \file parallel.h
+ * \brief Declarations of the work-stealing pool behind the parallel engine
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Expr;
+class Val;
+class Env;
+
+// estimated cost of a call, whose real cost is not known until it runs
+static const int CALL_COST = 1000;
+
+int annotate_cost(PTR(Expr) e);
+
+class WorkStealingPool {
+public:
+    // the pool the current thread is evaluating for, if any
+    static thread_local WorkStealingPool* current;
+
+    // subtrees cheaper than this are evaluated inline instead of forked
+    int grain_;
+
+    WorkStealingPool(int threads, int grain);
+    ~WorkStealingPool();
+
+    PTR(Val) run(PTR(Expr) e, PTR(Env) env);
+    void     fork_join(PTR(Expr) lhs, PTR(Expr) rhs, PTR(Env) env,
+                       PTR(Val)& lhs_val, PTR(Val)& rhs_val);
+    long     steals();
+    int      parked();
+
+private:
+    struct Task {
+        PTR(Expr)          expr_;
+        PTR(Env)           env_;
+        PTR(Val)           val_;
+        std::exception_ptr error_;
+        std::atomic<bool>  done_;
+
+        Task(PTR(Expr) expr, PTR(Env) env);
+    };
+
+    struct WorkDeque {
+        std::mutex         lock_;
+        std::deque<Task*>  tasks_;
+    };
+
+    static thread_local int index_;
+
+    std::vector<std::unique_ptr<WorkDeque>> deques_;
+    std::vector<std::thread>                threads_;
+    std::mutex                              idle_lock_;
+    std::condition_variable                 idle_cv_;
+    // forks so far, a parked worker wakes when it changes
+    std::atomic<long>                       forks_;
+    // workers waiting on idle_cv_
+    std::atomic<int>                        parked_;
+    std::atomic<bool>                       stop_;
+    std::atomic<long>                       steals_;
+
+    void  worker_main(int index);
+    void  execute(Task* t);
+    Task* steal(int thief);
+    bool  take_back(int index, Task* t);
+};
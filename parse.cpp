@@ -7,132 +7,389 @@
 #include "parse.h"
 #include "expr.h"
 #include <sstream>
+#include <climits>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <streambuf>
+#include <vector>
 
-PTR(Expr) parse(std::istream& in) {
-    PTR(Expr) e = parse_expr(in);
-    skip_whitespace(in);
+// offsets where the lines of the input being parsed start
+static thread_local std::vector<int> line_starts;
 
-    if (! in.eof()) {
-        throw std::runtime_error("invalid input");
+// characters of the text handed to the parser at a time
+static const size_t window = 1 << 20;
+
+/**
+ * \brief reads text in memory, such as a mapped file, without copying it.
+ * The text is handed out a window at a time, and the lines in each window
+ * are found as parsing reaches it, so text that has been parsed is never
+ * looked at again and can be released.
+ */
+class TextBuf : public std::streambuf {
+public:
+    TextBuf(const char* text, size_t size, const std::function<void(size_t)>& passed)
+        : text_(const_cast<char*>(text)), size_(size), passed_(passed) {
+        setg(text_, text_, text_);
     }
 
-    return e;
-}
+protected:
+    int_type underflow() override {
+        size_t at = egptr() - text_;
 
-PTR(Expr) parse_str(const std::string& s) {
-    std::stringstream ss(s);
+        if (at >= size_) {
+            return traits_type::eof();
+        }
+        if (at > 0 && passed_) {
+            passed_(at);
+        }
 
-    return parse(ss);
-}
+        size_t end = std::min(at + window, size_);
+        for (const char* c = text_ + at; (c = (const char*) memchr(c, '\n', text_ + end - c)) != nullptr; c++) {
+            line_starts.push_back((int) (c - text_ + 1));
+        }
+        // eback() stays at the start, so that seekoff() can tell where
+        // the parser is
+        setg(text_, text_ + at, text_ + end);
 
-static PTR(Expr) parse_expr(std::istream& in) {
-    PTR(Expr) e = parse_comparg(in);
-    skip_whitespace(in);
+        return traits_type::to_int_type(*gptr());
+    }
 
-    if (in.peek() == '=') {
-        consume_str(in, "==");
-        PTR(Expr) rhs = parse_expr(in);
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if (off != 0 || dir != std::ios_base::cur) {
+            return pos_type(off_type(-1));
+        }
 
-        return NEW(EqExpr)(e, rhs);
+        return pos_type(gptr() - eback());
     }
 
-    return e;
-}
+private:
+    char*                       text_;
+    size_t                      size_;
+    std::function<void(size_t)> passed_;
+};
 
-static PTR(Expr) parse_comparg(std::istream& in) {
-    PTR(Expr) e = parse_addend(in);
-    skip_whitespace(in);
+/**
+ * \brief parse a whole program from text in memory, without copying it
+ * \param text the program
+ * \param size its length
+ * \param passed called now and then with an offset that parsing has gone
+ * past for good, so that the text before it can be released; may be empty
+ * \return the expression
+ */
+PTR(Expr) parse_text(const char* text, size_t size, const std::function<void(size_t)>& passed) {
+    if (size > INT_MAX) {
+        throw std::runtime_error("input too large");
+    }
+
+    TextBuf buf(text, size, passed);
+    std::istream in(&buf);
 
-    if (in.peek() == '+') {
-        consume(in, '+');
-        PTR(Expr) rhs = parse_comparg(in);
+    line_starts = {0};
+
+    PTR(Expr) e = parse_expr(in);
+    skip_whitespace(in);
 
-        return NEW(AddExpr)(e, rhs);
+    if (! in.eof()) {
+        throw std::runtime_error("invalid input");
     }
 
     return e;
 }
 
-static PTR(Expr) parse_addend(std::istream& in) {
-    PTR(Expr) e = parse_multicand(in);
-    skip_whitespace(in);
-
-    if (in.peek() == '*') {
-        consume(in, '*');
-        PTR(Expr) rhs = parse_addend(in);
+PTR(Expr) parse(std::istream& in) {
+    // read everything first, so positions are known even when in is a pipe
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
 
-        return NEW(MultExpr)(e, rhs);
-    }
+    return parse_text(text.data(), text.size());
+}
 
-    return e;
+PTR(Expr) parse_str(const std::string& s) {
+    return parse_text(s.data(), s.size());
 }
 
-static PTR(Expr) parse_multicand(std::istream& in) {
-    PTR(Expr) e = parse_inner(in);
-    skip_whitespace(in);
+/**
+ * \brief the offset of the next character of the input
+ */
+static int position(std::istream& in) {
+    return (int) in.rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+}
 
-    while (in.peek() == '(') {
-        consume(in, '(');
-        PTR(Expr) arg = parse_expr(in);
-        skip_whitespace(in);
+/**
+ * \brief record where an expression was read from
+ * \param e the expression
+ * \param begin offset of its first character
+ * \param end offset one past its last character
+ * \return e
+ */
+static PTR(Expr) span(PTR(Expr) e, int begin, int end) {
+    int line = (int) (std::upper_bound(line_starts.begin(), line_starts.end(), begin) - line_starts.begin());
 
-        if (in.get() != ')') {
-            throw std::runtime_error("bad input");
-        }
-        e = NEW(CallExpr)(e, arg);
-    }
+    e->pos_ = begin;
+    e->end_ = end;
+    e->line_ = line;
+    e->column_ = begin - line_starts[line - 1] + 1;
 
     return e;
 }
 
-static PTR(Expr) parse_inner(std::istream& in) {
-    skip_whitespace(in);
-    int c = in.peek();
-
-    if (c == '-' || isdigit(c)) {
-        return parse_num(in);
-    }
-    if (c == '(') {
-        consume(in, '(');
-        PTR(Expr) e = parse_expr(in);
-        skip_whitespace(in);
-        c = in.get();
+// what the parser is in the middle of, while it parses a part of it
+typedef enum {
+    // lhs == ...
+    pending_eq,
+    // lhs + ...
+    pending_add,
+    // lhs * ...
+    pending_mult,
+    // ( ... )
+    pending_paren,
+    // lhs( ... )
+    pending_call,
+    // _let var = ... _in
+    pending_let_rhs,
+    // _let var = rhs _in ...
+    pending_let_body,
+    // _if ... _then
+    pending_if_condition,
+    // _if condition _then ... _else
+    pending_if_then,
+    // _if condition _then then _else ...
+    pending_if_else,
+    // _fun (var) ...
+    pending_fun_body,
+} pending_t;
+
+// the rule a part is parsed with, from the loosest to the tightest
+typedef enum {
+    level_expr,
+    level_comparg,
+    level_addend,
+} level_t;
+
+struct Pending {
+    pending_t   kind_;
+    // the rule the construct itself was started under
+    level_t     level_;
+    int         begin_;
+    std::string var_;
+    PTR(Expr)   lhs_;
+    PTR(Expr)   mid_;
+};
 
-        if (c != ')') {
-            throw std::runtime_error("bad input");
-        }
+/**
+ * \brief parse an expression with the grammar
+ *
+ *     expr      = comparg [ "==" expr ]
+ *     comparg   = addend [ "+" comparg ]
+ *     addend    = multicand [ "*" addend ]
+ *     multicand = inner { "(" expr ")" }
+ *     inner     = number | "(" expr ")" | variable | "_true" | "_false"
+ *               | "_let" variable "=" expr "_in" expr
+ *               | "_if" expr "_then" expr "_else" expr
+ *               | "_fun" "(" variable ")" expr
+ *
+ * keeping the constructs it is inside of on a stack of its own instead of
+ * recursing, so that nesting as deep as a large script has, such as a
+ * long chain of + or of _let, cannot overflow the call stack.
+ */
+static PTR(Expr) parse_expr(std::istream& in) {
+    std::vector<Pending> pending;
+    level_t level = level_expr;
+    PTR(Expr) e;
 
-        return e;
-    }
-    else if (isalpha(c)) {
-        return parse_var(in);
-    }
-    else if (c == '_') {
-        consume(in, '_');
-        std::string keyword = parse_keyword(in);
+    // each turn starts an inner expression, unless a construct that is
+    // done leaves e to be continued after
+    while (true) {
+        skip_whitespace(in);
+        int begin = position(in);
+        int c = in.peek();
+        bool started = false;
 
-        if (keyword == "let") {
-            return parse_let(in);
+        if (c == '-' || isdigit(c)) {
+            e = parse_num(in);
+            span(e, begin, position(in));
         }
-        else if (keyword == "true") {
-            return NEW(BoolExpr)(true);
+        else if (c == '(') {
+            consume(in, '(');
+            pending.push_back({pending_paren, level, begin});
+            started = true;
         }
-        else if (keyword == "false") {
-            return NEW(BoolExpr)(false);
+        else if (isalpha(c)) {
+            e = parse_var(in);
+            span(e, begin, position(in));
         }
-        else if (keyword == "if") {
-            return parse_if(in);
-        }
-        else if (keyword == "fun") {
-            return parse_fun(in);
+        else if (c == '_') {
+            consume(in, '_');
+            std::string keyword = parse_keyword(in);
+
+            if (keyword == "let") {
+                skip_whitespace(in);
+                std::string var = parse_var(in)->var_;
+                skip_whitespace(in);
+
+                if (in.peek() != '=') {
+                    throw std::runtime_error("bad input");
+                }
+                consume(in, '=');
+                pending.push_back({pending_let_rhs, level, begin, var});
+                started = true;
+            }
+            else if (keyword == "true") {
+                e = span(NEW(BoolExpr)(true), begin, position(in));
+            }
+            else if (keyword == "false") {
+                e = span(NEW(BoolExpr)(false), begin, position(in));
+            }
+            else if (keyword == "if") {
+                pending.push_back({pending_if_condition, level, begin});
+                started = true;
+            }
+            else if (keyword == "fun") {
+                skip_whitespace(in);
+                if (in.peek() != '(') {
+                    throw std::runtime_error("bad input");
+                }
+                consume(in, '(');
+                skip_whitespace(in);
+                std::string var = parse_var(in)->var_;
+                skip_whitespace(in);
+                if (in.peek() != ')') {
+                    throw std::runtime_error("bad input");
+                }
+                consume(in, ')');
+                pending.push_back({pending_fun_body, level, begin, var});
+                started = true;
+            }
+            else {
+                throw std::runtime_error("bad input");
+            }
         }
         else {
+            consume(in, c);
             throw std::runtime_error("bad input");
         }
-    }
-    else {
-        consume(in, c);
-        throw std::runtime_error("bad input");
+
+        if (started) {
+            // the part inside is a whole expr
+            level = level_expr;
+            continue;
+        }
+
+        // e is an inner expression started under level: apply the calls
+        // after it, then the operators the level allows, and finish the
+        // constructs that e completes, until one needs another part
+        bool calls = true;
+
+        while (true) {
+            skip_whitespace(in);
+
+            if (calls && in.peek() == '(') {
+                consume(in, '(');
+                pending.push_back({pending_call, level, 0, "", e});
+                level = level_expr;
+                break;
+            }
+            if (calls && in.peek() == '*') {
+                consume(in, '*');
+                pending.push_back({pending_mult, level, 0, "", e});
+                level = level_addend;
+                break;
+            }
+            if (level != level_addend && in.peek() == '+') {
+                consume(in, '+');
+                pending.push_back({pending_add, level, 0, "", e});
+                level = level_comparg;
+                break;
+            }
+            if (level == level_expr && in.peek() == '=') {
+                consume_str(in, "==");
+                pending.push_back({pending_eq, level, 0, "", e});
+                level = level_expr;
+                break;
+            }
+
+            // e is complete for its level, so it is the part the innermost
+            // pending construct was waiting for
+            if (pending.empty()) {
+                return e;
+            }
+
+            Pending& p = pending.back();
+            level = p.level_;
+
+            if (p.kind_ == pending_let_rhs) {
+                skip_whitespace(in);
+                if (parse_keyword(in) != "_in") {
+                    throw std::runtime_error("bad input");
+                }
+                p.kind_ = pending_let_body;
+                p.mid_ = e;
+                level = level_expr;
+                break;
+            }
+            if (p.kind_ == pending_if_condition || p.kind_ == pending_if_then) {
+                skip_whitespace(in);
+                if (parse_keyword(in) != (p.kind_ == pending_if_condition ? "_then" : "_else")) {
+                    throw std::runtime_error("bad input");
+                }
+                if (p.kind_ == pending_if_condition) {
+                    p.lhs_ = e;
+                }
+                else {
+                    p.mid_ = e;
+                }
+                p.kind_ = p.kind_ == pending_if_condition ? pending_if_then : pending_if_else;
+                level = level_expr;
+                break;
+            }
+
+            Pending done = std::move(p);
+            pending.pop_back();
+
+            switch (done.kind_) {
+            case pending_eq:
+                e = span(NEW(EqExpr)(done.lhs_, e), done.lhs_->pos_, e->end_);
+                calls = false;
+                break;
+            case pending_add:
+                e = span(NEW(AddExpr)(done.lhs_, e), done.lhs_->pos_, e->end_);
+                calls = false;
+                break;
+            case pending_mult:
+                e = span(NEW(MultExpr)(done.lhs_, e), done.lhs_->pos_, e->end_);
+                calls = false;
+                break;
+            case pending_paren:
+                skip_whitespace(in);
+                if (in.get() != ')') {
+                    throw std::runtime_error("bad input");
+                }
+                calls = true;
+                break;
+            case pending_call:
+                skip_whitespace(in);
+                if (in.get() != ')') {
+                    throw std::runtime_error("bad input");
+                }
+                e = span(NEW(CallExpr)(done.lhs_, e), done.lhs_->pos_, position(in));
+                calls = true;
+                break;
+            case pending_let_body:
+                e = span(NEW(LetExpr)(done.var_, done.mid_, e), done.begin_, e->end_);
+                calls = true;
+                break;
+            case pending_if_else:
+                e = span(NEW(IfExpr)(done.lhs_, done.mid_, e), done.begin_, e->end_);
+                calls = true;
+                break;
+            case pending_fun_body:
+                e = span(NEW(FunExpr)(NEW(VarExpr)(done.var_), e), done.begin_, e->end_);
+                calls = true;
+                break;
+            default:
+                break;
+            }
+        }
     }
 }
 
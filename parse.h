@@ -7,6 +7,10 @@
 #pragma once
 
 #include "pointer.h"
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <string>
 
 class Expr;
 class LetExpr;
@@ -17,16 +21,10 @@ class FunExpr;
 
 PTR(Expr)           parse(std::istream& in);
 PTR(Expr)           parse_str(const std::string& s);
+PTR(Expr)           parse_text(const char* text, size_t size, const std::function<void(size_t)>& passed = nullptr);
 static PTR(Expr)    parse_expr(std::istream& in);
-static PTR(Expr)    parse_comparg(std::istream& in);
-static PTR(Expr)    parse_addend(std::istream& in);
-static PTR(Expr)    parse_multicand(std::istream& in);
-static PTR(Expr)    parse_inner(std::istream& in);
 static PTR(NumExpr) parse_num(std::istream& in);
 static PTR(VarExpr) parse_var(std::istream& in);
-static PTR(LetExpr) parse_let(std::istream& in);
-static PTR(IfExpr)  parse_if(std::istream& in);
-static PTR(FunExpr) parse_fun(std::istream& in);
 static std::string  parse_keyword(std::istream& in);
 static void         skip_whitespace(std::istream& in);
 static void         consume(std::istream& in, int expect);
@@ -1,7 +1,11 @@
 #ifndef __msdscript_pointer__
 #define __msdscript_pointer__
 
+#include <atomic>
+#include <cstddef>
 #include <memory>
+#include <typeinfo>
+#include <utility>
 
 #define USE_PLAIN_POINTERS 0
 #if USE_PLAIN_POINTERS
@@ -9,17 +13,92 @@
 # define NEW(T)    new T
 # define PTR(T)    T*
 # define CAST(T)   dynamic_cast<T*>
+# define UNCHECKED_CAST(T) static_cast<T*>
 # define CLASS(T)  class T
 # define THIS      this
 
 #else
 
-# define NEW(T)    std::make_shared<T>
+# define NEW(T)    make_counted<T>
 # define PTR(T)    std::shared_ptr<T>
 # define CAST(T)   std::dynamic_pointer_cast<T>
+# define UNCHECKED_CAST(T) std::static_pointer_cast<T>
 # define CLASS(T)  class T : public std::enable_shared_from_this<T>
 # define THIS      this->shared_from_this()
 
+// live, peak and total counts and bytes of the objects of one type made by
+// NEW while MemStats is enabled, see memstats.h
+struct MemCounter {
+    std::atomic<long> live_{0};
+    std::atomic<long> peak_{0};
+    std::atomic<long> total_{0};
+    std::atomic<long> live_bytes_{0};
+    std::atomic<long> peak_bytes_{0};
+
+    void allocated(long bytes);
+    void freed(long bytes);
+};
+
+MemCounter& mem_counter(const std::type_info& type);
+
+// set by MemStats::enable() and Profiler::enable()
+extern bool count_allocations;
+// objects NEW has made while counting, read by the --profile profiler
+extern std::atomic<long> allocation_count;
+
+// allocator that charges whatever shared_ptr allocates for an object of
+// type Tag, control block included, to the MemCounter of Tag
+template <typename T, typename Tag>
+class CountingAllocator {
+public:
+    typedef T value_type;
+
+    CountingAllocator() = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U, Tag>&) {
+    }
+
+    T* allocate(std::size_t n) {
+        static MemCounter& counter = mem_counter(typeid(Tag));
+
+        T* p = std::allocator<T>().allocate(n);
+        counter.allocated((long) (n * sizeof(T)));
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        static MemCounter& counter = mem_counter(typeid(Tag));
+
+        counter.freed((long) (n * sizeof(T)));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U, Tag>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U, Tag>&) const {
+        return false;
+    }
+};
+
+/**
+ * \brief what NEW(T)(args) expands to: make_shared, counted per type when
+ * MemStats is enabled
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> make_counted(Args&&... args) {
+    if (count_allocations) {
+        return std::allocate_shared<T>(CountingAllocator<T, T>(), std::forward<Args>(args)...);
+    }
+
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,254 @@
+/**
+ * \file pretty.cpp
+ * \brief Definitions of PrettyWriter, the layout engine behind
+ * pretty_print_at
+ * \author Laura Zhang
+ *
+ * The printer used to find its column with std::ostream::tellp, which
+ * fails on streams that cannot seek, and it only broke lines at _let, _if
+ * and _fun, so a big sum or a long chain of calls came out as one line.
+ *
+ * The layout follows Oppen's pretty printer. Every node opens a block
+ * where it starts, and a newline goes to the column of the block around
+ * it plus an offset. An optional newline is taken when the text after it,
+ * up to the next optional newline in the same block or one around it, up
+ * to a newline that is always taken, or up to the end, does not fit in
+ * what is left of the line. Text is held back only while the oldest
+ * optional newline is undecided, and that is decided as soon as the text
+ * after it outgrows the line, so at most a line's worth is ever held back
+ * and each piece of text is handled a fixed number of times. A block that
+ * opens past the middle of the line is indented a little from the block
+ * around it instead of lined up with where it opens, so indentation stays
+ * within half the width however deep the nesting, and the output grows
+ * linearly with the expression. With no width limit every optional
+ * newline is written as blanks at once and nothing is held back.
+ */
+
+#include "pretty.h"
+#include "output.h"
+#include <algorithm>
+#include <cstring>
+
+int PrettyWriter::default_width = 0;
+
+// spaces written in one go for indentation
+static const char spaces[] = "                                                                ";
+
+/**
+ * \param ot where the text goes
+ * \param width the longest line to aim for, 0 for no limit
+ */
+PrettyWriter::PrettyWriter(std::ostream& ot, int width)
+    : ot_(ot), width_(width), column_(0), indents_(1, 0), depth_(0), total_(0), first_(0) {
+}
+
+PrettyWriter::Token& PrettyWriter::token(long n) {
+    return pending_[n - first_];
+}
+
+void PrettyWriter::write_text(const char* text, size_t size) {
+    ot_.write(text, size);
+    column_ += (int) size;
+}
+
+void PrettyWriter::write_newline(int indent) {
+    ot_.put('\n');
+    column_ = 0;
+
+    while (indent > 0) {
+        int n = indent < (int) sizeof(spaces) - 1 ? indent : (int) sizeof(spaces) - 1;
+        write_text(spaces, n);
+        indent -= n;
+    }
+}
+
+/**
+ * \brief write a token that is no longer held back
+ * \param take for an optional newline, whether to take it
+ */
+void PrettyWriter::write(const Token& token, bool take) {
+    switch (token.kind_) {
+    case token_text:
+        write_text(token.text_.data(), token.text_.size());
+        break;
+    case token_open:
+        if (width_ > 0 && column_ > width_ / 2) {
+            // lining up with a block that far right would leave little
+            // room, and deep nesting would push every line further in
+            indents_.push_back(std::min(indents_.back() + 2, width_ / 2));
+        }
+        else {
+            indents_.push_back(column_);
+        }
+        break;
+    case token_close:
+        indents_.pop_back();
+        break;
+    case token_optional:
+        if (take) {
+            write_newline(indents_.back() + token.offset_);
+        }
+        else {
+            write_text(spaces, token.blank_);
+        }
+        break;
+    default:
+        write_newline(indents_.back() + token.offset_);
+        break;
+    }
+}
+
+/**
+ * \brief write a token now if nothing is held back, or hold it back too
+ */
+void PrettyWriter::add(const Token& token) {
+    if (undecided_.empty()) {
+        write(token, false);
+    }
+    else {
+        pending_.push_back(token);
+    }
+}
+
+/**
+ * \brief decide the oldest optional newlines as far as what has been laid
+ * out allows, writing each with what follows it up to the next undecided one
+ */
+void PrettyWriter::decide() {
+    while (! undecided_.empty()) {
+        long n = undecided_.front();
+        Token& optional = token(n);
+        long size = (optional.end_ >= 0 ? optional.end_ : total_) - optional.start_;
+        bool take;
+
+        if (column_ + size > width_) {
+            take = true;
+        }
+        else if (optional.end_ >= 0) {
+            take = false;
+        }
+        else {
+            // it fits so far, but more may come
+            return;
+        }
+
+        undecided_.pop_front();
+        if (! growing_.empty() && growing_.front() == n) {
+            growing_.pop_front();
+        }
+        write(optional, take);
+        pending_.pop_front();
+        first_++;
+
+        while (! pending_.empty() && (undecided_.empty() || first_ != undecided_.front())) {
+            write(pending_.front(), false);
+            pending_.pop_front();
+            first_++;
+        }
+    }
+}
+
+void PrettyWriter::text(const char* text, size_t size) {
+    total_ += (long) size;
+
+    if (undecided_.empty()) {
+        write_text(text, size);
+    }
+    else {
+        pending_.push_back({token_text, std::string(text, size), 0, 0, 0, 0, 0});
+        decide();
+    }
+}
+
+PrettyWriter& PrettyWriter::operator<<(const std::string& text) {
+    this->text(text.data(), text.size());
+
+    return *this;
+}
+
+PrettyWriter& PrettyWriter::operator<<(const char* text) {
+    this->text(text, strlen(text));
+
+    return *this;
+}
+
+PrettyWriter& PrettyWriter::operator<<(int n) {
+    char text[max_int_chars];
+
+    this->text(text, format_int(text, n) - text);
+
+    return *this;
+}
+
+/**
+ * \brief start a block at the current column; newlines inside it are
+ * indented from there
+ */
+void PrettyWriter::open() {
+    depth_++;
+    add({token_open, "", 0, 0, 0, 0, 0});
+}
+
+/**
+ * \brief end the innermost block
+ */
+void PrettyWriter::close() {
+    depth_--;
+    add({token_close, "", 0, 0, 0, 0, 0});
+}
+
+/**
+ * \brief a place to end the line if what follows does not fit on it
+ * \param blank the number of spaces written instead when it fits
+ * \param offset columns to indent the next line by past its block
+ */
+void PrettyWriter::optional_newline(int blank, int offset) {
+    if (width_ <= 0) {
+        text(spaces, blank);
+        return;
+    }
+
+    // what must fit after the optional newlines of this block and the
+    // blocks inside it ends here
+    while (! growing_.empty() && token(growing_.back()).depth_ >= depth_) {
+        token(growing_.back()).end_ = total_;
+        growing_.pop_back();
+    }
+
+    long n = first_ + (long) pending_.size();
+    pending_.push_back({token_optional, "", blank, offset, depth_, total_, -1});
+    undecided_.push_back(n);
+    growing_.push_back(n);
+    total_ += blank;
+
+    decide();
+}
+
+/**
+ * \brief end the line, and start the next one at the column of the
+ * innermost block plus offset
+ * \param offset columns to indent by past the block
+ */
+void PrettyWriter::newline(int offset) {
+    // what must fit after every optional newline still waiting ends here,
+    // so all of them can be decided
+    for (long n : growing_) {
+        token(n).end_ = total_;
+    }
+    growing_.clear();
+    decide();
+
+    write_newline(indents_.back() + offset);
+}
+
+/**
+ * \brief decide and write everything still held back; call it once the
+ * whole expression has been laid out
+ */
+void PrettyWriter::finish() {
+    for (long n : growing_) {
+        token(n).end_ = total_;
+    }
+    growing_.clear();
+    decide();
+}
@@ -0,0 +1,88 @@
+/**
+ * \file pretty.h
+ * \brief Declarations of PrettyWriter, the layout engine behind
+ * pretty_print_at
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * \brief lays pretty printed text out in lines of at most a given width
+ * and writes it to a stream as it goes. The text comes in blocks, opened
+ * at the column they start at, with newlines that are always taken and
+ * optional ones that are taken only when what follows them would not fit
+ * on the line. Any stream works, including std::cout and pipes.
+ */
+class PrettyWriter {
+public:
+    // width pretty_print() lays lines out for, 0 for no limit
+    static int default_width;
+
+    PrettyWriter(std::ostream& ot, int width = default_width);
+
+    PrettyWriter& operator<<(const std::string& text);
+    PrettyWriter& operator<<(const char* text);
+    PrettyWriter& operator<<(int n);
+    void          open();
+    void          close();
+    void          optional_newline(int blank, int offset);
+    void          newline(int offset);
+    void          finish();
+
+private:
+    typedef enum {
+        token_text,
+        token_open,
+        token_close,
+        token_optional,
+        token_newline,
+    } token_kind_t;
+
+    // a piece of layout waiting for an optional newline before it to be
+    // decided
+    struct Token {
+        token_kind_t kind_;
+        std::string  text_;
+        int          blank_;
+        int          offset_;
+        // for an optional newline: the number of blocks open around it,
+        // and where what must fit after it starts and ends in total_
+        int          depth_;
+        long         start_;
+        long         end_;
+    };
+
+    std::ostream&     ot_;
+    int               width_;
+    // characters written since the last newline
+    int               column_;
+    // the columns of the blocks open in what has been written
+    std::vector<int>  indents_;
+    // blocks open in what has been laid out
+    int               depth_;
+    // characters laid out so far, counting optional newlines as blanks
+    long              total_;
+    // everything from the oldest undecided optional newline on
+    std::deque<Token> pending_;
+    // the number of tokens taken off the front of pending_
+    long              first_;
+    // undecided optional newlines, oldest first, by token number
+    std::deque<long>  undecided_;
+    // optional newlines whose text that must fit is still growing, outermost first
+    std::deque<long>  growing_;
+
+    void              text(const char* text, size_t size);
+    Token&            token(long n);
+    void              add(const Token& token);
+    void              decide();
+    void              write(const Token& token, bool take);
+    void              write_text(const char* text, size_t size);
+    void              write_newline(int indent);
+};
@@ -0,0 +1,250 @@
+/**
+ * \file profile.cpp
+ * \brief Definitions of the evaluation profiler behind --profile
+ * \author Laura Zhang
+ *
+ * Expr::interp() only checks Expr::profiling before calling do_interp(), so
+ * the profiler costs one predictable branch per node when it is off. When
+ * it is on, every evaluation goes through Profiler::interp(), which times
+ * the node with a steady clock and charges the time and the objects NEW
+ * made meanwhile, counted by make_counted() as for --mem-stats, to the node
+ * type and to the source location the parser recorded. Time spent in child
+ * nodes is subtracted to get the exclusive time, so VarExpr shows the cost
+ * of Env::lookup, LetExpr the cost of building its ExtendedEnv and CallExpr
+ * the cost of the call itself.
+ */
+
+#include "profile.h"
+#include "expr.h"
+#include "val.h"
+#include "env.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <exception>
+#include <iomanip>
+#include <stdexcept>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+int Profiler::line_offset = 0;
+
+typedef std::chrono::steady_clock profile_clock;
+
+static std::map<std::string, Profiler::Entry> types;
+static std::map<std::string, Profiler::Entry> locations;
+
+// time and allocations of the children of the nodes being evaluated
+struct Running {
+    double child_ms_ = 0;
+    long   child_allocations_ = 0;
+};
+
+static std::vector<Running> running;
+
+/**
+ * \brief the readable name of the dynamic type of an expression
+ */
+static const std::string& type_name(Expr* e) {
+    static std::unordered_map<std::type_index, std::string> names;
+    std::type_index type(typeid(*e));
+    auto found = names.find(type);
+
+    if (found != names.end()) {
+        return found->second;
+    }
+
+    int status;
+    char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : type.name();
+    free(demangled);
+
+    return names[type] = name;
+}
+
+/**
+ * \brief the source of an expression, shortened to fit a report line
+ */
+static std::string snippet(Expr* e) {
+    std::string s = e->to_string();
+
+    if (s.size() > 40) {
+        s = s.substr(0, 37) + "...";
+    }
+
+    return s;
+}
+
+static void charge(Profiler::Entry& entry, double inclusive_ms, double exclusive_ms, long allocations) {
+    entry.count_++;
+    entry.inclusive_ms_ += inclusive_ms;
+    entry.exclusive_ms_ += exclusive_ms;
+    entry.allocations_ += allocations;
+}
+
+/**
+ * \brief turn profiling on
+ */
+void Profiler::enable() {
+    if (! MSD_PROFILE) {
+        throw std::runtime_error("--profile needs a build with MSD_PROFILE set");
+    }
+
+    Expr::profiling = true;
+    count_allocations = true;
+}
+
+/**
+ * \brief forget everything recorded so far
+ */
+void Profiler::reset() {
+    types.clear();
+    locations.clear();
+    running.clear();
+}
+
+/**
+ * \brief evaluate an expression and record what it cost
+ * \param e the expression
+ * \param env the values of its free variables
+ * \return the value of the expression
+ */
+PTR(Val) Profiler::interp(Expr* e, PTR(Env) env) {
+    running.push_back(Running());
+
+    long allocations_before = allocation_count.load(std::memory_order_relaxed);
+    profile_clock::time_point start = profile_clock::now();
+
+    PTR(Val) result;
+    std::exception_ptr error;
+
+    try {
+        result = e->do_interp(env);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    double inclusive_ms = std::chrono::duration<double, std::milli>(profile_clock::now() - start).count();
+    long own_allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+    Running self = running.back();
+    running.pop_back();
+
+    double exclusive_ms = inclusive_ms - self.child_ms_;
+    long exclusive_allocations = own_allocations - self.child_allocations_;
+
+    if (! running.empty()) {
+        running.back().child_ms_ += inclusive_ms;
+        running.back().child_allocations_ += own_allocations;
+    }
+
+    const std::string& type = type_name(e);
+    charge(types[type], inclusive_ms, exclusive_ms, exclusive_allocations);
+
+    if (e->line_ > 0) {
+        std::string key = std::to_string(e->line_ + line_offset) + ":" + std::to_string(e->column_) + " " + type;
+        Entry& location = locations[key];
+
+        if (location.count_ == 0) {
+            location.type_ = type;
+            location.source_ = snippet(e);
+        }
+        charge(location, inclusive_ms, exclusive_ms, exclusive_allocations);
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return result;
+}
+
+/**
+ * \brief what was recorded for each node type, by type name
+ */
+const std::map<std::string, Profiler::Entry>& Profiler::by_type() {
+    return types;
+}
+
+/**
+ * \brief what was recorded for each source location, by "line:column type"
+ */
+const std::map<std::string, Profiler::Entry>& Profiler::by_location() {
+    return locations;
+}
+
+/**
+ * \brief the entries of a table, most exclusive time first
+ */
+static std::vector<std::pair<std::string, Profiler::Entry>> sorted(const std::map<std::string, Profiler::Entry>& table) {
+    std::vector<std::pair<std::string, Profiler::Entry>> rows(table.begin(), table.end());
+
+    std::stable_sort(rows.begin(), rows.end(), [](const std::pair<std::string, Profiler::Entry>& a,
+                                                  const std::pair<std::string, Profiler::Entry>& b) {
+        return a.second.exclusive_ms_ > b.second.exclusive_ms_;
+    });
+
+    return rows;
+}
+
+static void report_row(std::ostream& out, const std::string& name, const Profiler::Entry& entry) {
+    out << std::left << std::setw(24) << name << std::right
+        << std::setw(12) << entry.count_
+        << std::setw(14) << entry.inclusive_ms_
+        << std::setw(14) << entry.exclusive_ms_
+        << std::setw(12) << entry.allocations_ << "\n";
+}
+
+/**
+ * \brief print the tables sorted by exclusive time
+ * \param out where to print
+ */
+void Profiler::report(std::ostream& out) {
+    std::ios_base::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+
+    out << "profile by node type:\n";
+    out << std::left << std::setw(24) << "type" << std::right
+        << std::setw(12) << "count"
+        << std::setw(14) << "incl ms"
+        << std::setw(14) << "excl ms"
+        << std::setw(12) << "allocs" << "\n";
+    for (auto& row : sorted(types)) {
+        report_row(out, row.first, row.second);
+    }
+
+    out << "profile by location (top 20):\n";
+    out << std::left << std::setw(24) << "line:col" << std::right
+        << std::setw(12) << "count"
+        << std::setw(14) << "incl ms"
+        << std::setw(14) << "excl ms"
+        << std::setw(12) << "allocs" << "  source\n";
+    int shown = 0;
+    for (auto& row : sorted(locations)) {
+        if (shown++ == 20) {
+            break;
+        }
+        std::string where = row.first.substr(0, row.first.find(' '));
+        out << std::left << std::setw(24) << where << std::right
+            << std::setw(12) << row.second.count_
+            << std::setw(14) << row.second.inclusive_ms_
+            << std::setw(14) << row.second.exclusive_ms_
+            << std::setw(12) << row.second.allocations_
+            << "  " << row.second.type_ << " " << row.second.source_ << "\n";
+    }
+
+    long hits = VarExpr::cache_hits;
+    long misses = VarExpr::cache_misses;
+    if (hits + misses > 0) {
+        out << "variable cache: " << hits << " hits, " << misses << " misses, "
+            << std::setprecision(1) << 100.0 * hits / (hits + misses) << "% hit rate\n";
+    }
+
+    out.flags(flags);
+}
+
+PTR(Val) Expr::profiled_interp(const PTR(Env)& env) {
+    return Profiler::interp(this, env);
+}
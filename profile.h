@@ -0,0 +1,42 @@
+/**
+ * \file profile.h
+ * \brief Declarations of the evaluation profiler behind --profile
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <atomic>
+#include <map>
+#include <ostream>
+#include <string>
+
+class Expr;
+class Env;
+class Val;
+
+class Profiler {
+public:
+    struct Entry {
+        long        count_ = 0;
+        double      inclusive_ms_ = 0;
+        double      exclusive_ms_ = 0;
+        long        allocations_ = 0;
+        // node type and source of the first node seen at a location
+        std::string type_;
+        std::string source_;
+    };
+
+    // added to the line numbers of the input, for --interp which parses
+    // every line separately
+    static int line_offset;
+
+    static void enable();
+    static void reset();
+    static PTR(Val) interp(Expr* e, PTR(Env) env);
+
+    static const std::map<std::string, Entry>& by_type();
+    static const std::map<std::string, Entry>& by_location();
+    static void report(std::ostream& out);
+};
@@ -0,0 +1,330 @@
+/**
+ * \file sample.cpp
+ * \brief Definitions of the sampling profiler behind --flamegraph
+ * \author Laura Zhang
+ *
+ * Every function call pushes the body of the called function on a shadow
+ * stack kept per thread, so the stack shows MSDScript functions instead of
+ * the C++ frames of the tree walker. A SIGPROF timer interrupts the thread
+ * that is using the CPU, and the handler adds its shadow stack to a table
+ * of distinct stacks and their sample counts. The handler cannot allocate
+ * or lock, so the table and the pool of frames it points into are made by
+ * start(), and a sample arriving while another thread is in the handler,
+ * or after the table is full, is only counted as dropped. After each run
+ * forget_functions() turns the table into named stacks and empties it, so
+ * the expressions of a long input stream are not all kept alive for the
+ * names. write() prints the stacks in the collapsed-stack format, one
+ * "root;outer;inner count" line per stack, that flamegraph.pl and
+ * speedscope read.
+ */
+
+#include "sample.h"
+#include "expr.h"
+#include "trace.h"
+#include <algorithm>
+#include <csignal>
+#include <map>
+#include <stdexcept>
+#include <sys/time.h>
+#include <vector>
+
+bool Sampler::enabled = false;
+
+// the functions running on a thread, outermost first
+struct ShadowStack {
+    const Expr*      frames_[Sampler::max_depth];
+    std::atomic<int> depth_{0};
+};
+
+static thread_local ShadowStack stack;
+
+// a distinct stack seen by the handler
+struct Stack {
+    unsigned long hash_;
+    long          count_;
+    int           offset_;
+    int           depth_;
+};
+
+static const int table_size = 1 << 16;
+static const int pool_size = 1 << 21;
+
+static std::vector<Stack> table;
+static std::vector<const Expr*> pool;
+// the slots of the table in use, in the order the handler filled them
+static std::vector<int> slots;
+static int stacks_used = 0;
+static int pool_used = 0;
+
+static std::atomic_flag busy = ATOMIC_FLAG_INIT;
+static std::atomic<long> sample_count(0);
+static std::atomic<long> dropped_count(0);
+
+// names of the functions registered for the current run, by body, and
+// the expressions they come from, kept so the bodies are not freed and
+// their addresses reused until forget_functions()
+static std::map<const Expr*, std::string> labels;
+static std::vector<PTR(Expr)> named;
+
+// sample counts of the stacks of earlier runs, by collapsed stack
+static std::map<std::string, long> folded;
+
+/**
+ * \brief record the shadow stack of the interrupted thread
+ */
+static void on_sample(int) {
+    if (busy.test_and_set(std::memory_order_acquire)) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    int depth = stack.depth_.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    if (depth > Sampler::max_depth) {
+        depth = Sampler::max_depth;
+    }
+
+    unsigned long hash = 14695981039346656037ul;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (unsigned long) stack.frames_[i]) * 1099511628211ul;
+    }
+
+    int slot = (int) (hash & (table_size - 1));
+    bool recorded = false;
+
+    for (int probes = 0; probes < table_size; probes++, slot = (slot + 1) & (table_size - 1)) {
+        Stack& entry = table[slot];
+
+        if (entry.count_ == 0) {
+            // a new stack, if there is room for it
+            if (stacks_used < table_size / 2 && pool_used + depth <= pool_size) {
+                for (int i = 0; i < depth; i++) {
+                    pool[pool_used + i] = stack.frames_[i];
+                }
+                entry.hash_ = hash;
+                entry.offset_ = pool_used;
+                entry.depth_ = depth;
+                entry.count_ = 1;
+                slots[stacks_used] = slot;
+                pool_used += depth;
+                stacks_used++;
+                recorded = true;
+            }
+            break;
+        }
+        if (entry.hash_ == hash && entry.depth_ == depth &&
+            std::equal(stack.frames_, stack.frames_ + depth, pool.begin() + entry.offset_)) {
+            entry.count_++;
+            recorded = true;
+            break;
+        }
+    }
+
+    if (recorded) {
+        sample_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    busy.clear(std::memory_order_release);
+}
+
+/**
+ * \brief start sampling the call stacks of all threads
+ * \param hz samples per second of CPU time
+ */
+void Sampler::start(int hz) {
+    if (hz <= 0 || hz > 1000000) {
+        throw std::runtime_error("sample rate must be between 1 and 1000000");
+    }
+
+    table.assign(table_size, Stack());
+    pool.assign(pool_size, nullptr);
+    slots.assign(table_size / 2, 0);
+    folded.clear();
+    stacks_used = 0;
+    pool_used = 0;
+    sample_count = 0;
+    dropped_count = 0;
+
+    struct sigaction action = {};
+    action.sa_handler = on_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+        throw std::runtime_error("cannot install the SIGPROF handler");
+    }
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = 1000000 / hz / 1000000;
+    timer.it_interval.tv_usec = 1000000 / hz % 1000000;
+    timer.it_value = timer.it_interval;
+    enabled = true;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        enabled = false;
+        throw std::runtime_error("cannot start the profiling timer");
+    }
+}
+
+/**
+ * \brief stop the timer, keeping the samples taken so far
+ */
+void Sampler::stop() {
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    enabled = false;
+}
+
+/**
+ * \brief give the functions in an expression names for the report, the
+ * variable a _let binds them to or else their parameter, and where they
+ * start
+ */
+static void label_functions(PTR(Expr) e, const std::string& name, int line_offset) {
+    if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        std::string label = name.empty() ? "_fun(" + f->arg_->var_ + ")" : name;
+
+        if (f->line_ > 0) {
+            label += "@" + std::to_string(f->line_ + line_offset) + ":" + std::to_string(f->column_);
+        }
+        labels[f->body_.get()] = label;
+        // the functions returned by a curried function keep its name
+        label_functions(f->body_, CAST(FunExpr)(f->body_) != nullptr ? name : "", line_offset);
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        label_functions(l->rhs_, l->var_, line_offset);
+        label_functions(l->body_, "", line_offset);
+    }
+    else if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        label_functions(a->lhs_, "", line_offset);
+        label_functions(a->rhs_, "", line_offset);
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        label_functions(m->lhs_, "", line_offset);
+        label_functions(m->rhs_, "", line_offset);
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        label_functions(q->lhs_, "", line_offset);
+        label_functions(q->rhs_, "", line_offset);
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        label_functions(i->condition_, "", line_offset);
+        label_functions(i->then_, "", line_offset);
+        label_functions(i->else_, "", line_offset);
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        label_functions(c->callee_, "", line_offset);
+        label_functions(c->arg_, "", line_offset);
+    }
+}
+
+/**
+ * \brief register the functions of an expression about to be run, so the
+ * report can name them
+ * \param e the expression
+ * \param line_offset added to its line numbers
+ */
+void Sampler::name_functions(PTR(Expr) e, int line_offset) {
+    named.push_back(e);
+    label_functions(e, "", line_offset);
+}
+
+/**
+ * \brief move the stacks in the table to folded under their names and
+ * empty the table; the caller holds busy
+ */
+static void fold_table() {
+    for (int i = 0; i < stacks_used; i++) {
+        Stack& entry = table[slots[i]];
+
+        std::string line = "msdscript";
+        for (int j = 0; j < entry.depth_; j++) {
+            line += ";" + Sampler::label(pool[entry.offset_ + j]);
+        }
+        // a label can stand for several bodies, so merge equal lines
+        folded[line] += entry.count_;
+        entry = Stack();
+    }
+    stacks_used = 0;
+    pool_used = 0;
+}
+
+/**
+ * \brief name the stacks sampled and the calls traced so far, then let go
+ * of the functions registered by name_functions(); call it after each run
+ */
+void Sampler::forget_functions() {
+    Trace::name_calls();
+
+    while (busy.test_and_set(std::memory_order_acquire)) {
+    }
+    fold_table();
+    busy.clear(std::memory_order_release);
+
+    labels.clear();
+    named.clear();
+}
+
+/**
+ * \brief the name name_functions() gave a function
+ * \param body the body of the function
+ * \return the name, or "_fun" for a function it has not seen
+ */
+std::string Sampler::label(const Expr* body) {
+    auto found = labels.find(body);
+
+    return found == labels.end() ? "_fun" : found->second;
+}
+
+/**
+ * \brief note that a function was called on this thread
+ * \param body the body of the function
+ */
+void Sampler::push(const Expr* body) {
+    int depth = stack.depth_.load(std::memory_order_relaxed);
+
+    if (depth < max_depth) {
+        stack.frames_[depth] = body;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    stack.depth_.store(depth + 1, std::memory_order_relaxed);
+}
+
+/**
+ * \brief note that the last function called on this thread returned
+ */
+void Sampler::pop() {
+    stack.depth_.store(stack.depth_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+/**
+ * \brief the number of samples recorded
+ */
+long Sampler::samples() {
+    return sample_count;
+}
+
+/**
+ * \brief the number of samples lost to a full table or to two threads
+ * being interrupted at once
+ */
+long Sampler::dropped() {
+    return dropped_count;
+}
+
+/**
+ * \brief print the samples as collapsed stacks
+ * \param out where to print
+ */
+void Sampler::write(std::ostream& out) {
+    while (busy.test_and_set(std::memory_order_acquire)) {
+    }
+
+    fold_table();
+    busy.clear(std::memory_order_release);
+
+    for (auto& line : folded) {
+        out << line.first << " " << line.second << "\n";
+    }
+}
@@ -0,0 +1,66 @@
+/**
+ * \file sample.h
+ * \brief Declarations of the sampling profiler behind --flamegraph
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <atomic>
+#include <ostream>
+#include <string>
+
+class Expr;
+
+class Sampler {
+public:
+    // deepest MSDScript call stack recorded, deeper calls are left out
+    static const int max_depth = 512;
+
+    // true while the timer runs, checked by SampledCall
+    static bool enabled;
+
+    static void start(int hz);
+    static void stop();
+    static void name_functions(PTR(Expr) e, int line_offset);
+    static void forget_functions();
+    static std::string label(const Expr* body);
+
+    static void push(const Expr* body);
+    static void pop();
+
+    static long samples();
+    static long dropped();
+    static void write(std::ostream& out);
+};
+
+/**
+ * \brief keeps a function on the sampled call stack while it runs
+ */
+class SampledCall {
+public:
+    /**
+     * \param body the body of the function being called, which identifies
+     * the _fun expression it came from
+     */
+    explicit SampledCall(const Expr* body) {
+        active_ = Sampler::enabled;
+
+        if (active_) {
+            Sampler::push(body);
+        }
+    }
+
+    ~SampledCall() {
+        if (active_) {
+            Sampler::pop();
+        }
+    }
+
+    SampledCall(const SampledCall&) = delete;
+    SampledCall& operator=(const SampledCall&) = delete;
+
+private:
+    bool active_;
+};
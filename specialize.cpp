@@ -0,0 +1,285 @@
+/**
+ * \file specialize.cpp
+ * \brief Definitions of the specialized expression nodes and the pass
+ * that introduces them
+ * \author Laura Zhang
+ *
+ * Each specialized node is a subclass of the node it replaces, so printing,
+ * equality and the other passes see the original shape. Only interp() is
+ * overridden: it looks its variables up through VarExpr::lookup(), so they
+ * keep the inline cache of the VarExpr they replace, and works on the
+ * numbers directly instead of interpreting child nodes and allocating a
+ * NumVal for each constant. Operands of an unexpected type go through the
+ * generic Val methods, so errors are the same as for the original node.
+ */
+
+#include "specialize.h"
+#include "val.h"
+#include "env.h"
+
+static const PTR(Val) TRUE_VAL = NEW(BoolVal)(true);
+static const PTR(Val) FALSE_VAL = NEW(BoolVal)(false);
+
+/*
+ * AddVarConstExpr
+ */
+
+AddVarConstExpr::AddVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs) : AddExpr(lhs, rhs) {
+    var_ = lhs;
+    val_ = rhs->val_;
+}
+
+PTR(Val) AddVarConstExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs = var_->lookup(env);
+    PTR(NumVal) num = CAST(NumVal)(lhs);
+
+    if (num != nullptr) {
+        return NEW(NumVal)(num->val_ + val_);
+    }
+
+    return lhs->add_to(NEW(NumVal)(val_));
+}
+
+/*
+ * AddVarVarExpr
+ */
+
+AddVarVarExpr::AddVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs) : AddExpr(lhs, rhs) {
+    lhs_var_ = lhs;
+    rhs_var_ = rhs;
+}
+
+PTR(Val) AddVarVarExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs = lhs_var_->lookup(env);
+    PTR(Val) rhs = rhs_var_->lookup(env);
+    PTR(NumVal) lhs_num = CAST(NumVal)(lhs);
+    PTR(NumVal) rhs_num = CAST(NumVal)(rhs);
+
+    if (lhs_num != nullptr && rhs_num != nullptr) {
+        return NEW(NumVal)(lhs_num->val_ + rhs_num->val_);
+    }
+
+    return lhs->add_to(rhs);
+}
+
+/*
+ * MultVarConstExpr
+ */
+
+MultVarConstExpr::MultVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs) : MultExpr(lhs, rhs) {
+    var_ = lhs;
+    val_ = rhs->val_;
+}
+
+PTR(Val) MultVarConstExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs = var_->lookup(env);
+    PTR(NumVal) num = CAST(NumVal)(lhs);
+
+    if (num != nullptr) {
+        return NEW(NumVal)(num->val_ * val_);
+    }
+
+    return lhs->mult_with(NEW(NumVal)(val_));
+}
+
+/*
+ * MultVarVarExpr
+ */
+
+MultVarVarExpr::MultVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs) : MultExpr(lhs, rhs) {
+    lhs_var_ = lhs;
+    rhs_var_ = rhs;
+}
+
+PTR(Val) MultVarVarExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs = lhs_var_->lookup(env);
+    PTR(Val) rhs = rhs_var_->lookup(env);
+    PTR(NumVal) lhs_num = CAST(NumVal)(lhs);
+    PTR(NumVal) rhs_num = CAST(NumVal)(rhs);
+
+    if (lhs_num != nullptr && rhs_num != nullptr) {
+        return NEW(NumVal)(lhs_num->val_ * rhs_num->val_);
+    }
+
+    return lhs->mult_with(rhs);
+}
+
+/*
+ * EqVarConstExpr
+ */
+
+EqVarConstExpr::EqVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs) : EqExpr(lhs, rhs) {
+    var_ = lhs;
+    val_ = rhs->val_;
+}
+
+PTR(Val) EqVarConstExpr::do_interp(PTR(Env) env) {
+    PTR(NumVal) num = CAST(NumVal)(var_->lookup(env));
+
+    return num != nullptr && num->val_ == val_ ? TRUE_VAL : FALSE_VAL;
+}
+
+/*
+ * EqVarVarExpr
+ */
+
+EqVarVarExpr::EqVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs) : EqExpr(lhs, rhs) {
+    lhs_var_ = lhs;
+    rhs_var_ = rhs;
+}
+
+PTR(Val) EqVarVarExpr::do_interp(PTR(Env) env) {
+    PTR(Val) lhs = lhs_var_->lookup(env);
+
+    return lhs->equals(rhs_var_->lookup(env)) ? TRUE_VAL : FALSE_VAL;
+}
+
+/*
+ * IfEqConstExpr
+ */
+
+IfEqConstExpr::IfEqConstExpr(PTR(EqExpr) condition, PTR(Expr) then_part, PTR(Expr) else_part)
+        : IfExpr(condition, then_part, else_part) {
+    var_ = CAST(VarExpr)(condition->lhs_);
+    val_ = CAST(NumExpr)(condition->rhs_)->val_;
+}
+
+PTR(Val) IfEqConstExpr::do_interp(PTR(Env) env) {
+    PTR(NumVal) num = CAST(NumVal)(var_->lookup(env));
+
+    if (num != nullptr && num->val_ == val_) {
+        return then_->interp(env);
+    }
+
+    return else_->interp(env);
+}
+
+/*
+ * Specializer
+ */
+
+/**
+ * \brief replace the nodes of an expression that have a specialized form
+ * \param e the expression, whose children are updated in place
+ * \return the rewritten expression
+ */
+PTR(Expr) Specializer::rewrite(PTR(Expr) e) {
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        a->lhs_ = rewrite(a->lhs_);
+        a->rhs_ = rewrite(a->rhs_);
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        m->lhs_ = rewrite(m->lhs_);
+        m->rhs_ = rewrite(m->rhs_);
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        q->lhs_ = rewrite(q->lhs_);
+        q->rhs_ = rewrite(q->rhs_);
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        i->condition_ = rewrite(i->condition_);
+        i->then_ = rewrite(i->then_);
+        i->else_ = rewrite(i->else_);
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        l->rhs_ = rewrite(l->rhs_);
+        l->body_ = rewrite(l->body_);
+    }
+    else if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        f->body_ = rewrite(f->body_);
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        c->callee_ = rewrite(c->callee_);
+        c->arg_ = rewrite(c->arg_);
+    }
+
+    PTR(Expr) result = replace(e);
+
+    if (result != e) {
+        result->typed_ = e->typed_;
+        result->cost_ = e->cost_;
+    }
+
+    return result;
+}
+
+/**
+ * \brief the specialized form of a node whose children are already rewritten
+ * \return the new node, or e if there is none
+ */
+PTR(Expr) Specializer::replace(PTR(Expr) e) {
+    PTR(Expr) lhs, rhs;
+
+    if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        lhs = a->lhs_;
+        rhs = a->rhs_;
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        lhs = m->lhs_;
+        rhs = m->rhs_;
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        lhs = q->lhs_;
+        rhs = q->rhs_;
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        PTR(EqExpr) condition = CAST(EqExpr)(i->condition_);
+
+        if (condition != nullptr && CAST(VarExpr)(condition->lhs_) != nullptr &&
+            CAST(NumExpr)(condition->rhs_) != nullptr) {
+            // the condition was counted as eq-var-const but is never run now
+            counts_["eq-var-const"]--;
+            counts_["if-eq-const"]++;
+            return NEW(IfEqConstExpr)(condition, i->then_, i->else_);
+        }
+
+        return e;
+    }
+    else {
+        return e;
+    }
+
+    PTR(VarExpr) lhs_var = CAST(VarExpr)(lhs);
+    PTR(VarExpr) rhs_var = CAST(VarExpr)(rhs);
+    PTR(NumExpr) rhs_num = CAST(NumExpr)(rhs);
+
+    if (lhs_var == nullptr || (rhs_var == nullptr && rhs_num == nullptr)) {
+        return e;
+    }
+
+    if (CAST(AddExpr)(e) != nullptr) {
+        if (rhs_num != nullptr) {
+            counts_["add-var-const"]++;
+            return NEW(AddVarConstExpr)(lhs_var, rhs_num);
+        }
+        counts_["add-var-var"]++;
+        return NEW(AddVarVarExpr)(lhs_var, rhs_var);
+    }
+    if (CAST(MultExpr)(e) != nullptr) {
+        if (rhs_num != nullptr) {
+            counts_["mult-var-const"]++;
+            return NEW(MultVarConstExpr)(lhs_var, rhs_num);
+        }
+        counts_["mult-var-var"]++;
+        return NEW(MultVarVarExpr)(lhs_var, rhs_var);
+    }
+    if (rhs_num != nullptr) {
+        counts_["eq-var-const"]++;
+        return NEW(EqVarConstExpr)(lhs_var, rhs_num);
+    }
+    counts_["eq-var-var"]++;
+    return NEW(EqVarVarExpr)(lhs_var, rhs_var);
+}
+
+/**
+ * \brief the number of nodes replaced by rewrite() so far
+ */
+int Specializer::total() {
+    int n = 0;
+
+    for (auto& count : counts_) {
+        n += count.second;
+    }
+
+    return n;
+}
@@ -0,0 +1,95 @@
+/**
+ * \file specialize.h
+ * \brief Declarations of the specialized expression nodes and the pass
+ * that introduces them
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include "expr.h"
+#include <map>
+#include <string>
+
+// x + c
+class AddVarConstExpr : public AddExpr {
+public:
+    PTR(VarExpr) var_;
+    int          val_;
+
+    AddVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// x + y
+class AddVarVarExpr : public AddExpr {
+public:
+    PTR(VarExpr) lhs_var_;
+    PTR(VarExpr) rhs_var_;
+
+    AddVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// x * c
+class MultVarConstExpr : public MultExpr {
+public:
+    PTR(VarExpr) var_;
+    int          val_;
+
+    MultVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// x * y
+class MultVarVarExpr : public MultExpr {
+public:
+    PTR(VarExpr) lhs_var_;
+    PTR(VarExpr) rhs_var_;
+
+    MultVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// x == c
+class EqVarConstExpr : public EqExpr {
+public:
+    PTR(VarExpr) var_;
+    int          val_;
+
+    EqVarConstExpr(PTR(VarExpr) lhs, PTR(NumExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// x == y
+class EqVarVarExpr : public EqExpr {
+public:
+    PTR(VarExpr) lhs_var_;
+    PTR(VarExpr) rhs_var_;
+
+    EqVarVarExpr(PTR(VarExpr) lhs, PTR(VarExpr) rhs);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+// _if x == c _then ... _else ...
+class IfEqConstExpr : public IfExpr {
+public:
+    PTR(VarExpr) var_;
+    int          val_;
+
+    IfEqConstExpr(PTR(EqExpr) condition, PTR(Expr) then_part, PTR(Expr) else_part);
+    PTR(Val) do_interp(PTR(Env) env) override;
+};
+
+class Specializer {
+public:
+    // number of nodes replaced, by kind such as "add-var-const"
+    std::map<std::string, int> counts_;
+
+    PTR(Expr) rewrite(PTR(Expr) e);
+    int       total();
+
+private:
+    PTR(Expr) replace(PTR(Expr) e);
+};
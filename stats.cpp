@@ -0,0 +1,123 @@
+/**
+ * \file stats.cpp
+ * \brief Definitions of the statistics used to compare benchmark runs and
+ * to fit how costs grow
+ * \author Laura Zhang
+ *
+ * Timings are skewed, with long tails from interrupts and cache effects,
+ * so runs are compared with the Mann-Whitney U test, which only uses the
+ * order of the samples, instead of a t-test on their means.
+ */
+
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * \brief the middle sample, or the mean of the two middle ones
+ */
+double median(std::vector<double> samples) {
+    if (samples.empty()) {
+        throw std::runtime_error("median of no samples");
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+
+    return n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+/**
+ * \brief test whether two samples come from the same distribution
+ * \param a the first sample
+ * \param b the second sample
+ * \return U of a, and the two-sided p-value from the normal
+ * approximation with tie and continuity corrections
+ */
+MannWhitney mann_whitney(const std::vector<double>& a, const std::vector<double>& b) {
+    if (a.empty() || b.empty()) {
+        throw std::runtime_error("Mann-Whitney test of an empty sample");
+    }
+
+    // every sample with the sample it came from, in order
+    std::vector<std::pair<double, int>> all;
+    for (double x : a) {
+        all.push_back({x, 0});
+    }
+    for (double y : b) {
+        all.push_back({y, 1});
+    }
+    std::sort(all.begin(), all.end());
+
+    double n1 = (double) a.size();
+    double n2 = (double) b.size();
+    double n = n1 + n2;
+    double rank_sum = 0;
+    double ties = 0;
+
+    // equal samples share the mean of the ranks they span
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) {
+            j++;
+        }
+
+        double rank = (i + 1 + j) / 2.0;
+        double t = (double) (j - i);
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second == 0) {
+                rank_sum += rank;
+            }
+        }
+        ties += t * t * t - t;
+        i = j;
+    }
+
+    double u = rank_sum - n1 * (n1 + 1) / 2;
+    double mean = n1 * n2 / 2;
+    double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+
+    if (variance <= 0) {
+        // every sample is equal
+        return {u, 1};
+    }
+
+    double z = std::max(0.0, std::fabs(u - mean) - 0.5) / std::sqrt(variance);
+
+    return {u, std::erfc(z / std::sqrt(2.0))};
+}
+
+/**
+ * \brief fit cost = c * size^k by least squares on a log-log scale
+ * \param sizes the input sizes, all positive
+ * \param costs the cost at each size, all positive
+ * \return the exponent k
+ */
+double growth_exponent(const std::vector<double>& sizes, const std::vector<double>& costs) {
+    if (sizes.size() != costs.size() || sizes.size() < 2) {
+        throw std::runtime_error("growth exponent needs two or more sizes with a cost each");
+    }
+
+    size_t n = sizes.size();
+    double mean_x = 0;
+    double mean_y = 0;
+    for (size_t i = 0; i < n; i++) {
+        mean_x += std::log(sizes[i]) / n;
+        mean_y += std::log(costs[i]) / n;
+    }
+
+    double sxy = 0;
+    double sxx = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dx = std::log(sizes[i]) - mean_x;
+        sxy += dx * (std::log(costs[i]) - mean_y);
+        sxx += dx * dx;
+    }
+    if (sxx == 0) {
+        throw std::runtime_error("growth exponent needs two or more distinct sizes");
+    }
+
+    return sxy / sxx;
+}
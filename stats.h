@@ -0,0 +1,22 @@
+/**
+ * \file stats.h
+ * \brief Declarations of the statistics used to compare benchmark runs and
+ * to fit how costs grow
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include <vector>
+
+// the result of a Mann-Whitney U test of two samples a and b
+struct MannWhitney {
+    // number of pairs (x from a, y from b) with x > y, ties counting half
+    double u_;
+    // two-sided p-value of the two samples coming from one distribution
+    double p_;
+};
+
+double      median(std::vector<double> samples);
+MannWhitney mann_whitney(const std::vector<double>& a, const std::vector<double>& b);
+double      growth_exponent(const std::vector<double>& sizes, const std::vector<double>& costs);
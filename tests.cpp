@@ -2,10 +2,24 @@
  * \file tests.cpp
  * \brief Generate random tests
  * \author Laura Zhang
+ *
+ * With one msdscript, checks that printing and pretty printing keep the
+ * value of random expressions. With two, checks that they agree on random
+ * expressions and compares their CPU time and memory. The runs go through
+ * an ExecPool, so as many run at once as there are cores, or with
+ * --worker first through one msdscript --worker per program and mode.
  */
 
 #include "exec.h"
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 std::string random_var();
 std::string random_expr_string();
@@ -94,86 +108,219 @@ std::string random_nested_expr() {
     return random_nested_expr() + "*" + random_nested_expr();
 }
 
+// random expressions to try, and how long one run may take
+static const int cases = 200;
+static const double timeout_seconds = 10;
+
+/**
+ * \brief the expression msdscript printed after a label such as
+ * "print value: ", up to the dashed line closing the result
+ */
+static std::string printed_value(const std::string& out, const std::string& label) {
+    size_t begin = out.find(label);
+    if (begin == std::string::npos) {
+        return "";
+    }
+    begin += label.size();
+
+    return out.substr(begin, out.find("\n--------------------", begin) - begin) + "\n";
+}
+
+// run each program as a --worker and feed it every input, instead of
+// starting it once per input
+static bool use_workers = false;
+
+/**
+ * \brief run the jobs through the pool, or with --worker through one
+ * persistent msdscript per program and mode, kept for later calls
+ */
+static std::vector<ExecResult> run_jobs(ExecPool& pool, const std::vector<ExecJob>& jobs) {
+    static std::map<std::vector<std::string>, std::unique_ptr<ExecWorker>> workers;
+
+    if (! use_workers) {
+        return pool.run(jobs);
+    }
+
+    std::vector<ExecResult> results;
+    for (const ExecJob& j : jobs) {
+        // --interp becomes --worker=interp, and so on
+        std::vector<std::string> argv = {j.argv[0], "--worker=" + j.argv[1].substr(2)};
+        std::unique_ptr<ExecWorker>& worker = workers[argv];
+
+        if (! worker) {
+            worker.reset(new ExecWorker(argv, timeout_seconds));
+        }
+        results.push_back(worker->run(j.input));
+    }
+
+    return results;
+}
+
+static ExecJob job(const char* program, const char* mode, const std::string& input) {
+    ExecJob j;
+    j.argv = {program, mode};
+    j.input = input;
+
+    return j;
+}
+
+static void check_finished(const ExecResult& r, const std::string& what, const std::string& in) {
+    if (r.timed_out) {
+        throw std::runtime_error("Error: " + what + " timed out on " + in);
+    }
+    if (r.exit_code != 0) {
+        throw std::runtime_error("Error: " + what + " did not exit 0 on " + in);
+    }
+}
+
+/**
+ * \brief print the CPU time and peak memory of two builds over the same
+ * runs, and the cases where the second was slowest relative to the first
+ */
+static void report_performance(const std::vector<std::string>& inputs,
+                               const std::vector<ExecResult>& results, int runs_per_case) {
+    double cpu[2] = {0, 0};
+    long rss[2] = {0, 0};
+    std::vector<std::pair<double, size_t>> ratios;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        double case_cpu[2] = {0, 0};
+
+        for (int k = 0; k < runs_per_case; k++) {
+            for (int b = 0; b < 2; b++) {
+                const ExecResult& r = results[(i * runs_per_case + k) * 2 + b];
+                case_cpu[b] += r.user_ms + r.sys_ms;
+                rss[b] = std::max(rss[b], r.max_rss_kb);
+            }
+        }
+        cpu[0] += case_cpu[0];
+        cpu[1] += case_cpu[1];
+        ratios.push_back({(case_cpu[1] + 0.1) / (case_cpu[0] + 0.1), i});
+    }
+
+    std::sort(ratios.rbegin(), ratios.rend());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "CPU time: " << cpu[0] << " ms vs " << cpu[1] << " ms, peak RSS: "
+              << rss[0] << " KB vs " << rss[1] << " KB" << std::endl;
+    std::cout << "cases slowest on the second build relative to the first:" << std::endl;
+    for (size_t i = 0; i < ratios.size() && i < 5; i++) {
+        std::string in = inputs[ratios[i].second];
+        in.pop_back();
+        std::cout << "  " << std::setprecision(2) << ratios[i].first << "x  "
+                  << (in.size() > 60 ? in.substr(0, 60) + "..." : in) << std::endl;
+    }
+}
+
 int tests_main(int argc, char* argv[]) {
     srand(time(nullptr));
 
+    if (argc > 1 && std::string(argv[1]) == "--worker") {
+        use_workers = true;
+        argc--;
+        argv++;
+    }
+
     if (argc < 2 || argc > 3) {
         std::cerr << "Error: Two or three arguments are required." << std::endl;
         exit(1);
     }
 
-    const char* const interp1_argv[] = {argv[1], "--interp"};
-    const char* const print1_argv[] = {argv[1], "--print"};
-    const char* const pretty_print1_argv[] = {argv[1], "--pretty-print"};
+    ExecPool pool(std::max(1, (int) std::thread::hardware_concurrency()), timeout_seconds);
 
     if (argc == 2) {
-        for (int i = 0; i < 100; i++) {
-            std::string in = random_nested_expr();
-            std::cout << "Trying " << in << "\n";
-
-            // throw error message if any of the tests did not exit 0
-            ExecResult interp_result = exec_program(2, interp1_argv, in);
-            if (interp_result.exit_code != 0) {
-                throw std::runtime_error("Error: interp() did not exit 0");
-            }
+        std::vector<std::string> inputs;
+        std::vector<ExecJob> jobs;
 
-            ExecResult print_result = exec_program(2, print1_argv, in);
-            if (interp_result.exit_code != 0) {
-                throw std::runtime_error("Error: print() did not exit 0");
-            }
+        for (int i = 0; i < cases; i++) {
+            inputs.push_back(random_nested_expr() + "\n");
+            jobs.push_back(job(argv[1], "--interp", inputs[i]));
+            jobs.push_back(job(argv[1], "--print", inputs[i]));
+            jobs.push_back(job(argv[1], "--pretty-print", inputs[i]));
+        }
 
-            ExecResult pretty_print_result = exec_program(2, pretty_print1_argv, in);
-            if (interp_result.exit_code != 0) {
-                throw std::runtime_error("Error: pretty_print() did not exit 0");
-            }
+        // throw error message if any of the tests did not exit 0
+        std::vector<ExecResult> first = run_jobs(pool, jobs);
+        jobs.clear();
+
+        for (int i = 0; i < cases; i++) {
+            check_finished(first[3 * i], "interp()", inputs[i]);
+            check_finished(first[3 * i + 1], "print()", inputs[i]);
+            check_finished(first[3 * i + 2], "pretty_print()", inputs[i]);
+
+            std::string pretty = printed_value(first[3 * i + 2].out, "pretty print value: \n");
+            jobs.push_back(job(argv[1], "--interp", printed_value(first[3 * i + 1].out, "print value: ")));
+            jobs.push_back(job(argv[1], "--interp", pretty));
+            jobs.push_back(job(argv[1], "--pretty-print", pretty));
+        }
 
-            // throw error message if any of the tests has different result
-            ExecResult interp_print_result = exec_program(2, interp1_argv, print_result.out);
-            if (interp_print_result.out != interp_result.out) {
+        // throw error message if any of the tests has different result
+        std::vector<ExecResult> second = run_jobs(pool, jobs);
+
+        for (int i = 0; i < cases; i++) {
+            std::cout << "Trying " << inputs[i];
+
+            if (second[3 * i].out != first[3 * i].out) {
                 throw std::runtime_error("Error: different result for interp() and print()");
             }
-
-            ExecResult interp_pretty_print_result = exec_program(2, interp1_argv, pretty_print_result.out);
-            if (interp_pretty_print_result.out != interp_result.out) {
+            if (second[3 * i + 1].out != first[3 * i].out) {
                 throw std::runtime_error("Error: different result for interp() and pretty_print()");
             }
-
-            ExecResult pretty_print_pretty_print_result = exec_program(2, pretty_print1_argv, pretty_print_result.out);
-            if (pretty_print_pretty_print_result.out != pretty_print_result.out) {
+            if (second[3 * i + 2].out != first[3 * i + 2].out) {
                 throw std::runtime_error("Error: different result for pretty_print() and pretty_print()");
             }
         }
     }
     else if (argc == 3) {
-        const char* const interp2_argv[] = {argv[2], "--interp"};
-        const char* const print2_argv[] = {argv[2], "--print"};
-        const char* const pretty_print2_argv[] = {argv[2], "--pretty-print"};
+        const char* const modes[] = {"--interp", "--print", "--pretty-print"};
+        const char* const names[] = {"interp", "print", "pretty_print"};
+        std::vector<std::string> inputs;
+        std::vector<ExecJob> jobs;
+
+        // every run of the first build is followed by the same run of the second
+        for (int i = 0; i < cases; i++) {
+            inputs.push_back(random_expr_string() + "\n");
+            for (const char* mode : modes) {
+                jobs.push_back(job(argv[1], mode, inputs[i]));
+                jobs.push_back(job(argv[2], mode, inputs[i]));
+            }
+        }
+
+        std::vector<ExecResult> results = run_jobs(pool, jobs);
 
-        for (int i = 0; i < 100; ++i) {
-            std::string in = random_expr_string();
-            std::cout << "Trying " << in << "\n";
+        for (int i = 0; i < cases; i++) {
+            std::cout << "Trying " << inputs[i];
 
             // throw error message if any of the tests did not return the same result
-            ExecResult interp1_result = exec_program(2, interp1_argv, in);
-            ExecResult interp2_result = exec_program(2, interp2_argv, in);
-            if (interp1_result.out != interp2_result.out) {
-                throw std::runtime_error("interp results did not match");
-            }
+            for (int m = 0; m < 3; m++) {
+                const ExecResult& r1 = results[(3 * i + m) * 2];
+                const ExecResult& r2 = results[(3 * i + m) * 2 + 1];
 
-            ExecResult print1_result = exec_program(2, print1_argv, in);
-            ExecResult print2_result = exec_program(2, print2_argv, in);
-            if (print1_result.out != print2_result.out) {
-                throw std::runtime_error("print results did not match");
+                if (r1.timed_out || r2.timed_out) {
+                    throw std::runtime_error(std::string(names[m]) + " timed out");
+                }
+                if (r1.out != r2.out) {
+                    throw std::runtime_error(std::string(names[m]) + " results did not match");
+                }
             }
+        }
 
-            ExecResult pretty_print1_result = exec_program(2, pretty_print1_argv, in);
-            ExecResult pretty_print2_result = exec_program(2, pretty_print2_argv, in);
-            if (pretty_print1_result.out != pretty_print2_result.out) {
-                throw std::runtime_error("pretty_print results did not match");
-            }
+        // workers do not report CPU time or memory per input
+        if (! use_workers) {
+            report_performance(inputs, results, 3);
         }
     }
 
     std::cout << "All tests passed!" << std::endl;
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    try {
+        return tests_main(argc, argv);
+    }
+    catch (std::runtime_error exn) {
+        std::cerr << exn.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,194 @@
+/**
+ * \file trace.cpp
+ * \brief Definitions of the trace-event recorder behind --trace
+ * \author Laura Zhang
+ *
+ * Each thread records its events in a ring buffer of its own, so recording
+ * takes no lock: the thread writes the next slot and moves its head. Only
+ * the first event of a thread takes a lock, to add its ring to the list
+ * write() reads at exit. When a ring is full the oldest events are
+ * overwritten and counted as dropped. write() prints the Chrome trace-event
+ * JSON format that chrome://tracing and ui.perfetto.dev open, with one
+ * complete ("X") event per span.
+ */
+
+#include "trace.h"
+#include "sample.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool Trace::enabled = false;
+bool Trace::calls = false;
+
+typedef std::chrono::steady_clock trace_clock;
+
+struct Event {
+    const char* name_;
+    // the body of the called function of a call span until name_calls()
+    // turns it into label_
+    const Expr* body_;
+    std::string label_;
+    bool        call_;
+    int         line_;
+    double      start_us_;
+    double      dur_us_;
+};
+
+struct Ring {
+    std::vector<Event> events_;
+    // number of events ever recorded, the next one goes in head_ % size
+    std::atomic<long>  head_{0};
+    // events before this one have their calls named
+    long               named_ = 0;
+    int                tid_;
+};
+
+static std::mutex rings_mutex;
+static std::vector<Ring*> rings;
+static int ring_capacity = 1 << 16;
+static trace_clock::time_point epoch = trace_clock::now();
+
+static thread_local Ring* ring = nullptr;
+
+/**
+ * \brief start recording, forgetting the events recorded so far
+ * \param capacity events kept per thread
+ */
+void Trace::start(int capacity) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+
+    ring_capacity = capacity;
+    for (Ring* r : rings) {
+        r->events_.assign(capacity, Event());
+        r->head_ = 0;
+        r->named_ = 0;
+    }
+    epoch = trace_clock::now();
+    enabled = true;
+}
+
+/**
+ * \brief microseconds since start()
+ */
+double Trace::now() {
+    return std::chrono::duration<double, std::micro>(trace_clock::now() - epoch).count();
+}
+
+/**
+ * \brief record a span that started at start_us and ends now
+ * \param name the event name, a string literal
+ * \param start_us when the span started, from now()
+ * \param line the input line, or 0
+ * \param body the body of the called function for a call span, or nullptr
+ */
+void Trace::record(const char* name, double start_us, int line, const Expr* body) {
+    double end_us = now();
+
+    if (ring == nullptr) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+
+        ring = new Ring();
+        ring->events_.assign(ring_capacity, Event());
+        ring->tid_ = (int) rings.size() + 1;
+        rings.push_back(ring);
+    }
+
+    long head = ring->head_.load(std::memory_order_relaxed);
+    Event& event = ring->events_[head % ring->events_.size()];
+
+    event.name_ = name;
+    event.body_ = body;
+    event.call_ = body != nullptr;
+    event.line_ = line;
+    event.start_us_ = start_us;
+    event.dur_us_ = end_us - start_us;
+    ring->head_.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * \brief name the call spans recorded so far, so the functions they ran
+ * can be freed; call it while no thread is recording
+ */
+void Trace::name_calls() {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+
+    for (Ring* r : rings) {
+        long head = r->head_.load(std::memory_order_acquire);
+        long size = (long) r->events_.size();
+
+        for (long i = std::max(r->named_, head - size); i < head; i++) {
+            Event& event = r->events_[i % size];
+
+            if (event.body_ != nullptr) {
+                event.label_ = Sampler::label(event.body_);
+                event.body_ = nullptr;
+            }
+        }
+        r->named_ = head;
+    }
+}
+
+/**
+ * \brief the number of events overwritten because a ring was full
+ */
+long Trace::dropped() {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    long n = 0;
+
+    for (Ring* r : rings) {
+        long head = r->head_.load(std::memory_order_acquire);
+        if (head > (long) r->events_.size()) {
+            n += head - (long) r->events_.size();
+        }
+    }
+
+    return n;
+}
+
+/**
+ * \brief print the recorded events as Chrome trace-event JSON
+ * \param out where to print
+ */
+void Trace::write(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    std::ios_base::fmtflags flags = out.flags();
+    const char* separator = "\n";
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (Ring* r : rings) {
+        long head = r->head_.load(std::memory_order_acquire);
+        long size = (long) r->events_.size();
+
+        out << separator << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << r->tid_
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread " << r->tid_ << "\"}}";
+        separator = ",\n";
+
+        for (long i = head > size ? head - size : 0; i < head; i++) {
+            const Event& event = r->events_[i % size];
+
+            out << separator << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << r->tid_
+                << ",\"ts\":" << event.start_us_ << ",\"dur\":" << event.dur_us_;
+            if (event.call_) {
+                out << ",\"cat\":\"call\",\"name\":\""
+                    << (event.body_ != nullptr ? Sampler::label(event.body_) : event.label_) << "\"";
+            }
+            else {
+                out << ",\"cat\":\"phase\",\"name\":\"" << event.name_ << "\"";
+            }
+            if (event.line_ > 0) {
+                out << ",\"args\":{\"line\":" << event.line_ << "}";
+            }
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+    out.flags(flags);
+}
@@ -0,0 +1,76 @@
+/**
+ * \file trace.h
+ * \brief Declarations of the trace-event recorder behind --trace
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include <ostream>
+
+class Expr;
+
+class Trace {
+public:
+    // true once start() is called, checked by TraceSpan
+    static bool enabled;
+    // also record a span for every function call, checked by TraceSpan
+    static bool calls;
+
+    static void   start(int capacity = 1 << 16);
+    static double now();
+    static void   record(const char* name, double start_us, int line, const Expr* body);
+    static void   name_calls();
+    static long   dropped();
+    static void   write(std::ostream& out);
+};
+
+/**
+ * \brief records the time from its construction to its destruction as one
+ * complete event, when tracing is on
+ */
+class TraceSpan {
+public:
+    /**
+     * \param name the event name, a string literal
+     * \param line the input line it belongs to, or 0
+     */
+    explicit TraceSpan(const char* name, int line = 0) {
+        name_ = Trace::enabled ? name : nullptr;
+
+        if (name_ != nullptr) {
+            line_ = line;
+            body_ = nullptr;
+            start_us_ = Trace::now();
+        }
+    }
+
+    /**
+     * \brief the span of a function call, when calls are traced
+     * \param body the body of the called function
+     */
+    explicit TraceSpan(const Expr* body) {
+        name_ = Trace::calls ? "call" : nullptr;
+
+        if (name_ != nullptr) {
+            line_ = 0;
+            body_ = body;
+            start_us_ = Trace::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (name_ != nullptr) {
+            Trace::record(name_, start_us_, line_, body_);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    int         line_;
+    const Expr* body_;
+    double      start_us_;
+};
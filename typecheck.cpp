@@ -0,0 +1,447 @@
+/**
+ * \file typecheck.cpp
+ * \brief Definitions of the Hindley-Milner type inference pass
+ * \author Laura Zhang
+ */
+
+#include "typecheck.h"
+#include "expr.h"
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <vector>
+
+// level of a type variable that has been generalized by a _let
+static const int GENERIC = INT_MAX;
+
+// longest expression quoted in a type error
+static const int QUOTE_LIMIT = 60;
+
+/*
+ * Type
+ */
+
+Type::Type(type_kind_t kind) {
+    kind_ = kind;
+    level_ = 0;
+    id_ = 0;
+}
+
+Type::Type(PTR(Type) arg, PTR(Type) ret) {
+    kind_ = type_fun;
+    arg_ = arg;
+    ret_ = ret;
+    level_ = 0;
+    id_ = 0;
+}
+
+Type::Type(int level, int id) {
+    kind_ = type_var;
+    level_ = level;
+    id_ = id;
+}
+
+/**
+ * \brief follow the links of bound type variables
+ * \return the representative of this type
+ */
+PTR(Type) Type::resolve() {
+    PTR(Type) t = THIS;
+
+    while (t->kind_ == type_var && t->link_ != nullptr) {
+        t = t->link_;
+    }
+
+    return t;
+}
+
+/**
+ * \brief check whether the type contains no unbound type variables
+ * \return true if the type is fully known
+ */
+bool Type::is_ground() {
+    PTR(Type) t = resolve();
+
+    switch (t->kind_) {
+        case type_var:
+            return false;
+        case type_fun:
+            return t->arg_->is_ground() && t->ret_->is_ground();
+        default:
+            return true;
+    }
+}
+
+static std::string type_string(PTR(Type) t, std::map<int, std::string>& names, bool nested) {
+    t = t->resolve();
+
+    switch (t->kind_) {
+        case type_int:
+            return "int";
+        case type_bool:
+            return "bool";
+        case type_var:
+            if (names.count(t->id_) == 0) {
+                int n = (int) names.size();
+                names[t->id_] = std::string("'") + (char) ('a' + n % 26) + (n < 26 ? "" : std::to_string(n / 26));
+            }
+            return names[t->id_];
+        default: {
+            std::string s = type_string(t->arg_, names, true) + " -> " + type_string(t->ret_, names, false);
+            return nested ? "(" + s + ")" : s;
+        }
+    }
+}
+
+/**
+ * \brief convert a type to a string such as "int -> bool"
+ * \return string version of the type
+ */
+std::string Type::to_string() {
+    std::map<int, std::string> names;
+
+    return type_string(THIS, names, false);
+}
+
+/*
+ * TypeEnv
+ */
+
+class TypeEnv {
+public:
+    std::string  name_;
+    PTR(Type)    type_;
+    PTR(TypeEnv) rest_;
+
+    TypeEnv(std::string name, PTR(Type) type, PTR(TypeEnv) rest) {
+        name_ = name;
+        type_ = type;
+        rest_ = rest;
+    }
+};
+
+/*
+ * TypeInference
+ */
+
+TypeInference::TypeInference() {
+    allow_free_ = false;
+    level_ = 1;
+    next_id_ = 0;
+}
+
+/**
+ * \brief infer the type of a whole program
+ * \param e the program
+ * \return the type of the program
+ * \throw std::runtime_error describing the first type error found
+ */
+PTR(Type) TypeInference::infer(PTR(Expr) e) {
+    return infer(e, nullptr);
+}
+
+/**
+ * \brief the type inferred for a node of the last program passed to infer()
+ * \param e the node
+ * \return its type, or nullptr if the node was not visited
+ */
+PTR(Type) TypeInference::type_of(Expr* e) {
+    auto it = types_.find(e);
+
+    if (it == types_.end()) {
+        return nullptr;
+    }
+
+    return it->second->resolve();
+}
+
+/**
+ * \brief the types given to free variables when allow_free_ is set
+ */
+std::map<std::string, PTR(Type)> TypeInference::free_vars() {
+    return free_vars_;
+}
+
+static std::string quote(PTR(Expr) e) {
+    std::string s = e->to_string();
+
+    if (s.length() > QUOTE_LIMIT) {
+        s = s.substr(0, QUOTE_LIMIT - 3) + "...";
+    }
+
+    return s;
+}
+
+PTR(Type) TypeInference::infer(PTR(Expr) e, PTR(TypeEnv) env) {
+    PTR(Type) t;
+
+    if (CAST(NumExpr)(e) != nullptr) {
+        t = NEW(Type)(type_int);
+    }
+    else if (CAST(BoolExpr)(e) != nullptr) {
+        t = NEW(Type)(type_bool);
+    }
+    else if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        PTR(TypeEnv) binding = env;
+
+        while (binding != nullptr && binding->name_ != v->var_) {
+            binding = binding->rest_;
+        }
+
+        if (binding != nullptr) {
+            std::map<int, PTR(Type)> copies;
+            t = instantiate(binding->type_, copies);
+        }
+        else if (allow_free_) {
+            if (free_vars_.count(v->var_) == 0) {
+                // level 0 keeps a free variable from ever being generalized
+                free_vars_[v->var_] = NEW(Type)(0, next_id_++);
+            }
+            t = free_vars_[v->var_];
+        }
+        else {
+            throw std::runtime_error("free variable: " + v->var_);
+        }
+    }
+    else if (PTR(AddExpr) a = CAST(AddExpr)(e)) {
+        unify(NEW(Type)(type_int), infer(a->lhs_, env), a->lhs_, e);
+        unify(NEW(Type)(type_int), infer(a->rhs_, env), a->rhs_, e);
+        t = NEW(Type)(type_int);
+    }
+    else if (PTR(MultExpr) m = CAST(MultExpr)(e)) {
+        unify(NEW(Type)(type_int), infer(m->lhs_, env), m->lhs_, e);
+        unify(NEW(Type)(type_int), infer(m->rhs_, env), m->rhs_, e);
+        t = NEW(Type)(type_int);
+    }
+    else if (PTR(EqExpr) q = CAST(EqExpr)(e)) {
+        // values of different types may be compared, they are just not equal
+        infer(q->lhs_, env);
+        infer(q->rhs_, env);
+        t = NEW(Type)(type_bool);
+    }
+    else if (PTR(IfExpr) i = CAST(IfExpr)(e)) {
+        unify(NEW(Type)(type_bool), infer(i->condition_, env), i->condition_, e);
+        t = infer(i->then_, env);
+        unify(t, infer(i->else_, env), i->else_, e);
+    }
+    else if (PTR(LetExpr) l = CAST(LetExpr)(e)) {
+        level_++;
+        PTR(Type) rhs = infer(l->rhs_, env);
+        level_--;
+        generalize(rhs);
+
+        t = infer(l->body_, NEW(TypeEnv)(l->var_, rhs, env));
+    }
+    else if (PTR(FunExpr) f = CAST(FunExpr)(e)) {
+        PTR(Type) arg = fresh();
+        PTR(Type) body = infer(f->body_, NEW(TypeEnv)(f->arg_->var_, arg, env));
+
+        t = NEW(Type)(arg, body);
+    }
+    else if (PTR(CallExpr) c = CAST(CallExpr)(e)) {
+        PTR(Type) callee = infer(c->callee_, env)->resolve();
+
+        if (callee->kind_ == type_int || callee->kind_ == type_bool) {
+            throw std::runtime_error("type error: cannot call " + callee->to_string() +
+                                     " " + quote(c->callee_) + " in " + quote(e));
+        }
+
+        PTR(Type) arg = infer(c->arg_, env);
+        t = fresh();
+        unify(NEW(Type)(arg, t), callee, c->callee_, e);
+    }
+    else {
+        throw std::runtime_error("type error: unknown expression " + quote(e));
+    }
+
+    types_[e.get()] = t;
+
+    return t;
+}
+
+PTR(Type) TypeInference::fresh() {
+    return NEW(Type)(level_, next_id_++);
+}
+
+/**
+ * \brief copy a type, replacing generalized variables with fresh ones
+ * \param t the type of a _let-bound variable
+ * \param copies fresh variables already made for this instantiation
+ * \return the instantiated type
+ */
+PTR(Type) TypeInference::instantiate(PTR(Type) t, std::map<int, PTR(Type)>& copies) {
+    t = t->resolve();
+
+    if (t->kind_ == type_var && t->level_ == GENERIC) {
+        if (copies.count(t->id_) == 0) {
+            copies[t->id_] = fresh();
+        }
+
+        return copies[t->id_];
+    }
+    if (t->kind_ == type_fun) {
+        return NEW(Type)(instantiate(t->arg_, copies), instantiate(t->ret_, copies));
+    }
+
+    return t;
+}
+
+/**
+ * \brief mark the variables created inside the current _let rhs as generic
+ * \param t the type of the rhs
+ */
+void TypeInference::generalize(PTR(Type) t) {
+    t = t->resolve();
+
+    if (t->kind_ == type_var && t->level_ > level_) {
+        t->level_ = GENERIC;
+    }
+    else if (t->kind_ == type_fun) {
+        generalize(t->arg_);
+        generalize(t->ret_);
+    }
+}
+
+/**
+ * \brief check that a variable does not occur in t, and lower the level of
+ * the variables of t to the variable's level since they now share a scope
+ */
+static bool occurs(PTR(Type) var, PTR(Type) t) {
+    t = t->resolve();
+
+    if (t == var) {
+        return true;
+    }
+    if (t->kind_ == type_var) {
+        t->level_ = std::min(t->level_, var->level_);
+        return false;
+    }
+    if (t->kind_ == type_fun) {
+        return occurs(var, t->arg_) || occurs(var, t->ret_);
+    }
+
+    return false;
+}
+
+typedef enum {
+    unify_ok,
+    unify_mismatch,
+    unify_recursive,
+} unify_result_t;
+
+/**
+ * \brief bind type variables so that a and b are equal
+ * \param bound collects the variables bound, so a failed unification can
+ * be taken back
+ */
+static unify_result_t unify_types(PTR(Type) a, PTR(Type) b, std::vector<PTR(Type)>& bound) {
+    a = a->resolve();
+    b = b->resolve();
+
+    if (a == b) {
+        return unify_ok;
+    }
+    if (a->kind_ != type_var && b->kind_ == type_var) {
+        std::swap(a, b);
+    }
+    if (a->kind_ == type_var) {
+        if (occurs(a, b)) {
+            return unify_recursive;
+        }
+
+        a->link_ = b;
+        bound.push_back(a);
+        return unify_ok;
+    }
+    if (a->kind_ != b->kind_) {
+        return unify_mismatch;
+    }
+    if (a->kind_ == type_fun) {
+        unify_result_t r = unify_types(a->arg_, b->arg_, bound);
+
+        if (r != unify_ok) {
+            return r;
+        }
+
+        return unify_types(a->ret_, b->ret_, bound);
+    }
+
+    return unify_ok;
+}
+
+/**
+ * \brief make two types equal or report a type error
+ * \param expected the type the context requires
+ * \param found the type inferred for the subexpression
+ * \param at the subexpression
+ * \param in the expression containing it
+ */
+void TypeInference::unify(PTR(Type) expected, PTR(Type) found, PTR(Expr) at, PTR(Expr) in) {
+    bound_.clear();
+
+    switch (unify_types(expected, found, bound_)) {
+        case unify_mismatch:
+            // unbind what the argument types bound before the mismatch, so
+            // the message shows the types as they were
+            for (PTR(Type) var : bound_) {
+                var->link_ = nullptr;
+            }
+            throw std::runtime_error("type error: expected " + expected->to_string() + " but found " +
+                                     found->to_string() + " for " + quote(at) + " in " + quote(in));
+        case unify_recursive:
+            throw std::runtime_error("type error: " + quote(at) + " would need a recursive type in " + quote(in));
+        default:
+            break;
+    }
+}
+
+/**
+ * \brief infer the type of a program and mark every node as type checked,
+ * which lets interp() skip the runtime type checks of its operands
+ * \param e the program
+ * \return the type of the program
+ * \throw std::runtime_error if the program is ill-typed or has free variables
+ */
+PTR(Type) typecheck(PTR(Expr) e) {
+    TypeInference ti;
+    PTR(Type) t = ti.infer(e);
+
+    std::vector<PTR(Expr)> pending = {e};
+
+    while (! pending.empty()) {
+        PTR(Expr) cur = pending.back();
+        pending.pop_back();
+        cur->typed_ = true;
+
+        if (PTR(AddExpr) a = CAST(AddExpr)(cur)) {
+            pending.push_back(a->lhs_);
+            pending.push_back(a->rhs_);
+        }
+        else if (PTR(MultExpr) m = CAST(MultExpr)(cur)) {
+            pending.push_back(m->lhs_);
+            pending.push_back(m->rhs_);
+        }
+        else if (PTR(EqExpr) q = CAST(EqExpr)(cur)) {
+            pending.push_back(q->lhs_);
+            pending.push_back(q->rhs_);
+        }
+        else if (PTR(IfExpr) i = CAST(IfExpr)(cur)) {
+            pending.push_back(i->condition_);
+            pending.push_back(i->then_);
+            pending.push_back(i->else_);
+        }
+        else if (PTR(LetExpr) l = CAST(LetExpr)(cur)) {
+            pending.push_back(l->rhs_);
+            pending.push_back(l->body_);
+        }
+        else if (PTR(FunExpr) f = CAST(FunExpr)(cur)) {
+            pending.push_back(f->body_);
+        }
+        else if (PTR(CallExpr) c = CAST(CallExpr)(cur)) {
+            pending.push_back(c->callee_);
+            pending.push_back(c->arg_);
+        }
+    }
+
+    return t;
+}
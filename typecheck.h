@@ -0,0 +1,70 @@
+/**
+ * \file typecheck.h
+ * \brief Declarations of the Hindley-Milner type inference pass
+ * \author Laura Zhang
+ */
+
+#pragma once
+
+#include "pointer.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Expr;
+
+typedef enum {
+    type_int,
+    type_bool,
+    type_fun,
+    type_var,
+} type_kind_t;
+
+CLASS(Type) {
+public:
+    type_kind_t kind_;
+    PTR(Type)   arg_;
+    PTR(Type)   ret_;
+    PTR(Type)   link_;
+    int         level_;
+    int         id_;
+
+    Type(type_kind_t kind);
+    Type(PTR(Type) arg, PTR(Type) ret);
+    Type(int level, int id);
+
+    PTR(Type)   resolve();
+    bool        is_ground();
+    std::string to_string();
+};
+
+class TypeEnv;
+
+class TypeInference {
+public:
+    // give free variables fresh types instead of rejecting the program
+    bool allow_free_;
+
+    TypeInference();
+
+    PTR(Type) infer(PTR(Expr) e);
+    PTR(Type) type_of(Expr* e);
+    std::map<std::string, PTR(Type)> free_vars();
+
+private:
+    std::unordered_map<Expr*, PTR(Type)> types_;
+    std::map<std::string, PTR(Type)>     free_vars_;
+    int                                  level_;
+    int                                  next_id_;
+    // variables bound by the unification in progress
+    std::vector<PTR(Type)>               bound_;
+
+    PTR(Type) infer(PTR(Expr) e, PTR(TypeEnv) env);
+    PTR(Type) fresh();
+    PTR(Type) instantiate(PTR(Type) t, std::map<int, PTR(Type)>& copies);
+    void      generalize(PTR(Type) t);
+    void      unify(PTR(Type) expected, PTR(Type) found, PTR(Expr) at, PTR(Expr) in);
+};
+
+PTR(Type) typecheck(PTR(Expr) e);
@@ -6,6 +6,11 @@
 
 #include "expr.h"
 #include "val.h"
+#include "env.h"
+#include "jit.h"
+#include "sample.h"
+#include "trace.h"
+#include "output.h"
 
 /*
  * NumVal
@@ -50,7 +55,9 @@ PTR(Val) NumVal::mult_with(PTR(Val) rhs) {
 }
 
 std::string NumVal::to_string() {
-    return std::to_string(val_);
+    char text[max_int_chars];
+
+    return std::string(text, format_int(text, val_));
 }
 
 bool NumVal::is_true() {
@@ -114,6 +121,13 @@ PTR(Val) BoolVal::call(PTR(Val) arg) {
 FunVal::FunVal(PTR(VarExpr) arg, PTR(Expr) body) {
     arg_ = arg;
     body_ = body;
+    env_ = Env::empty;
+}
+
+FunVal::FunVal(PTR(VarExpr) arg, PTR(Expr) body, PTR(Env) env) {
+    arg_ = arg;
+    body_ = body;
+    env_ = env;
 }
 
 PTR(Expr) FunVal::to_expr() {
@@ -148,5 +162,34 @@ bool FunVal::is_true() {
 }
 
 PTR(Val) FunVal::call(PTR(Val) arg) {
-    return body_->interp(NEW(ExtendedEnv)(arg_->var_, arg, env_));
+    SampledCall sampled(body_.get());
+    TraceSpan traced(body_.get());
+
+    if (native_ != nullptr) {
+        PTR(NumVal) n = CAST(NumVal)(arg);
+
+        if (n != nullptr) {
+            return native_->call(n->val_);
+        }
+    }
+
+    PTR(Env) env = NEW(ExtendedEnv)(arg_->var_, arg, env_);
+    env->lexical_ = true;
+
+    return body_->interp(env);
+}
+
+/**
+ * \brief call the function without evaluating the argument first
+ * \param arg the argument expression, evaluated on first use in the body
+ * \param env the environment of the call site
+ * \return the value of the body
+ */
+PTR(Val) FunVal::call_by_need(PTR(Expr) arg, PTR(Env) env) {
+    SampledCall sampled(body_.get());
+    TraceSpan traced(body_.get());
+    PTR(Env) arg_env = NEW(LazyEnv)(arg_->var_, arg, env, env_);
+    arg_env->lexical_ = true;
+
+    return body_->interp(arg_env);
 }
@@ -13,6 +13,7 @@
 class Expr;
 class VarExpr;
 class Env;
+class JitCode;
 
 class Val {
 public:
@@ -60,8 +61,11 @@ public:
     PTR(VarExpr) arg_;
     PTR(Expr)    body_;
     PTR(Env)     env_;
+    // compiled body used when the argument is a number, or nullptr
+    PTR(JitCode) native_;
 
     FunVal(PTR(VarExpr) arg, PTR(Expr) body);
+    FunVal(PTR(VarExpr) arg, PTR(Expr) body, PTR(Env) env);
 
     PTR(Expr)   to_expr() override;
     bool        equals(PTR(Val) rhs) override;
@@ -70,4 +74,5 @@ public:
     std::string to_string() override;
     bool        is_true() override;
     PTR(Val)    call(PTR(Val) arg) override;
+    PTR(Val)    call_by_need(PTR(Expr) arg, PTR(Env) env);
 };